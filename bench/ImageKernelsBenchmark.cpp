@@ -0,0 +1,81 @@
+// Marcus Schmidt
+// Created on 9/16/23
+
+/* Measures how many megapixels per second each image kernel gets through with every instruction set the processor supports, on a synthetic
+ * 24 megapixel photo (about what a current camera produces). Each kernel is run several times and the fastest run counts, which keeps one-off
+ * interruptions out of the numbers. Build and run it with "make benchmark". */
+
+#include "ImageKernels.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+constexpr int WIDTH = 6000, HEIGHT = 4000, RUNS = 5;
+
+static double Measure(std::function<void()> kernel)
+{
+	double best = 1e30;
+	for (int run = 0; run < RUNS; run++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		kernel();
+		best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	return (double) WIDTH * HEIGHT / 1e6 / best;
+}
+
+int main()
+{
+	// Smooth gradients with some noise, so nothing about the data is unusually easy
+	std::vector<unsigned char> image((std::size_t) WIDTH * HEIGHT * 3);
+	uint32_t noise = 1;
+	for (int y = 0; y < HEIGHT; y++)
+		for (int x = 0; x < WIDTH; x++)
+		{
+			noise = noise * 1664525 + 1013904223;
+			unsigned char *pixel = &image[((std::size_t) y * WIDTH + x) * 3];
+			pixel[0] = (unsigned char) (x * 255 / WIDTH + (noise >> 28));
+			pixel[1] = (unsigned char) (y * 255 / HEIGHT + (noise >> 24 & 15));
+			pixel[2] = (unsigned char) ((x + y) * 127 / (WIDTH + HEIGHT) + (noise >> 20 & 15));
+		}
+
+	std::vector<unsigned char> output((std::size_t) WIDTH * HEIGHT * 4);
+	const ImageKernels::Layout bgra = { 2, 1, 0, 3 };
+	struct Kernel
+	{
+		const char *name;
+		std::function<void()> run;
+	};
+	std::vector<Kernel> kernels = {
+		{ "downscale to 1920x1280", [&]() { ImageKernels::Downscale(image.data(), WIDTH, HEIGHT, 3, output.data(), 1920, 1280); } },
+		{ "downscale to 4800x3200", [&]() { ImageKernels::Downscale(image.data(), WIDTH, HEIGHT, 3, output.data(), 4800, 3200); } },
+		{ "turn a quarter clockwise", [&]() { ImageKernels::Orient(image.data(), WIDTH, HEIGHT, 3, 6, output.data()); } },
+		{ "turn upside down", [&]() { ImageKernels::Orient(image.data(), WIDTH, HEIGHT, 3, 3, output.data()); } },
+		{ "convert to BGRA", [&]() { ImageKernels::ConvertToDisplay(image.data(), (std::size_t) WIDTH * HEIGHT, bgra, output.data()); } },
+	};
+
+	std::vector<ImageKernels::InstructionSet> sets;
+	for (ImageKernels::InstructionSet set : { ImageKernels::InstructionSet::SCALAR, ImageKernels::InstructionSet::SSSE3, ImageKernels::InstructionSet::AVX2 })
+		if (set <= ImageKernels::GetSupported())
+			sets.push_back(set);
+
+	std::printf("%-26s", "megapixels per second");
+	for (ImageKernels::InstructionSet set : sets)
+		std::printf("%10s", ImageKernels::GetName(set));
+	std::printf("\n");
+
+	for (const Kernel &kernel : kernels)
+	{
+		std::printf("%-26s", kernel.name);
+		for (ImageKernels::InstructionSet set : sets)
+		{
+			ImageKernels::SetInstructionSet(set);
+			std::printf("%10.0f", Measure(kernel.run));
+		}
+		std::printf("\n");
+	}
+	return 0;
+}
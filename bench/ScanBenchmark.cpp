@@ -0,0 +1,289 @@
+// Marcus Schmidt
+// Created on 9/30/23
+
+/* Times a full scan of a synthetic photo library the way "Refresh Viewer" does it: every top-level directory is collected with
+ * RecurseGetImages() (with filters on some of them), the root directory's own images are added, and the sorted runs are merged with
+ * MergeVectors() (and shuffled for the random order). The library is generated first, with a configurable shape:
+ *
+ *   --files N[,N...]  library sizes to measure, each generated and scanned in turn (default 1000,10000,100000)
+ *   --depth D         levels of directories below the root (default 3)
+ *   --fanout F        subdirectories in every directory above the last level (default 4)
+ *   --copies P        fraction of images that also have a copy-named duplicate such as "IMG_0000042 copy.jpg" (default 0.1)
+ *   --filters K       filter folders, each used as an INCLUDE or EXCLUDE filter on one top-level directory (default 2)
+ *   --runs R          scans per measurement, of which the fastest counts (default 3)
+ *   --directory PATH  where to generate the libraries (default: a new directory in the system's temporary directory)
+ *   --keep            leave the generated libraries in place
+ *
+ * Every combination of library size, sort method and catalog state (empty, or warm from the previous scan) is printed as one CSV line on
+ * standard output, so results can be compared between builds. Progress goes to standard error. Build and run it with "make scan_benchmark". */
+
+#include "StaticUtilities.h"
+#include "DirectoryReader.h"
+#include "FileTable.h"
+#include "FileTypeRegistry.h"
+#include "Filter.h"
+#include "ScanCatalog.h"
+#include "CaptureTimeCache.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+struct Options
+{
+	std::vector<long> sizes = { 1000, 10000, 100000 };
+	int depth = 3;
+	int fanout = 4;
+	double copies = 0.1;
+	int filters = 2;
+	int runs = 3;
+	std::filesystem::path directory;
+	bool keep = false;
+};
+
+struct Result
+{
+	double scanMilliseconds = 1e30;
+	double mergeMilliseconds = 1e30;
+	std::size_t files = 0;
+	uint64_t systemCalls = 0;
+};
+
+// A tiny linear congruential generator, so that the same options always generate the same library
+static uint32_t Random(uint32_t &state)
+{
+	state = state * 1664525 + 1013904223;
+	return state >> 8;
+}
+
+static bool ParseOptions(int argc, char **argv, Options &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string option = argv[i];
+		if (option == "--keep")
+		{
+			options.keep = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+			return false;
+
+		std::string value = argv[++i];
+		if (option == "--files")
+		{
+			options.sizes.clear();
+			std::stringstream stream(value);
+			std::string size;
+			while (std::getline(stream, size, ','))
+				options.sizes.push_back(std::atol(size.c_str()));
+		}
+		else if (option == "--depth")
+			options.depth = std::atoi(value.c_str());
+		else if (option == "--fanout")
+			options.fanout = std::atoi(value.c_str());
+		else if (option == "--copies")
+			options.copies = std::atof(value.c_str());
+		else if (option == "--filters")
+			options.filters = std::atoi(value.c_str());
+		else if (option == "--runs")
+			options.runs = std::atoi(value.c_str());
+		else if (option == "--directory")
+			options.directory = value;
+		else
+			return false;
+	}
+
+	return !options.sizes.empty() && options.depth >= 1 && options.fanout >= 1 && options.runs >= 1 && options.filters >= 0;
+}
+
+static void CreateFile(const std::filesystem::path &path, uint32_t &state)
+{
+	std::ofstream(path).close();
+
+	// Spread the modification times over a few years so that sorting by date has real work to do
+	std::error_code error;
+	std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now() - std::chrono::seconds(Random(state) % (3 * 365 * 86400)), error);
+}
+
+/* Generate a library of 'size' files under 'root/library' spread evenly over its directories, mostly JPEGs with some PNGs, videos and files
+ * of unknown types, and 'filters' filter folders under 'root/filters' that each hold copies of a sample of the library's names. Returns the
+ * number of directories in the library */
+static std::size_t GenerateLibrary(const std::filesystem::path &root, long size, const Options &options)
+{
+	std::filesystem::path library = root / "library";
+	std::vector<std::filesystem::path> directories = { library };
+	std::filesystem::create_directories(library);
+	for (std::size_t level = 0, first = 0; level < (std::size_t) options.depth; level++)
+	{
+		std::size_t last = directories.size();
+		for (std::size_t parent = first; parent < last; parent++)
+			for (int child = 0; child < options.fanout; child++)
+			{
+				directories.push_back(directories[parent] / ("folder " + std::to_string(child)));
+				std::filesystem::create_directory(directories.back());
+			}
+		first = last;
+	}
+
+	const char *extensions[] = { ".jpg", ".jpg", ".jpg", ".jpg", ".jpg", ".jpg", ".png", ".mp4", ".txt" };
+	uint32_t state = (uint32_t) size;
+	long made = 0;
+	for (long i = 0; made < size; i++)
+	{
+		char name[32];
+		std::snprintf(name, sizeof(name), "IMG_%07ld", i);
+		const char *extension = extensions[Random(state) % 9];
+		CreateFile(directories[i % directories.size()] / (name + std::string(extension)), state);
+		made++;
+
+		// Put the copy somewhere else, the way duplicates end up in a library
+		if (made < size && Random(state) % 1000 < options.copies * 1000)
+		{
+			std::string copy = name + std::string(Random(state) % 2 ? " copy" : " copy 2") + extension;
+			CreateFile(directories[(i + 1 + Random(state)) % directories.size()] / copy, state);
+			made++;
+		}
+	}
+
+	// Each filter folder holds a copy of every tenth name, so filters match a realistic share of the library
+	for (int filter = 0; filter < options.filters; filter++)
+	{
+		std::filesystem::path folder = root / "filters" / std::to_string(filter);
+		std::filesystem::create_directories(folder);
+		for (long i = filter; i < size; i += 10)
+		{
+			char name[48];
+			std::snprintf(name, sizeof(name), "IMG_%07ld copy.jpg", i);
+			CreateFile(folder / name, state);
+		}
+	}
+
+	return directories.size();
+}
+
+// The top-level directories as the viewer lists them, with the filters put on the first few
+static std::vector<Directory> GetDirectories(const std::filesystem::path &root, const Options &options)
+{
+	std::vector<Directory> directories;
+	for (const auto &entry : std::filesystem::directory_iterator(root / "library"))
+	{
+		if (!entry.is_directory())
+			continue;
+
+		Directory directory;
+		directory.name = entry.path().filename().string();
+		directory.active = true;
+		directories.push_back(directory);
+	}
+	std::sort(directories.begin(), directories.end(), [](const Directory &a, const Directory &b) { return a.name < b.name; });
+
+	for (int filter = 0; filter < options.filters && filter < (int) directories.size(); filter++)
+	{
+		Filter *rule = new Filter();
+		rule->SetFilter(filter % 2 == 0 ? Filter::EXCLUDE : Filter::INCLUDE, (root / "filters" / std::to_string(filter)).string());
+		directories[filter].filters.push_back(rule);
+	}
+	return directories;
+}
+
+// One scan and merge, the same steps as ImageViewer::GetImages()
+static void Scan(const std::filesystem::path &library, std::vector<Directory> directories, SortMethod sortMethod, const FileTypeRegistry &fileTypes,
+				 Result &result)
+{
+	DirectoryReader::ResetStatistics();
+	FileTable::Get().Clear();
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::vector<File>> runs;
+	for (Directory directory : directories)
+		StaticUtilities::RecurseGetImages(library, sortMethod, fileTypes, &directory, runs);
+
+	std::vector<File> rootFiles;
+	StaticUtilities::GetDirectoryImages(library.string(), fileTypes, {}, true, rootFiles);
+	StaticUtilities::SortFiles(rootFiles, sortMethod);
+	runs.push_back(std::move(rootFiles));
+	auto scanned = std::chrono::steady_clock::now();
+
+	std::vector<File> files = StaticUtilities::MergeVectors(runs, sortMethod);
+	if (sortMethod == SortMethod::RANDOM)
+		StaticUtilities::ShuffleFiles(files, 1);
+	auto merged = std::chrono::steady_clock::now();
+
+	result.scanMilliseconds = std::min(result.scanMilliseconds, std::chrono::duration<double, std::milli>(scanned - start).count());
+	result.mergeMilliseconds = std::min(result.mergeMilliseconds, std::chrono::duration<double, std::milli>(merged - scanned).count());
+	result.files = files.size();
+	result.systemCalls = DirectoryReader::GetStatistics().GetSystemCalls();
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		std::cerr << "Usage: " << argv[0] << " [--files N[,N...]] [--depth D] [--fanout F] [--copies P] [--filters K] [--runs R] [--directory PATH] [--keep]"
+				  << std::endl;
+		return 1;
+	}
+	if (options.directory.empty())
+		options.directory = std::filesystem::temp_directory_path() / ("TotalPhotoScanBenchmark-" + std::to_string(getpid()));
+
+	FileTypeRegistry fileTypes;
+	const std::pair<SortMethod, const char *> sortMethods[] = { { SortMethod::NAME, "name" }, { SortMethod::DATE, "date" }, { SortMethod::CAPTURE_DATE, "taken" },
+												 { SortMethod::RANDOM, "random" } };
+	std::cout << "files,directories,sort,catalog,scan_ms,merge_ms,total_ms,found,system_calls" << std::endl;
+
+	for (long size : options.sizes)
+	{
+		std::filesystem::path root = options.directory / std::to_string(size);
+		std::error_code error;
+		std::filesystem::remove_all(root, error);
+		std::cerr << "Generating " << size << " files in " << root.string() << std::endl;
+		std::size_t directoryCount = GenerateLibrary(root, size, options);
+		std::vector<Directory> directories = GetDirectories(root, options);
+
+		for (const auto &sortMethod : sortMethods)
+		{
+			// An empty catalog is a first scan, and a warm one is a refresh where nothing changed (where the filters are cached too)
+			for (bool warm : { false, true })
+			{
+				Result result;
+				for (int run = 0; run < options.runs; run++)
+				{
+					if (!warm)
+					{
+						ScanCatalog::Get().Clear();
+						CaptureTimeCache::Get().Clear();
+						Filter::ClearCache();
+					}
+					Scan(root / "library", directories, sortMethod.first, fileTypes, result);
+				}
+
+				std::cout << size << "," << directoryCount << "," << sortMethod.second << "," << (warm ? "warm" : "empty") << "," << result.scanMilliseconds << ","
+						  << result.mergeMilliseconds << "," << result.scanMilliseconds + result.mergeMilliseconds << "," << result.files << ","
+						  << result.systemCalls << std::endl;
+			}
+		}
+
+		for (Directory &directory : directories)
+			for (Filter *filter : directory.filters)
+				delete filter;
+		if (!options.keep)
+			std::filesystem::remove_all(root, error);
+	}
+
+	if (!options.keep)
+	{
+		std::error_code error;
+		std::filesystem::remove(options.directory, error);
+	}
+	return 0;
+}
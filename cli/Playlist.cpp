@@ -0,0 +1,381 @@
+// Marcus Schmidt
+// Created on 10/7/23
+
+/* Prints the list of images that the viewer would show, one path per line, without opening a window. It uses the same scan as "Refresh
+ * Viewer" (ImageViewer::GetImages()), so the list and its order are exactly the viewer's, and it only needs wxWidgets' base library, so it
+ * runs on a server without a display. The directory list is set up the same way as in the viewer's side panel, with every top-level directory
+ * starting out inactive, and these options are applied in the order they're given, the same as clicking through the panel:
+ *
+ *   --activate DIR            activate a directory and everything listed beneath it (DIR is relative to the root, e.g. "2023/Italy")
+ *   --deactivate DIR          deactivate a directory and everything listed beneath it
+ *   --include DIR=FOLDER      add an INCLUDE filter with the images in FOLDER to a directory
+ *   --exclude DIR=FOLDER      add an EXCLUDE filter with the images in FOLDER to a directory
+ *   --include-content DIR=FOLDER, --exclude-content DIR=FOLDER
+ *                             the same, but matching images by their contents rather than their names (see Filter::CONTENT)
+ *
+ * Naming a nested directory lists the subdirectories of its parents first, the way expanding them in the panel does, so they start out with
+ * their parent's state and copies of its filters. The other options are:
+ *
+ *   --sort METHOD             name, date (modified), taken (the capture date, see CaptureTimeCache) or random (default name)
+ *   --seed N                  the seed of the random order, to reproduce one the viewer showed (default: a new one, printed to standard error)
+ *   --filetypes PATH          the file types config file (default: the built-in types)
+ *   --catalog PATH            a scan catalog to load and save, which makes repeated runs fast (default: none, so nothing is kept in memory)
+ *   --capture-times PATH      a cache of capture times to load and save, so that sorting by capture date only reads new files (default: none)
+ *   --fingerprints PATH       a cache of content fingerprints to load and save, so that content filters only read new files (default: none)
+ *   --null                    end every path with a null character instead of a new line, for "xargs -0"
+ *   --statistics              report the time, system calls and memory the scan took on standard error
+ *   --trace PATH              record where the scan spends its time and write it to PATH as a trace (see Trace::Export())
+ *
+ * Only the paths go to standard output; everything else goes to standard error. The sorted runs are merged straight into the output instead of
+ * into a list of their own, and the paths are built in the output buffer from the packed names in the FileTable, so the memory used is the
+ * 24-byte entries and the names themselves, which holds up with millions of images. Build it with "make playlist". */
+
+#include "StaticUtilities.h"
+#include "DirectoryReader.h"
+#include "FileTable.h"
+#include "FileTypeRegistry.h"
+#include "Filter.h"
+#include "ScanCatalog.h"
+#include "CaptureTimeCache.h"
+#include "FingerprintCache.h"
+#include "Trace.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// A change to the directory list, applied in the order they were given
+struct DirectoryChange
+{
+	enum Type { ACTIVATE, DEACTIVATE, INCLUDE, EXCLUDE };
+
+	Type type;
+	std::string directory;
+	std::string filterPath;
+	Filter::Match match = Filter::NAME;
+};
+
+struct Options
+{
+	std::filesystem::path root;
+	SortMethod sortMethod = SortMethod::NAME;
+	uint64_t seed = 0;
+	bool seedGiven = false;
+	std::vector<DirectoryChange> changes;
+	std::string fileTypesPath;
+	std::string catalogPath;
+	std::string captureTimesPath;
+	std::string fingerprintsPath;
+	std::string tracePath;
+	char separator = '\n';
+	bool statistics = false;
+};
+
+static bool ParseOptions(int argc, char **argv, Options &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string option = argv[i];
+		if (option == "--null")
+		{
+			options.separator = '\0';
+			continue;
+		}
+		else if (option == "--statistics")
+		{
+			options.statistics = true;
+			continue;
+		}
+		else if (option.compare(0, 2, "--") != 0)
+		{
+			if (!options.root.empty())
+				return false;
+			options.root = option;
+			continue;
+		}
+		if (i + 1 >= argc)
+			return false;
+
+		std::string value = argv[++i];
+		if (option == "--sort")
+		{
+			if (value == "name")
+				options.sortMethod = SortMethod::NAME;
+			else if (value == "date")
+				options.sortMethod = SortMethod::DATE;
+			else if (value == "taken")
+				options.sortMethod = SortMethod::CAPTURE_DATE;
+			else if (value == "random")
+				options.sortMethod = SortMethod::RANDOM;
+			else
+				return false;
+		}
+		else if (option == "--seed")
+		{
+			char *end = nullptr;
+			options.seed = std::strtoull(value.c_str(), &end, 10);
+			options.seedGiven = true;
+			if (value.empty() || *end != '\0')
+				return false;
+		}
+		else if (option == "--activate")
+			options.changes.push_back({ DirectoryChange::ACTIVATE, value, "" });
+		else if (option == "--deactivate")
+			options.changes.push_back({ DirectoryChange::DEACTIVATE, value, "" });
+		else if (option == "--include" || option == "--exclude" || option == "--include-content" || option == "--exclude-content")
+		{
+			std::size_t equals = value.find('=');
+			if (equals == std::string::npos || equals + 1 == value.size())
+				return false;
+			DirectoryChange::Type type = (option.compare(0, 9, "--include") == 0) ? DirectoryChange::INCLUDE : DirectoryChange::EXCLUDE;
+			Filter::Match match = (option.size() > 9 && option.compare(option.size() - 8, 8, "-content") == 0) ? Filter::CONTENT : Filter::NAME;
+			options.changes.push_back({ type, value.substr(0, equals), value.substr(equals + 1), match });
+		}
+		else if (option == "--filetypes")
+			options.fileTypesPath = value;
+		else if (option == "--catalog")
+			options.catalogPath = value;
+		else if (option == "--capture-times")
+			options.captureTimesPath = value;
+		else if (option == "--fingerprints")
+			options.fingerprintsPath = value;
+		else if (option == "--trace")
+			options.tracePath = value;
+		else
+			return false;
+	}
+
+	return !options.root.empty();
+}
+
+// The same list as ImageViewer::GetSubdirectories(): every directory in 'path' by name, with the parent's activation state and copies of its filters
+static std::vector<Directory> GetSubdirectories(const std::filesystem::path &path, Directory *parent)
+{
+	std::vector<Directory> subdirectories;
+	std::error_code error;
+	for (const auto &entry : std::filesystem::directory_iterator(path, error))
+	{
+		if (entry.is_directory(error))
+		{
+			Directory subdirectory = { { entry.path().filename().string(), parent != nullptr && parent->active }, parent };
+			if (parent != nullptr)
+			{
+				for (const auto &filter : parent->filters)
+					subdirectory.filters.push_back(filter->GetCopy());
+			}
+			StaticUtilities::SortAlphabetically(subdirectories, subdirectory);
+		}
+	}
+
+	if (error)
+		std::cerr << "Unable to list \"" << path.string() << "\": " << error.message() << std::endl;
+	return subdirectories;
+}
+
+// Find a directory by its path from the root, listing the subdirectories of each parent on the way the first time it's passed through
+static Directory * FindDirectory(const std::filesystem::path &root, std::vector<Directory> &directories, const std::string &path)
+{
+	std::filesystem::path directoryPath = root;
+	std::vector<Directory> *list = &directories;
+	Directory *directory = nullptr;
+	for (const auto &component : std::filesystem::path(path).lexically_normal())
+	{
+		if (component.empty() || component == ".")
+			continue;
+
+		// Everything that's listed beneath a directory points back at it, so its list can't change once it's been made
+		if (directory != nullptr)
+		{
+			if (!directory->expanded)
+			{
+				directory->subdirectories = GetSubdirectories(directoryPath, directory);
+				directory->expanded = true;
+			}
+			list = &directory->subdirectories;
+		}
+
+		directory = nullptr;
+		for (Directory &candidate : *list)
+		{
+			if (candidate.name == component.string())
+				directory = &candidate;
+		}
+		if (directory == nullptr)
+			return nullptr;
+		directoryPath /= component;
+	}
+
+	return directory;
+}
+
+// The same as ImageViewer::RecurseActivationState(), without the checkboxes
+static void SetActive(Directory &directory, bool active)
+{
+	directory.active = active;
+	for (Directory &subdirectory : directory.subdirectories)
+		SetActive(subdirectory, active);
+}
+
+static void DeleteFilters(std::vector<Directory> &directories)
+{
+	for (Directory &directory : directories)
+	{
+		for (Filter *filter : directory.filters)
+			delete filter;
+		DeleteFilters(directory.subdirectories);
+	}
+}
+
+// Add a file's path straight to the output buffer rather than building it as a string first
+static void WritePath(const FileTable &table, const File &file, char separator)
+{
+	const std::string &directory = table.GetDirectory(file.directory);
+	std::string_view name = table.GetOriginalName(file);
+	std::fwrite(directory.data(), 1, directory.size(), stdout);
+	std::fwrite(name.data(), 1, name.size(), stdout);
+	std::fputc(separator, stdout);
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		std::cerr << "Usage: " << argv[0] << " ROOT [--activate DIR] [--deactivate DIR] [--include DIR=FOLDER] [--exclude DIR=FOLDER]"
+				  << " [--include-content DIR=FOLDER] [--exclude-content DIR=FOLDER] [--sort name|date|taken|random] [--seed N] [--filetypes PATH]"
+				  << " [--catalog PATH] [--capture-times PATH] [--fingerprints PATH] [--null] [--statistics] [--trace PATH]" << std::endl;
+		return 1;
+	}
+
+	std::error_code error;
+	if (!std::filesystem::is_directory(options.root, error))
+	{
+		std::cerr << "\"" << options.root.string() << "\" is not a directory" << std::endl;
+		return 1;
+	}
+
+	// The scanning code reports problems on standard output, which is reserved for the paths here
+	std::cout.rdbuf(std::cerr.rdbuf());
+
+	FileTypeRegistry fileTypes;
+	if (!options.fileTypesPath.empty())
+		fileTypes.Load(options.fileTypesPath);
+
+	// Without a catalog file to save to, there's no reason to keep every directory's listing around until the program ends
+	if (!options.catalogPath.empty())
+		ScanCatalog::Get().Load(options.catalogPath);
+	else
+		ScanCatalog::Get().SetCaching(false);
+	if (!options.captureTimesPath.empty())
+		CaptureTimeCache::Get().Load(options.captureTimesPath);
+	if (!options.fingerprintsPath.empty())
+		FingerprintCache::Get().Load(options.fingerprintsPath);
+
+	std::vector<Directory> directories = GetSubdirectories(options.root, nullptr);
+	for (const DirectoryChange &change : options.changes)
+	{
+		Directory *directory = FindDirectory(options.root, directories, change.directory);
+		if (directory == nullptr)
+		{
+			std::cerr << "There's no directory \"" << change.directory << "\" in \"" << options.root.string() << "\"" << std::endl;
+			DeleteFilters(directories);
+			return 1;
+		}
+
+		if (change.type == DirectoryChange::ACTIVATE || change.type == DirectoryChange::DEACTIVATE)
+			SetActive(*directory, change.type == DirectoryChange::ACTIVATE);
+		else
+		{
+			Filter *filter = new Filter();
+			filter->SetFilter(change.type == DirectoryChange::INCLUDE ? Filter::INCLUDE : Filter::EXCLUDE, change.filterPath, change.match);
+			directory->filters.push_back(filter);
+		}
+	}
+
+	if (options.sortMethod == SortMethod::RANDOM && !options.seedGiven)
+	{
+		options.seed = StaticUtilities::GetRandomSeed();
+		std::cerr << "Random order seed: " << options.seed << std::endl;
+	}
+
+	if (!options.tracePath.empty())
+		Trace::Start();
+
+	// The same steps as ImageViewer::GetImages(): a sorted run for every directory and one for the root directory's own images
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	DirectoryReader::ResetStatistics();
+	std::vector<std::vector<File>> runs;
+	for (Directory directory : directories)
+		StaticUtilities::RecurseGetImages(options.root, options.sortMethod, fileTypes, &directory, runs);
+
+	std::vector<File> rootFiles;
+	StaticUtilities::GetDirectoryImages(options.root.string(), fileTypes, {}, true, rootFiles);
+	StaticUtilities::SortFiles(rootFiles, options.sortMethod);
+	runs.push_back(std::move(rootFiles));
+	std::chrono::steady_clock::time_point scanned = std::chrono::steady_clock::now();
+
+	std::size_t listMemory = 0;
+	for (const auto &run : runs)
+		listMemory += run.capacity() * sizeof(File);
+
+	// A random order shuffles the whole name order, so only that one needs the merged list
+	const FileTable &table = FileTable::Get();
+	std::size_t count = 0;
+	static char buffer[1 << 20];
+	std::setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+	if (options.sortMethod == SortMethod::RANDOM)
+	{
+		std::vector<File> files = StaticUtilities::MergeVectors(runs, options.sortMethod);
+		StaticUtilities::ShuffleFiles(files, options.seed);
+		for (const File &file : files)
+			WritePath(table, file, options.separator);
+		count = files.size();
+	}
+	else
+	{
+		StaticUtilities::MergeRuns(runs, options.sortMethod, [&](File &file)
+		{
+			WritePath(table, file, options.separator);
+			count++;
+		});
+	}
+	std::fflush(stdout);
+	std::chrono::steady_clock::time_point written = std::chrono::steady_clock::now();
+
+	if (!options.catalogPath.empty())
+		ScanCatalog::Get().Save();
+	CaptureTimeCache::Get().Save();
+	FingerprintCache::Get().Save();
+	DeleteFilters(directories);
+
+	if (!options.tracePath.empty())
+	{
+		Trace::Stop();
+		if (!Trace::Export(options.tracePath))
+			std::cerr << "Unable to write the trace to \"" << options.tracePath << "\"" << std::endl;
+	}
+
+	if (options.statistics)
+	{
+		ScanStatistics statistics = DirectoryReader::GetStatistics();
+		std::size_t tableMemory = table.GetMemoryUsage();
+		std::cerr << count << " files in " << std::chrono::duration<double, std::milli>(written - start).count() << " ms ("
+				  << std::chrono::duration<double, std::milli>(scanned - start).count() << " ms scanning, "
+				  << std::chrono::duration<double, std::milli>(written - scanned).count() << " ms merging and writing)" << std::endl;
+		std::cerr << statistics.GetSystemCalls() << " system calls for " << statistics.entries << " entries" << std::endl;
+		if (count > 0)
+			std::cerr << (double) (listMemory + tableMemory) / count << " bytes per file (" << listMemory << " list, " << tableMemory << " table for "
+					  << table.GetDirectoryCount() << " directories)" << std::endl;
+	}
+
+	if (std::ferror(stdout))
+	{
+		std::cerr << "Unable to write the list" << std::endl;
+		return 1;
+	}
+	return 0;
+}
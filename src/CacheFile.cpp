@@ -0,0 +1,83 @@
+// Marcus Schmidt
+// Created on 11/18/23
+
+#include "CacheFile.h"
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <iostream>
+
+/* FNV-1a, continued from 'hash' so that the key of a path can be built from its directory and name without putting them together first
+ * (Reference: http://www.isthe.com/chongo/tech/comp/fnv/index.html) */
+uint64_t CacheFile::GetKey(std::string_view text, uint64_t hash)
+{
+	for (char character : text)
+		hash = (hash ^ (unsigned char) character) * 0x100000001b3;
+	return hash;
+}
+
+/* Read every record of a cache file into 'records', 'recordWords' words per record. Returns false if there's no file or it isn't a valid one,
+ * in which case the cache starts out empty */
+bool CacheFile::Read(const std::string &path, uint64_t magic, std::size_t recordWords, std::vector<uint64_t> &records)
+{
+	records.clear();
+	std::ifstream stream(path, std::ios::binary | std::ios::ate);
+	if (!stream)
+		return false;
+
+	const std::size_t RECORD_SIZE = recordWords * sizeof(uint64_t);
+	uint64_t size = (uint64_t) stream.tellg(), header[2];
+	stream.seekg(0);
+	if (!stream.read(reinterpret_cast<char *>(header), sizeof(header)) || header[0] != magic || header[1] != (size - sizeof(header)) / RECORD_SIZE
+		|| (size - sizeof(header)) % RECORD_SIZE != 0)
+	{
+		std::cout << "CacheFile::Read(): Discarding unreadable cache \"" << path << "\"" << std::endl;
+		return false;
+	}
+
+	records.resize(header[1] * recordWords);
+	if (!stream.read(reinterpret_cast<char *>(records.data()), records.size() * sizeof(uint64_t)))
+	{
+		std::cout << "CacheFile::Read(): Discarding unreadable cache \"" << path << "\"" << std::endl;
+		records.clear();
+		return false;
+	}
+
+	return true;
+}
+
+// Replace a cache file with 'records', 'recordWords' words per record. Returns false (leaving the old file in place) if it can't be written
+bool CacheFile::Write(const std::string &path, uint64_t magic, std::size_t recordWords, const std::vector<uint64_t> &records)
+{
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+	std::string temporaryPath = path + ".tmp";
+	{
+		uint64_t header[2] = { magic, (uint64_t) (records.size() / recordWords) };
+		std::ofstream stream(temporaryPath, std::ios::binary | std::ios::trunc);
+		stream.write(reinterpret_cast<const char *>(header), sizeof(header));
+		stream.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(uint64_t));
+		if (!stream)
+		{
+			std::cout << "CacheFile::Write(): Unable to write \"" << temporaryPath << "\"" << std::endl;
+			std::filesystem::remove(temporaryPath, error);
+			return false;
+		}
+	}
+
+	std::filesystem::rename(temporaryPath, path, error);
+	if (error)
+	{
+		std::cout << "CacheFile::Write(): Unable to replace \"" << path << "\" (" << error.message() << ")" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Delete a cache file, if there is one
+void CacheFile::Remove(const std::string &path)
+{
+	std::error_code error;
+	if (!path.empty())
+		std::filesystem::remove(path, error);
+}
@@ -0,0 +1,28 @@
+// Marcus Schmidt
+// Created on 11/18/23
+
+#ifndef CACHE_FILE
+#define CACHE_FILE
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* What the caches of facts about files (CaptureTimeCache, FingerprintCache, PerceptualHashCache and ThumbnailCache) have in common: entries are
+ * remembered by a hash of the file's path, and (except for thumbnails) saved as a header of a magic number and a record count followed by
+ * records of a fixed number of 64-bit words, the first of which is the key. Like the scan catalog these are just caches: a file that's missing,
+ * unreadable or from another version (a different magic number) is discarded, and a new one is written to a temporary file that replaces the
+ * old one, so that a partially written cache is never loaded. */
+class CacheFile
+{
+public:
+	static uint64_t GetKey(std::string_view text, uint64_t hash = KEY_BASIS);
+	static bool Read(const std::string &path, uint64_t magic, std::size_t recordWords, std::vector<uint64_t> &records);
+	static bool Write(const std::string &path, uint64_t magic, std::size_t recordWords, const std::vector<uint64_t> &records);
+	static void Remove(const std::string &path);
+
+	constexpr static uint64_t KEY_BASIS = 0xcbf29ce484222325; // the key of an empty path
+};
+
+#endif
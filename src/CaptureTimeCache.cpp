@@ -0,0 +1,216 @@
+// Marcus Schmidt
+// Created on 10/21/23
+
+#include "CaptureTimeCache.h"
+#include "CacheFile.h"
+#include "ExifReader.h"
+#include "FileTable.h"
+#include "MovieReader.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include <algorithm>
+
+CaptureTimeCache & CaptureTimeCache::Get()
+{
+	static CaptureTimeCache cache;
+	return cache;
+}
+
+// Drop the files that haven't been started and wait for every task to finish before the members go away (see ~ThumbnailCache())
+CaptureTimeCache::~CaptureTimeCache()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	queue.clear();
+	listeners.clear();
+	tasksFinished.wait(lock, [this]() { return tasks == 0; });
+}
+
+// Read the saved capture times, unless the file is the one that's already open (every viewer window shares the same cache)
+void CaptureTimeCache::Load(std::string _path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_path == path)
+		return;
+
+	path = _path;
+	entries.clear();
+	changed = false;
+
+	std::vector<uint64_t> records;
+	CacheFile::Read(path, MAGIC, RECORD_WORDS, records);
+	entries.reserve(records.size() / RECORD_WORDS);
+	for (std::size_t i = 0; i < records.size(); i += RECORD_WORDS)
+		entries[records[i]] = { (int64_t) records[i + 1], (int64_t) records[i + 2] };
+}
+
+void CaptureTimeCache::Save()
+{
+	std::string savePath;
+	std::vector<uint64_t> records;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!changed || path.empty())
+			return;
+		changed = false;
+
+		savePath = path;
+		records.reserve(entries.size() * RECORD_WORDS);
+		for (const auto &entry : entries)
+		{
+			records.push_back(entry.first);
+			records.push_back((uint64_t) entry.second.modifiedTime);
+			records.push_back((uint64_t) entry.second.captureTime);
+		}
+	}
+
+	CacheFile::Write(savePath, MAGIC, RECORD_WORDS, records);
+}
+
+// Forget every capture time (and delete the saved file) so that they're all read again. Files that are being read right now are still stored
+void CaptureTimeCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	entries.clear();
+	for (const Job &job : queue)
+		queued.erase(job.key);
+	queue.clear();
+	changed = false;
+	CacheFile::Remove(path);
+}
+
+/* Give every file in 'files' its capture time in the FileTable, as far as it's known. Only the metadata at the start of each file (or the box
+ * headers on the way to it in a video) is read, in batches on the thread pool. A HEADLESS build waits for them and adds the results to the cache
+ * all at once; otherwise the files that aren't cached keep sorting by their modification times and are read in the background (see Listen()) */
+void CaptureTimeCache::Resolve(const std::vector<File> &files)
+{
+	Trace::Span span("ResolveCaptureTimes");
+	FileTable &table = FileTable::Get();
+	std::vector<std::size_t> missing;
+	std::vector<uint64_t> keys(files.size());
+	std::size_t newJobs = 0;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (std::size_t i = 0; i < files.size(); i++)
+		{
+			keys[i] = CacheFile::GetKey(table.GetOriginalName(files[i]), CacheFile::GetKey(table.GetDirectory(files[i].directory)));
+			auto iterator = entries.find(keys[i]);
+			if (iterator != entries.end() && iterator->second.modifiedTime == (int64_t) files[i].modifiedTime)
+				table.SetCaptureTime(files[i], (time_t) iterator->second.captureTime);
+#ifdef HEADLESS
+			else
+				missing.push_back(i);
+#else
+			else if (queued.insert(keys[i]).second)
+			{
+				queue.push_back({ keys[i], table.GetPath(files[i]), table.GetType(files[i]), files[i].modifiedTime });
+				newJobs++;
+			}
+#endif
+		}
+		tasks += (newJobs + BATCH_SIZE - 1) / BATCH_SIZE;
+	}
+
+	for (std::size_t task = 0; task < (newJobs + BATCH_SIZE - 1) / BATCH_SIZE; task++)
+	{
+		ThreadPool::Get().Submit([this]()
+		{
+			ReadNext();
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--tasks == 0)
+				tasksFinished.notify_all();
+		});
+	}
+	if (missing.empty())
+		return;
+
+	// Every task writes to its own part of 'times' and to different files' records, so nothing needs a lock until the results are recorded
+	std::vector<time_t> times(missing.size());
+	auto ReadBatch = [&files, &table, &missing, &times](std::size_t start)
+	{
+		for (std::size_t i = start; i < std::min(start + BATCH_SIZE, missing.size()); i++)
+		{
+			const File &file = files[missing[i]];
+			times[i] = ReadCaptureTime(table.GetPath(file), table.GetType(file));
+			table.SetCaptureTime(file, times[i]);
+		}
+	};
+
+	ThreadPool &pool = ThreadPool::Get();
+	if (pool.GetThreadCount() > 1 && missing.size() > BATCH_SIZE)
+	{
+		TaskGroup group(pool);
+		for (std::size_t start = 0; start < missing.size(); start += BATCH_SIZE)
+			group.Run([&ReadBatch, start]() { ReadBatch(start); });
+		group.Wait();
+	}
+	else
+	{
+		for (std::size_t start = 0; start < missing.size(); start += BATCH_SIZE)
+			ReadBatch(start);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for (std::size_t i = 0; i < missing.size(); i++)
+		entries[keys[missing[i]]] = { (int64_t) files[missing[i]].modifiedTime, (int64_t) times[i] };
+	changed = true;
+}
+
+/* Call 'progress' with the number of files whose capture times are still waiting to be read whenever a batch of them has been, which is from a
+ * worker thread with the cache locked. It's called with 0 once every file that was queued has been read */
+void CaptureTimeCache::Listen(const void *owner, std::function<void(std::size_t)> progress)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	listeners[owner] = progress;
+}
+
+// Stop telling an owner about progress, which must be done before the owner is destroyed
+void CaptureTimeCache::Cancel(const void *owner)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	listeners.erase(owner);
+}
+
+//********************
+// Private functions *
+//********************
+
+// Read the capture times of the next batch of files that are waiting, if there are any, and store them together
+void CaptureTimeCache::ReadNext()
+{
+	std::vector<Job> batch;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		while (batch.size() < BATCH_SIZE && !queue.empty())
+		{
+			batch.push_back(std::move(queue.front()));
+			queue.pop_front();
+		}
+	}
+	if (batch.empty())
+		return;
+
+	Trace::Span span("ReadCaptureTimes");
+	std::vector<time_t> times(batch.size());
+	for (std::size_t i = 0; i < batch.size(); i++)
+		times[i] = ReadCaptureTime(batch[i].path, batch[i].type);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for (std::size_t i = 0; i < batch.size(); i++)
+	{
+		entries[batch[i].key] = { (int64_t) batch[i].modifiedTime, (int64_t) times[i] };
+		queued.erase(batch[i].key);
+	}
+	changed = true;
+
+	for (const auto &listener : listeners)
+		listener.second(queued.size());
+}
+
+// The capture time from the file's metadata, or 0 if it doesn't have one
+time_t CaptureTimeCache::ReadCaptureTime(const std::string &path, MediaType type)
+{
+	time_t time = 0;
+	bool found = (type == MediaType::VIDEO) ? MovieReader::ReadCaptureTime(path, time) : ExifReader::ReadCaptureTime(path, time);
+	return found ? time : 0;
+}
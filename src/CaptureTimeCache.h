@@ -0,0 +1,77 @@
+// Marcus Schmidt
+// Created on 10/21/23
+
+#ifndef CAPTURE_TIME_CACHE
+#define CAPTURE_TIME_CACHE
+
+#include "CustomTypes.h"
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/* The times that photos and videos were taken, read from their metadata (see ExifReader::ReadCaptureTime() and MovieReader::ReadCaptureTime())
+ * for sorting by capture date. Modification times change whenever files are copied, but capture times travel with the files. Reading them means
+ * opening every file, so they're read in parallel on the thread pool and remembered by a hash of the path along with the modification time,
+ * which means sorting again (or after restarting) only reads files that are new or have changed. The first sort of a large library would still
+ * keep the viewer waiting, so outside of a HEADLESS build they're read in the background instead, the files sort by their modification times
+ * until then, and whoever is listening is told how many are left as they're read (like PerceptualHashCache). */
+class CaptureTimeCache
+{
+public:
+	static CaptureTimeCache & Get();
+
+	void Load(std::string _path);
+	void Save();
+	void Clear();
+
+	void Resolve(const std::vector<File> &files);
+	void Listen(const void *owner, std::function<void(std::size_t)> progress);
+	void Cancel(const void *owner);
+
+	constexpr static std::size_t BATCH_SIZE = 64; // files read by one task, which is enough to outweigh the cost of scheduling it
+
+private:
+	// A capture time of 0 records that the file doesn't have one, so that it isn't read again
+	struct Entry
+	{
+		int64_t modifiedTime;
+		int64_t captureTime;
+	};
+
+	struct Job
+	{
+		uint64_t key;
+		std::string path;
+		MediaType type;
+		time_t modifiedTime;
+	};
+
+	CaptureTimeCache() {}
+	~CaptureTimeCache();
+
+	void ReadNext();
+	static time_t ReadCaptureTime(const std::string &path, MediaType type);
+
+	constexpr static uint64_t VERSION = 1;
+	constexpr static uint64_t MAGIC = 0x434150544d450000 | VERSION; // "CAPTME" and the version
+	constexpr static std::size_t RECORD_WORDS = 3; // the key, modification time and capture time (see CacheFile)
+
+	std::string path;
+	std::unordered_map<uint64_t, Entry> entries;
+	std::deque<Job> queue; // files waiting to be read in the background
+	std::unordered_set<uint64_t> queued; // the keys of the files that are waiting or being read
+	std::unordered_map<const void *, std::function<void(std::size_t)>> listeners;
+	std::size_t tasks = 0; // tasks handed to the pool that haven't finished yet
+	std::condition_variable tasksFinished;
+	std::mutex mutex;
+	bool changed = false;
+};
+
+#endif
@@ -7,12 +7,18 @@
 #include "Filter.h"
 #include <string>
 #include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
 #include <sys/stat.h>
-#include <wx/sizer.h>
-#include <wx/button.h>
-#include <wx/checkbox.h>
+#include <wx/defs.h>
 
-enum class SortMethod { NAME = wxID_HIGHEST + 1, DATE = wxID_HIGHEST + 2, RANDOM = wxID_HIGHEST + 3 };
+// Directories only point to their controls, so the scanning code can be built without the GUI library (see HEADLESS in the Makefile)
+class wxBoxSizer;
+class wxCheckBox;
+class wxButton;
+
+enum class SortMethod { NAME = wxID_HIGHEST + 1, DATE = wxID_HIGHEST + 2, RANDOM = wxID_HIGHEST + 3, CAPTURE_DATE = wxID_HIGHEST + 4 };
 enum class MediaType { IMAGE, VIDEO, UNKNOWN };
 
 struct ToggledString
@@ -38,13 +44,35 @@ struct FileType : ToggledString
 	MediaType type;
 };
 
-struct File
+/* The filter rules that decide which images found in a directory are shown. Filters that match by name are combined into 'filterItems' (which
+ * is the filter's own cached set when there's only one), and the images they let through must also match one of the included source folders by
+ * content or by looks (if there are any) and none of the excluded ones */
+struct ScanRules
+{
+	std::shared_ptr<const std::unordered_map<std::string, int>> filterItems = std::make_shared<const std::unordered_map<std::string, int>>();
+	bool defaultValidity = true;
+	std::vector<std::shared_ptr<const FingerprintItems>> includedContent;
+	std::vector<std::shared_ptr<const FingerprintItems>> excludedContent;
+	std::vector<std::shared_ptr<const SimilarityIndex>> includedSimilar;
+	std::vector<std::shared_ptr<const SimilarityIndex>> excludedSimilar;
+};
+
+// A directory that was scanned with a set of rules, either by itself or together with everything beneath it ('recursive')
+struct ScanRoot
 {
-	std::string name;
-	std::string originalName;
 	std::string path;
+	bool recursive;
+	std::shared_ptr<const ScanRules> rules;
+};
+
+/* One entry in the list of images. Only the sort keys are stored here; the names, directory and media type live in the FileTable and
+ * are looked up by 'id' and 'directory', so an entry is 24 bytes no matter how long its path is. */
+struct File
+{
+	uint64_t nameKey; // the first 8 bytes of the standardized name, packed so that comparing keys compares the names' beginnings
 	time_t modifiedTime;
-	MediaType type;
+	uint32_t id;
+	uint32_t directory;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,257 @@
+// Marcus Schmidt
+// Created on 7/29/23
+
+#include "DirectoryReader.h"
+#include <chrono>
+#include <system_error>
+#ifdef __linux__
+#include <dirent.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+std::atomic<uint64_t> DirectoryReader::directoryStats { 0 };
+std::atomic<uint64_t> DirectoryReader::directoryOpens { 0 };
+std::atomic<uint64_t> DirectoryReader::directoryReads { 0 };
+std::atomic<uint64_t> DirectoryReader::directoryCloses { 0 };
+std::atomic<uint64_t> DirectoryReader::fileStats { 0 };
+std::atomic<uint64_t> DirectoryReader::entries { 0 };
+
+#ifdef __linux__
+// The record format returned by getdents64(). Reference: https://man7.org/linux/man-pages/man2/getdents.2.html
+struct LinuxDirectoryEntry
+{
+	uint64_t inode;
+	int64_t offset;
+	unsigned short length;
+	unsigned char type;
+	char name[];
+};
+#endif
+
+DirectoryReader::DirectoryReader(const std::string &path)
+{
+#ifdef __linux__
+	descriptor = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	directoryOpens.fetch_add(1, std::memory_order_relaxed);
+	failed = descriptor < 0;
+#else
+	this->path = path;
+	std::error_code error;
+	iterator = std::filesystem::directory_iterator(path, error);
+	directoryOpens.fetch_add(1, std::memory_order_relaxed);
+	open = !error;
+	failed = (bool) error;
+#endif
+}
+
+DirectoryReader::~DirectoryReader()
+{
+#ifdef __linux__
+	if (descriptor >= 0)
+	{
+		close(descriptor);
+		directoryCloses.fetch_add(1, std::memory_order_relaxed);
+	}
+#endif
+}
+
+bool DirectoryReader::IsOpen() const
+{
+#ifdef __linux__
+	return descriptor >= 0;
+#else
+	return open;
+#endif
+}
+
+// Whether the directory couldn't be opened or reading it stopped partway through
+bool DirectoryReader::Failed() const
+{
+	return failed;
+}
+
+// Move to the next entry, returning false once there are no more (or on an error, which Failed() reports)
+bool DirectoryReader::Next()
+{
+#ifdef __linux__
+	while (true)
+	{
+		if (position >= end)
+		{
+			if (descriptor < 0)
+				return false;
+
+			long length = syscall(SYS_getdents64, descriptor, buffer, sizeof(buffer));
+			directoryReads.fetch_add(1, std::memory_order_relaxed);
+			if (length <= 0)
+			{
+				// Everything has been read, so the directory can be closed right away
+				failed = length < 0;
+				close(descriptor);
+				directoryCloses.fetch_add(1, std::memory_order_relaxed);
+				descriptor = -1;
+				return false;
+			}
+
+			position = buffer;
+			end = buffer + length;
+		}
+
+		const LinuxDirectoryEntry *entry = reinterpret_cast<const LinuxDirectoryEntry *>(position);
+		position += entry->length;
+
+		const char *entryName = entry->name;
+		if (entryName[0] == '.' && (entryName[1] == '\0' || (entryName[1] == '.' && entryName[2] == '\0')))
+			continue;
+
+		entries.fetch_add(1, std::memory_order_relaxed);
+		name.assign(entryName);
+		haveInfo = false;
+
+		// Only links and file systems that don't report types need a stat() to find out what the entry is
+		if (entry->type == DT_DIR)
+			type = DIRECTORY;
+		else if (entry->type == DT_REG)
+			type = REGULAR_FILE;
+		else if (entry->type == DT_LNK || entry->type == DT_UNKNOWN)
+			type = Classify() ? (S_ISDIR(info.st_mode) ? DIRECTORY : S_ISREG(info.st_mode) ? REGULAR_FILE : OTHER) : OTHER;
+		else
+			type = OTHER;
+
+		return true;
+	}
+#else
+	if (!open)
+		return false;
+
+	std::error_code error;
+	if (started)
+		iterator.increment(error);
+	started = true;
+
+	if (error || iterator == std::filesystem::directory_iterator())
+	{
+		failed = (bool) error;
+		open = false;
+		return false;
+	}
+
+	entries.fetch_add(1, std::memory_order_relaxed);
+	name = iterator->path().filename().string();
+	haveInfo = false;
+
+	std::error_code typeError;
+	if (iterator->is_directory(typeError))
+		type = DIRECTORY;
+	else if (iterator->is_regular_file(typeError))
+		type = REGULAR_FILE;
+	else
+		type = OTHER;
+
+	return true;
+#endif
+}
+
+const char * DirectoryReader::GetName() const
+{
+	return name.c_str();
+}
+
+DirectoryReader::EntryType DirectoryReader::GetType() const
+{
+	return type;
+}
+
+// Get the modification time of the current entry, reusing the stat() result if one was needed to find its type
+bool DirectoryReader::GetModifiedTime(time_t &time)
+{
+	if (!haveInfo && !Classify())
+		return false;
+
+	time = info.st_mtime;
+	return true;
+}
+
+// Get a directory's modification time in nanoseconds, which is precise enough to notice a change made within the same second
+bool DirectoryReader::GetDirectoryTime(const std::string &path, int64_t &time)
+{
+	directoryStats.fetch_add(1, std::memory_order_relaxed);
+
+#ifdef __linux__
+	struct stat directoryInfo;
+	if (stat(path.c_str(), &directoryInfo) != 0)
+		return false;
+
+	time = (int64_t) directoryInfo.st_mtim.tv_sec * 1000000000 + directoryInfo.st_mtim.tv_nsec;
+	return true;
+#else
+	std::error_code error;
+	std::filesystem::file_time_type fileTime = std::filesystem::last_write_time(path, error);
+	time = fileTime.time_since_epoch().count();
+	return !error;
+#endif
+}
+
+// The time right now in the same units as GetDirectoryTime(), so that the two can be compared
+int64_t DirectoryReader::GetCurrentTime()
+{
+#ifdef __linux__
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+#else
+	return std::filesystem::file_time_type::clock::now().time_since_epoch().count();
+#endif
+}
+
+// A number of seconds in the same units as GetDirectoryTime()
+int64_t DirectoryReader::GetTimeSpan(int seconds)
+{
+#ifdef __linux__
+	return (int64_t) seconds * 1000000000;
+#else
+	return std::chrono::duration_cast<std::filesystem::file_time_type::duration>(std::chrono::seconds(seconds)).count();
+#endif
+}
+
+ScanStatistics DirectoryReader::GetStatistics()
+{
+	ScanStatistics statistics;
+	statistics.directoryStats = directoryStats.load(std::memory_order_relaxed);
+	statistics.directoryOpens = directoryOpens.load(std::memory_order_relaxed);
+	statistics.directoryReads = directoryReads.load(std::memory_order_relaxed);
+	statistics.directoryCloses = directoryCloses.load(std::memory_order_relaxed);
+	statistics.fileStats = fileStats.load(std::memory_order_relaxed);
+	statistics.entries = entries.load(std::memory_order_relaxed);
+	return statistics;
+}
+
+void DirectoryReader::ResetStatistics()
+{
+	directoryStats = 0;
+	directoryOpens = 0;
+	directoryReads = 0;
+	directoryCloses = 0;
+	fileStats = 0;
+	entries = 0;
+}
+
+//********************
+// Private functions *
+//********************
+
+// stat() the current entry, following symbolic links
+bool DirectoryReader::Classify()
+{
+	fileStats.fetch_add(1, std::memory_order_relaxed);
+
+#ifdef __linux__
+	haveInfo = descriptor >= 0 && fstatat(descriptor, name.c_str(), &info, 0) == 0;
+#else
+	haveInfo = stat((path + "/" + name).c_str(), &info) == 0;
+#endif
+	return haveInfo;
+}
@@ -0,0 +1,77 @@
+// Marcus Schmidt
+// Created on 7/29/23
+
+#ifndef DIRECTORY_READER
+#define DIRECTORY_READER
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <string>
+#include <sys/stat.h>
+
+// Counts of the system calls made while reading directories, used to check how much work a scan did
+struct ScanStatistics
+{
+	uint64_t directoryStats = 0; // stat() calls for directory modification times
+	uint64_t directoryOpens = 0;
+	uint64_t directoryReads = 0; // getdents64() calls
+	uint64_t directoryCloses = 0;
+	uint64_t fileStats = 0; // fstatat() calls for files (and for entries whose type wasn't reported)
+	uint64_t entries = 0;
+
+	uint64_t GetSystemCalls() const { return directoryStats + directoryOpens + directoryReads + directoryCloses + fileStats; }
+};
+
+/* Reads the entries of one directory with as few system calls as possible. On Linux the entries come straight from getdents64() along
+ * with their type, so telling files from subdirectories doesn't need a stat() call, and files are stat()ed relative to the open directory
+ * rather than by their full path. Elsewhere it falls back to std::filesystem. "." and ".." are skipped and symbolic links are followed. */
+class DirectoryReader
+{
+public:
+	enum EntryType { REGULAR_FILE, DIRECTORY, OTHER };
+
+	DirectoryReader(const std::string &path);
+	~DirectoryReader();
+	DirectoryReader(const DirectoryReader &) = delete;
+	DirectoryReader & operator=(const DirectoryReader &) = delete;
+
+	bool IsOpen() const;
+	bool Failed() const;
+	bool Next();
+	const char * GetName() const;
+	EntryType GetType() const;
+	bool GetModifiedTime(time_t &time);
+
+	static bool GetDirectoryTime(const std::string &path, int64_t &time);
+	static int64_t GetCurrentTime();
+	static int64_t GetTimeSpan(int seconds);
+	static ScanStatistics GetStatistics();
+	static void ResetStatistics();
+
+private:
+	bool Classify();
+
+	std::string name;
+	EntryType type = OTHER;
+	bool failed = false;
+	bool haveInfo = false;
+	struct stat info;
+
+#ifdef __linux__
+	int descriptor = -1;
+	char *position = nullptr;
+	char *end = nullptr;
+	alignas(8) char buffer[16384];
+#else
+	std::string path;
+	std::filesystem::directory_iterator iterator;
+	bool open = false;
+	bool started = false;
+#endif
+
+	static std::atomic<uint64_t> directoryStats, directoryOpens, directoryReads, directoryCloses, fileStats, entries;
+};
+
+#endif
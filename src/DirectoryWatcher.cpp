@@ -0,0 +1,190 @@
+// Marcus Schmidt
+// Created on 7/22/23
+
+#include "DirectoryWatcher.h"
+#include <chrono>
+#include <vector>
+#include <iostream>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+DirectoryWatcher::DirectoryWatcher(Callback _callback)
+{
+	callback = _callback;
+
+#ifdef __linux__
+	// Reference: https://man7.org/linux/man-pages/man7/inotify.7.html
+	descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (descriptor >= 0)
+		thread = std::thread(&DirectoryWatcher::Run, this);
+	else
+		std::cout << "DirectoryWatcher(): Unable to start inotify" << std::endl;
+#endif
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+	stopping = true;
+	if (thread.joinable())
+		thread.join();
+
+#ifdef __linux__
+	if (descriptor >= 0)
+		close(descriptor);
+#endif
+}
+
+bool DirectoryWatcher::IsSupported()
+{
+#ifdef __linux__
+	return true;
+#else
+	return false;
+#endif
+}
+
+// Start watching the files and subdirectories directly inside a directory (its subdirectories need to be watched separately)
+bool DirectoryWatcher::Watch(const std::string &path)
+{
+#ifdef __linux__
+	if (descriptor < 0)
+		return false;
+
+	int watch = inotify_add_watch(descriptor, path.c_str(), IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+	if (watch < 0)
+	{
+		std::cout << "DirectoryWatcher::Watch(): Unable to watch \"" << path << "\"" << std::endl;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	watches[watch] = path;
+	watchDescriptors[path] = watch;
+	return true;
+#else
+	return false;
+#endif
+}
+
+// Stop watching a directory and every watched directory beneath it
+void DirectoryWatcher::UnwatchTree(const std::string &path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::string prefix = path + "/";
+	for (auto iterator = watchDescriptors.begin(); iterator != watchDescriptors.end();)
+	{
+		if (iterator->first == path || iterator->first.compare(0, prefix.size(), prefix) == 0)
+		{
+#ifdef __linux__
+			inotify_rm_watch(descriptor, iterator->second);
+#endif
+			watches.erase(iterator->second);
+			iterator = watchDescriptors.erase(iterator);
+		}
+		else
+			iterator++;
+	}
+}
+
+void DirectoryWatcher::Clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+#ifdef __linux__
+	for (const auto &watch : watches)
+		inotify_rm_watch(descriptor, watch.first);
+#endif
+	watches.clear();
+	watchDescriptors.clear();
+}
+
+//********************
+// Private functions *
+//********************
+
+void DirectoryWatcher::Run()
+{
+#ifdef __linux__
+	std::set<std::string> directories;
+	std::set<std::string> trees;
+	bool overflowed = false;
+	std::chrono::steady_clock::time_point firstEvent, lastEvent;
+
+	while (!stopping)
+	{
+		// Wake up regularly to check whether the watcher is being destroyed
+		pollfd request = { descriptor, POLLIN, 0 };
+		if (poll(&request, 1, 100) > 0 && (request.revents & POLLIN))
+		{
+			bool wasEmpty = directories.empty() && trees.empty() && !overflowed;
+			ReadEvents(directories, trees, overflowed);
+
+			lastEvent = std::chrono::steady_clock::now();
+			if (wasEmpty)
+				firstEvent = lastEvent;
+		}
+
+		// Report the batch once the directories have settled down, or if events have kept arriving for too long
+		if (!directories.empty() || !trees.empty() || overflowed)
+		{
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (now - lastEvent >= std::chrono::milliseconds(QUIET_MILLISECONDS) || now - firstEvent >= std::chrono::milliseconds(MAX_DELAY_MILLISECONDS))
+			{
+				callback(std::move(directories), std::move(trees), overflowed);
+				directories.clear();
+				trees.clear();
+				overflowed = false;
+			}
+		}
+	}
+#endif
+}
+
+void DirectoryWatcher::ReadEvents(std::set<std::string> &directories, std::set<std::string> &trees, bool &overflowed)
+{
+#ifdef __linux__
+	// The buffer must be aligned for inotify_event. Reference: https://man7.org/linux/man-pages/man7/inotify.7.html
+	alignas(inotify_event) char buffer[16384];
+	ssize_t length;
+	while ((length = read(descriptor, buffer, sizeof(buffer))) > 0)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (char *pointer = buffer; pointer < buffer + length;)
+		{
+			const inotify_event *event = reinterpret_cast<const inotify_event *>(pointer);
+			pointer += sizeof(inotify_event) + event->len;
+
+			// Events were dropped, which isn't tied to any one watch (its descriptor is -1), so nothing can be trusted to be up to date
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				overflowed = true;
+				continue;
+			}
+
+			auto watch = watches.find(event->wd);
+			if (watch == watches.end())
+				continue;
+
+			// The kernel has dropped the watch because the directory was deleted
+			if (event->mask & IN_IGNORED)
+			{
+				watchDescriptors.erase(watch->second);
+				watches.erase(watch);
+				continue;
+			}
+
+			if (event->len == 0)
+				continue;
+
+			/* A subdirectory changing affects everything beneath it, while a file only affects the directory it's in. A file that's written
+			 * is reported when it's closed, but one that appears without being written (a hard link, say) only has IN_CREATE */
+			if (event->mask & IN_ISDIR)
+				trees.insert(watch->second + "/" + event->name);
+			else if (event->mask & (IN_CREATE | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))
+				directories.insert(watch->second);
+		}
+	}
+#endif
+}
@@ -0,0 +1,50 @@
+// Marcus Schmidt
+// Created on 7/22/23
+
+#ifndef DIRECTORY_WATCHER
+#define DIRECTORY_WATCHER
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+/* Watches a set of directories for files being added, removed or renamed and reports the changes in batches. Events are collected
+ * on a background thread until the directories have been quiet for a moment, so copying thousands of files results in one
+ * callback. The callback receives the directories whose own files changed and the subdirectories that were created, removed or
+ * moved, and it's run on the watcher's thread. If more events arrive than the kernel can queue, some are lost, so the callback is
+ * told that the queue overflowed and everything that's watched has to be read again. Only Linux (inotify) is supported; elsewhere
+ * IsSupported() is false and nothing is reported. */
+class DirectoryWatcher
+{
+public:
+	typedef std::function<void(std::set<std::string> directories, std::set<std::string> trees, bool overflowed)> Callback;
+
+	DirectoryWatcher(Callback _callback);
+	~DirectoryWatcher();
+
+	static bool IsSupported();
+	bool Watch(const std::string &path);
+	void UnwatchTree(const std::string &path);
+	void Clear();
+
+private:
+	void Run();
+	void ReadEvents(std::set<std::string> &directories, std::set<std::string> &trees, bool &overflowed);
+
+	constexpr static int QUIET_MILLISECONDS = 250; // how long the directories must go without events before a batch is reported
+	constexpr static int MAX_DELAY_MILLISECONDS = 2000; // the longest a batch is held back while events keep arriving
+
+	Callback callback;
+	int descriptor = -1;
+	std::unordered_map<int, std::string> watches; // watch descriptor -> directory path
+	std::unordered_map<std::string, int> watchDescriptors;
+	std::mutex mutex;
+	std::atomic<bool> stopping { false };
+	std::thread thread;
+};
+
+#endif
@@ -0,0 +1,455 @@
+// Marcus Schmidt
+// Created on 9/2/23
+
+#include "ExifReader.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+/* Get the JPEG preview that cameras embed in the Exif segment (stored after the second directory of tags), if there is one, along with the
+ * orientation of the main image (see ReadOrientation()), which the preview shares, so that the header is only read once for both
+ * Reference: https://www.cipa.jp/std/documents/e/DC-X008-Translation-2019-E.pdf (section 4.5.8) */
+bool ExifReader::ReadThumbnail(const std::string &path, std::vector<unsigned char> &thumbnail, int &orientation)
+{
+	std::vector<unsigned char> segment;
+	Tiff tiff;
+	if (!ReadExif(path, segment, tiff))
+		return false;
+	orientation = GetOrientation(tiff);
+
+	// Skip the first directory (the main image's tags) to get to the one for the thumbnail
+	uint32_t directory;
+	uint16_t count;
+	if (!tiff.Read32(4, directory) || !tiff.Read16(directory, count) || !tiff.Read32(directory + 2 + 12 * (std::size_t) count, directory) || directory == 0
+		|| !tiff.Read16(directory, count))
+		return false;
+
+	uint32_t offset = 0, length = 0;
+	for (uint16_t i = 0; i < count; i++)
+	{
+		std::size_t entry = directory + 2 + 12 * (std::size_t) i;
+		uint16_t tag;
+		if (!tiff.Read16(entry, tag))
+			return false;
+
+		// JPEGInterchangeFormat and JPEGInterchangeFormatLength, both single LONG values stored in place
+		if (tag == 0x0201)
+			tiff.Read32(entry + 8, offset);
+		else if (tag == 0x0202)
+			tiff.Read32(entry + 8, length);
+	}
+
+	if (length < 4 || offset > tiff.size || length > tiff.size - offset || tiff.data[offset] != 0xFF || tiff.data[offset + 1] != 0xD8)
+		return false;
+
+	thumbnail.assign(tiff.data + offset, tiff.data + offset + length);
+	return true;
+}
+
+/* Get how the camera was held, as the Exif orientation (1 to 8, see ImageKernels::Orient()). Returns 1, which means the image is already upright,
+ * if the file doesn't say */
+int ExifReader::ReadOrientation(const std::string &path)
+{
+	std::vector<unsigned char> segment;
+	Tiff tiff;
+	return ReadExif(path, segment, tiff) ? GetOrientation(tiff) : 1;
+}
+
+/* The same for a file that's already in memory, such as a MappedFile that's about to be decoded, which saves opening and reading the file
+ * again just for its header */
+int ExifReader::ReadOrientation(const unsigned char *data, std::size_t size)
+{
+	auto Need = [data, size](std::size_t end) -> const unsigned char *
+	{
+		return end <= std::min(size, MAX_HEADER_BYTES) ? data : nullptr;
+	};
+
+	std::size_t start, end;
+	Tiff tiff;
+	return data != nullptr && FindExif(Need, start, end) && StartTiff(data + start, end - start, tiff) ? GetOrientation(tiff) : 1;
+}
+
+/* Get when the photo was taken from DateTimeOriginal in the Exif directory, or failing that from DateTime in the first directory, which is when
+ * the camera (or the last editor) wrote the file. Exif times are the local time where the photo was taken, so unless OffsetTimeOriginal says
+ * which time zone that was, they're taken as local time here, which at least keeps the photos from one place in order with each other */
+bool ExifReader::ReadCaptureTime(const std::string &path, time_t &time)
+{
+	std::vector<unsigned char> segment;
+	Tiff tiff;
+	uint32_t directory, exifDirectory;
+	std::size_t entry;
+	if (!ReadExif(path, segment, tiff, true) || !tiff.Read32(4, directory))
+		return false;
+
+	// The Exif directory is found through the ExifIFDPointer tag in the first directory
+	std::string text, offset;
+	if (tiff.FindEntry(directory, 0x8769, entry) && tiff.Read32(entry + 8, exifDirectory) && tiff.FindEntry(exifDirectory, 0x9003, entry)
+		&& tiff.ReadText(entry, text))
+	{
+		if (tiff.FindEntry(exifDirectory, 0x9011, entry))
+			tiff.ReadText(entry, offset);
+		if (ParseTime(text, offset, time))
+			return true;
+	}
+
+	return tiff.FindEntry(directory, 0x0132, entry) && tiff.ReadText(entry, text) && ParseTime(text, "", time);
+}
+
+//********************
+// Private functions *
+//********************
+
+// The orientation in the first directory of an Exif segment, or 1 if there isn't one
+int ExifReader::GetOrientation(const Tiff &tiff)
+{
+	uint32_t directory;
+	uint16_t count;
+	if (!tiff.Read32(4, directory) || !tiff.Read16(directory, count))
+		return 1;
+
+	// Orientation is a single SHORT stored in place, in the first directory
+	for (uint16_t i = 0; i < count; i++)
+	{
+		std::size_t entry = directory + 2 + 12 * (std::size_t) i;
+		uint16_t tag, orientation;
+		if (!tiff.Read16(entry, tag))
+			break;
+		if (tag == 0x0112)
+			return tiff.Read16(entry + 8, orientation) && orientation >= 1 && orientation <= 8 ? orientation : 1;
+	}
+	return 1;
+}
+
+/* Read the Exif segment from the start of a file, reading only as much as FindExif() needs. Fills 'segment' with the Exif segment and points
+ * 'tiff' into it. HEIF files are only looked at with 'includeHeif', since their Exif orientation has to be ignored (the container says how to
+ * turn the image) and so only their capture time is read */
+bool ExifReader::ReadExif(const std::string &path, std::vector<unsigned char> &segment, Tiff &tiff, bool includeHeif)
+{
+	std::ifstream stream(path, std::ios::binary);
+	if (!stream)
+		return false;
+
+	// Read more of the file whenever the walk needs bytes that haven't been read yet
+	std::vector<unsigned char> header;
+	auto Need = [&stream, &header](std::size_t end) -> const unsigned char *
+	{
+		if (end > MAX_HEADER_BYTES)
+			return nullptr;
+		if (end > header.size())
+		{
+			std::size_t size = header.size();
+			header.resize(std::max(end, std::min(MAX_HEADER_BYTES, std::max(size * 2, FIRST_READ_BYTES))));
+			stream.read(reinterpret_cast<char *>(header.data() + size), header.size() - size);
+			header.resize(size + stream.gcount());
+		}
+		return end <= header.size() ? header.data() : nullptr;
+	};
+
+	// A HEIF file starts with its 'ftyp' box
+	if (includeHeif && Need(12) && std::memcmp(&header[4], "ftyp", 4) == 0)
+		return ReadHeifExif(stream, segment) && StartTiff(segment.data(), segment.size(), tiff);
+
+	std::size_t start, end;
+	if (!FindExif(Need, start, end))
+		return false;
+	segment.assign(header.begin() + start, header.begin() + end);
+	return StartTiff(segment.data(), segment.size(), tiff);
+}
+
+/* Find the Exif segment by walking the JPEG's marker segments from the start of the file. 'Need' makes sure the file is available up to an
+ * offset and returns where it starts, or null if the file (or how far into it the walk is allowed to go) ends first. Gives where the segment's
+ * TIFF structure starts and ends, after the "Exif\0\0" that opens the segment */
+bool ExifReader::FindExif(const std::function<const unsigned char *(std::size_t end)> &Need, std::size_t &start, std::size_t &end)
+{
+	const unsigned char *header = Need(2);
+	if (header == nullptr || header[0] != 0xFF || header[1] != 0xD8)
+		return false;
+
+	std::size_t position = 2;
+	while ((header = Need(position + 4)) != nullptr)
+	{
+		if (header[position] != 0xFF)
+			return false;
+
+		unsigned char marker = header[position + 1];
+		if (marker == 0xFF)
+		{
+			// Markers can be padded with any number of fill bytes
+			position++;
+			continue;
+		}
+
+		// Standalone markers have no length, and the image data starts at SOS, after which there's nothing more to find
+		if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+		{
+			position += 2;
+			continue;
+		}
+		if (marker == 0xDA || marker == 0xD9)
+			return false;
+
+		std::size_t length = ((std::size_t) header[position + 2] << 8) | header[position + 3];
+		if (length < 2)
+			return false;
+
+		start = position + 4;
+		end = position + 2 + length;
+		if (marker == 0xE1 && length >= 2 + 6 + 8 && (header = Need(start + 6)) != nullptr && std::memcmp(header + start, "Exif\0\0", 6) == 0)
+		{
+			start += 6;
+			return Need(end) != nullptr;
+		}
+
+		position = end;
+	}
+
+	return false;
+}
+
+/* Find the Exif item of a HEIF file and fill 'segment' with its TIFF structure. The 'meta' box near the start of the file lists the items in
+ * 'iinf', which gives the Exif item's ID, and where each item's bytes are in 'iloc'. The item itself starts with the offset of the TIFF header,
+ * which usually skips the same "Exif\0\0" that a JPEG's segment starts with.
+ * Reference: ISO/IEC 23008-12 (section 9, items and Exif) and ISO/IEC 14496-12 (section 8.11, 'meta', 'iinf' and 'iloc') */
+bool ExifReader::ReadHeifExif(std::ifstream &stream, std::vector<unsigned char> &segment)
+{
+	/* Walk the top-level boxes by their headers until 'meta', which is read whole (see MovieReader::FindBox() for the header format). A box
+	 * can't run past the end of the file, which also keeps a corrupt 64-bit size from wrapping the position around */
+	std::vector<unsigned char> meta;
+	stream.clear();
+	if (!stream.seekg(0, std::ios::end))
+		return false;
+	uint64_t fileSize = (uint64_t) stream.tellg(), position = 0;
+	while (meta.empty() && fileSize - position >= 8)
+	{
+		unsigned char header[16];
+		stream.clear();
+		stream.seekg((std::streamoff) position);
+		if (!stream.read(reinterpret_cast<char *>(header), 8))
+			return false;
+
+		uint64_t size = ((uint64_t) header[0] << 24) | ((uint64_t) header[1] << 16) | ((uint64_t) header[2] << 8) | header[3];
+		uint64_t headerSize = 8;
+		if (size == 1)
+		{
+			if (!stream.read(reinterpret_cast<char *>(header + 8), 8))
+				return false;
+			size = 0;
+			for (int i = 8; i < 16; i++)
+				size = (size << 8) | header[i];
+			headerSize = 16;
+		}
+		if (size < headerSize || size > fileSize - position)
+			return false;
+
+		if (std::memcmp(header + 4, "meta", 4) == 0)
+		{
+			if (size - headerSize > MAX_HEADER_BYTES || size - headerSize < 4)
+				return false;
+			meta.resize((std::size_t) (size - headerSize));
+			if (!stream.read(reinterpret_cast<char *>(meta.data()), meta.size()))
+				return false;
+		}
+		position += size;
+	}
+	if (meta.empty())
+		return false;
+
+	// Big-endian numbers of 0 to 8 bytes, since 'iloc' gives the sizes of its own fields
+	auto Read = [&meta](std::size_t offset, std::size_t bytes, uint64_t &value)
+	{
+		if (offset > meta.size() || meta.size() - offset < bytes)
+			return false;
+		value = 0;
+		for (std::size_t i = 0; i < bytes; i++)
+			value = (value << 8) | meta[offset + i];
+		return true;
+	};
+
+	// Find the next box of a type between 'start' and 'end' (the boxes inside 'meta' all have 32-bit sizes)
+	auto Find = [&meta, &Read](std::size_t start, std::size_t end, const char *type, std::size_t &contentStart, std::size_t &contentEnd)
+	{
+		uint64_t size;
+		for (std::size_t box = start; end - box >= 8 && Read(box, 4, size); box += size)
+		{
+			if (size < 8 || size > end - box)
+				return false;
+			if (std::memcmp(&meta[box + 4], type, 4) == 0)
+			{
+				contentStart = box + 8;
+				contentEnd = box + size;
+				return true;
+			}
+		}
+		return false;
+	};
+
+	// 'meta' and the boxes in it are "full boxes", which start with a version byte and three bytes of flags
+	std::size_t start, end, itemStart, itemEnd;
+	uint64_t version, count, id = 0;
+	bool found = false;
+	if (!Find(4, meta.size(), "iinf", start, end) || !Read(start, 1, version))
+		return false;
+	std::size_t item = start + (version == 0 ? 6 : 8);
+	while (!found && Find(item, end, "infe", itemStart, itemEnd))
+	{
+		// Item info entries from version 2 on give the item's type; version 3 has 32-bit IDs
+		uint64_t itemVersion;
+		if (Read(itemStart, 1, itemVersion) && itemVersion >= 2)
+		{
+			std::size_t idSize = (itemVersion == 2) ? 2 : 4;
+			found = Read(itemStart + 4, idSize, id) && itemEnd - itemStart >= 4 + idSize + 2 + 4
+					&& std::memcmp(&meta[itemStart + 4 + idSize + 2], "Exif", 4) == 0;
+		}
+		item = itemEnd;
+	}
+	if (!found || !Find(4, meta.size(), "iloc", start, end) || !Read(start, 1, version) || version > 2)
+		return false;
+
+	// The sizes of the offsets and lengths that follow, packed into nibbles
+	uint64_t sizes, moreSizes;
+	if (!Read(start + 4, 1, sizes) || !Read(start + 5, 1, moreSizes) || !Read(start + 6, version < 2 ? 2 : 4, count))
+		return false;
+	std::size_t offsetSize = sizes >> 4, lengthSize = sizes & 15, baseOffsetSize = moreSizes >> 4, indexSize = (version == 0) ? 0 : moreSizes & 15;
+	std::size_t idSize = (version < 2) ? 2 : 4;
+	std::size_t location = start + 6 + (version < 2 ? 2 : 4);
+	for (uint64_t i = 0; i < count; i++)
+	{
+		uint64_t itemId, method = 0, baseOffset, extentCount;
+		if (!Read(location, idSize, itemId))
+			return false;
+		location += idSize;
+		if (version > 0)
+		{
+			if (!Read(location, 2, method))
+				return false;
+			location += 2;
+		}
+		location += 2; // the data reference index
+		if (!Read(location, baseOffsetSize, baseOffset) || !Read(location + baseOffsetSize, 2, extentCount))
+			return false;
+		location += baseOffsetSize + 2;
+
+		// Only an item stored in a single extent of the file itself is read, which is how Exif items are written in practice
+		if (itemId == id)
+		{
+			uint64_t offset, length;
+			if ((method & 15) != 0 || extentCount != 1 || !Read(location + indexSize, offsetSize, offset)
+				|| !Read(location + indexSize + offsetSize, lengthSize, length) || length < 4 + 8 || length > MAX_HEADER_BYTES)
+				return false;
+
+			segment.resize((std::size_t) length);
+			stream.clear();
+			stream.seekg((std::streamoff) (baseOffset + offset));
+			if (!stream.read(reinterpret_cast<char *>(segment.data()), segment.size()))
+				return false;
+
+			std::size_t tiffOffset = ((std::size_t) segment[0] << 24) | ((std::size_t) segment[1] << 16) | ((std::size_t) segment[2] << 8) | segment[3];
+			if (tiffOffset > segment.size() - 4 - 8)
+				return false;
+			segment.erase(segment.begin(), segment.begin() + 4 + tiffOffset);
+			return true;
+		}
+		location += extentCount * (indexSize + offsetSize + lengthSize);
+	}
+
+	return false;
+}
+
+// Point 'tiff' at the TIFF structure in an Exif segment, which starts with its byte order ("II" or "MM") and the number 42
+bool ExifReader::StartTiff(const unsigned char *data, std::size_t size, Tiff &tiff)
+{
+	tiff.data = data;
+	tiff.size = size;
+	if (tiff.size < 8)
+		return false;
+
+	tiff.bigEndian = (data[0] == 'M' && data[1] == 'M');
+	uint16_t magic;
+	return (tiff.bigEndian || (data[0] == 'I' && data[1] == 'I')) && tiff.Read16(2, magic) && magic == 42;
+}
+
+/* Convert an Exif time ("YYYY:MM:DD HH:MM:SS") into a time_t. 'offset' is the time zone it's in ("+HH:MM" or "-HH:MM"), or empty for the
+ * local time zone. Cameras without a clock set write zeros or spaces, which aren't a time */
+bool ExifReader::ParseTime(const std::string &text, const std::string &offset, time_t &time)
+{
+	std::tm fields = {};
+	if (std::sscanf(text.c_str(), "%4d:%2d:%2d %2d:%2d:%2d", &fields.tm_year, &fields.tm_mon, &fields.tm_mday, &fields.tm_hour, &fields.tm_min,
+					&fields.tm_sec) != 6 || fields.tm_year < 1900 || fields.tm_mon < 1 || fields.tm_mon > 12 || fields.tm_mday < 1 || fields.tm_mday > 31
+		|| fields.tm_hour > 23 || fields.tm_min > 59 || fields.tm_sec > 60)
+		return false;
+	fields.tm_year -= 1900;
+	fields.tm_mon -= 1;
+
+	char sign;
+	int hours, minutes;
+	if (std::sscanf(offset.c_str(), "%c%2d:%2d", &sign, &hours, &minutes) == 3 && (sign == '+' || sign == '-'))
+	{
+		// The fields are in UTC once the offset is taken away, which the C library only converts with a non-standard function
+#ifdef _WIN32
+		time = _mkgmtime(&fields) - (sign == '+' ? 1 : -1) * (hours * 3600 + minutes * 60);
+#else
+		time = timegm(&fields) - (sign == '+' ? 1 : -1) * (hours * 3600 + minutes * 60);
+#endif
+		return true;
+	}
+
+	fields.tm_isdst = -1;
+	time = std::mktime(&fields);
+	return time != (time_t) -1;
+}
+
+bool ExifReader::Tiff::Read16(std::size_t offset, uint16_t &value) const
+{
+	if (offset > size || size - offset < 2)
+		return false;
+
+	const unsigned char *bytes = data + offset;
+	value = bigEndian ? (uint16_t) ((bytes[0] << 8) | bytes[1]) : (uint16_t) ((bytes[1] << 8) | bytes[0]);
+	return true;
+}
+
+// Find a tag's 12-byte entry in a directory of tags
+bool ExifReader::Tiff::FindEntry(std::size_t directory, uint16_t tag, std::size_t &entry) const
+{
+	uint16_t count, entryTag;
+	if (!Read16(directory, count))
+		return false;
+
+	for (uint16_t i = 0; i < count; i++)
+	{
+		entry = directory + 2 + 12 * (std::size_t) i;
+		if (!Read16(entry, entryTag))
+			return false;
+		if (entryTag == tag)
+			return true;
+	}
+	return false;
+}
+
+// Read an ASCII value, which is stored in the entry itself when it fits in 4 bytes and at an offset otherwise, up to its terminating null
+bool ExifReader::Tiff::ReadText(std::size_t entry, std::string &text) const
+{
+	uint16_t type;
+	uint32_t count, offset = (uint32_t) entry + 8;
+	if (!Read16(entry + 2, type) || type != 2 || !Read32(entry + 4, count) || (count > 4 && !Read32(entry + 8, offset)) || offset > size
+		|| size - offset < count)
+		return false;
+
+	const char *characters = reinterpret_cast<const char *>(data + offset);
+	text.assign(characters, std::find(characters, characters + count, '\0'));
+	return true;
+}
+
+bool ExifReader::Tiff::Read32(std::size_t offset, uint32_t &value) const
+{
+	if (offset > size || size - offset < 4)
+		return false;
+
+	const unsigned char *bytes = data + offset;
+	if (bigEndian)
+		value = ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) | ((uint32_t) bytes[2] << 8) | bytes[3];
+	else
+		value = ((uint32_t) bytes[3] << 24) | ((uint32_t) bytes[2] << 16) | ((uint32_t) bytes[1] << 8) | bytes[0];
+	return true;
+}
@@ -0,0 +1,51 @@
+// Marcus Schmidt
+// Created on 9/2/23
+
+#ifndef EXIF_READER
+#define EXIF_READER
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+/* Reads metadata from the Exif segment at the start of a JPEG without decoding the image. Only the marker segments before the Exif segment and
+ * the segment itself are read, which is a few kilobytes for a typical camera file, and anything unexpected is treated as there being no Exif.
+ * The capture time can also be read from HEIF (HEIC) files, which keep their Exif block as an item that the 'meta' box near the start points to. */
+class ExifReader
+{
+public:
+	static bool ReadThumbnail(const std::string &path, std::vector<unsigned char> &thumbnail, int &orientation);
+	static int ReadOrientation(const std::string &path);
+	static int ReadOrientation(const unsigned char *data, std::size_t size);
+	static bool ReadCaptureTime(const std::string &path, time_t &time);
+
+	constexpr static std::size_t FIRST_READ_BYTES = 4096; // enough for the markers before the Exif segment in most files
+	constexpr static std::size_t MAX_HEADER_BYTES = 256 << 10; // how far into the file to look for the Exif segment
+
+private:
+	// The TIFF structure inside an Exif segment, which stores its numbers in either byte order
+	struct Tiff
+	{
+		const unsigned char *data;
+		std::size_t size;
+		bool bigEndian;
+
+		bool Read16(std::size_t offset, uint16_t &value) const;
+		bool Read32(std::size_t offset, uint32_t &value) const;
+		bool ReadText(std::size_t entry, std::string &text) const;
+		bool FindEntry(std::size_t directory, uint16_t tag, std::size_t &entry) const;
+	};
+
+	static bool ReadExif(const std::string &path, std::vector<unsigned char> &segment, Tiff &tiff, bool includeHeif = false);
+	static bool FindExif(const std::function<const unsigned char *(std::size_t end)> &Need, std::size_t &start, std::size_t &end);
+	static bool ReadHeifExif(std::ifstream &stream, std::vector<unsigned char> &segment);
+	static bool StartTiff(const unsigned char *data, std::size_t size, Tiff &tiff);
+	static int GetOrientation(const Tiff &tiff);
+	static bool ParseTime(const std::string &text, const std::string &offset, time_t &time);
+};
+
+#endif
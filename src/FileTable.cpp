@@ -0,0 +1,171 @@
+// Marcus Schmidt
+// Created on 8/5/23
+
+#include "FileTable.h"
+#include <algorithm>
+
+FileTable & FileTable::Get()
+{
+	static FileTable table;
+	return table;
+}
+
+// Get the ID of a directory (given with a trailing '/'), adding it if it hasn't been seen before
+uint32_t FileTable::AddDirectory(const std::string &path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto iterator = directoryIds.find(path);
+	if (iterator != directoryIds.end())
+		return iterator->second;
+
+	uint32_t id = (uint32_t) directories.size();
+	directories.push_back(path);
+	directoryIds[directories.back()] = id;
+	return id;
+}
+
+File FileTable::AddFile(uint32_t directory, const std::string &name, const std::string &originalName, time_t modifiedTime, MediaType type)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	FileRecord record;
+	record.originalNameOffset = AddName(originalName);
+	record.originalNameLength = (uint16_t) originalName.size();
+	record.nameOffset = (name == originalName) ? record.originalNameOffset : AddName(name);
+	record.nameLength = (uint16_t) name.size();
+	record.type = type;
+
+	uint32_t id = (uint32_t) records.size();
+	records.push_back(record);
+	return { GetNameKey(name), modifiedTime, id, directory };
+}
+
+// Register a list whose files must stay valid whenever the table is rebuilt (see Compact()), until it's removed again
+void FileTable::AddList(std::vector<File> *list)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	lists.push_back(list);
+}
+
+void FileTable::RemoveList(std::vector<File> *list)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	lists.erase(std::remove(lists.begin(), lists.end(), list), lists.end());
+}
+
+/* Forget every file and directory. Any File that's still around afterwards refers to nothing, so this is only for tools that have a single
+ * list and clear it first; viewers share the table with each other and use Compact() instead */
+void FileTable::Clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	directories.clear();
+	directoryIds.clear();
+	records.clear();
+	names.clear();
+}
+
+/* Rebuild the table with only the files in the registered lists (updating their IDs to match), which reclaims the space of files that have
+ * since been removed from every list. Everything is copied in the lists' order, so neighbouring images also end up with neighbouring names. */
+void FileTable::Compact()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::deque<std::string> oldDirectories;
+	std::vector<FileRecord> oldRecords;
+	std::vector<char> oldNames;
+	oldDirectories.swap(directories);
+	oldRecords.swap(records);
+	oldNames.swap(names);
+	directoryIds.clear();
+
+	std::vector<uint32_t> directoryMap(oldDirectories.size(), UINT32_MAX);
+	records.reserve(GetListedFileCount());
+	for (std::vector<File> *list : lists)
+	{
+		for (File &file : *list)
+		{
+			uint32_t &directory = directoryMap[file.directory];
+			if (directory == UINT32_MAX)
+			{
+				directory = (uint32_t) directories.size();
+				directories.push_back(std::move(oldDirectories[file.directory]));
+				directoryIds[directories.back()] = directory;
+			}
+
+			const FileRecord &oldRecord = oldRecords[file.id];
+			FileRecord record = oldRecord;
+			record.originalNameOffset = (uint32_t) names.size();
+			names.insert(names.end(), oldNames.begin() + oldRecord.originalNameOffset, oldNames.begin() + oldRecord.originalNameOffset + oldRecord.originalNameLength);
+			if (oldRecord.nameOffset == oldRecord.originalNameOffset)
+				record.nameOffset = record.originalNameOffset;
+			else
+			{
+				record.nameOffset = (uint32_t) names.size();
+				names.insert(names.end(), oldNames.begin() + oldRecord.nameOffset, oldNames.begin() + oldRecord.nameOffset + oldRecord.nameLength);
+			}
+
+			file.id = (uint32_t) records.size();
+			file.directory = directory;
+			records.push_back(record);
+		}
+	}
+}
+
+// The standardized name, which is what the list is sorted by and what filters match against
+std::string_view FileTable::GetName(const File &file) const
+{
+	const FileRecord &record = records[file.id];
+	return std::string_view(names.data() + record.nameOffset, record.nameLength);
+}
+
+std::string_view FileTable::GetOriginalName(const File &file) const
+{
+	const FileRecord &record = records[file.id];
+	return std::string_view(names.data() + record.originalNameOffset, record.originalNameLength);
+}
+
+// The full path of a file, built on demand since it's only needed to open the file or show it to the user
+std::string FileTable::GetPath(const File &file) const
+{
+	std::string path = directories[file.directory];
+	path.append(GetOriginalName(file));
+	return path;
+}
+
+// How many files the registered lists refer to, which is all the table needs to keep
+std::size_t FileTable::GetListedFileCount() const
+{
+	std::size_t count = 0;
+	for (const std::vector<File> *list : lists)
+		count += list->size();
+	return count;
+}
+
+// Approximately how many bytes the table is using, to report the cost of the list per image
+std::size_t FileTable::GetMemoryUsage() const
+{
+	std::size_t usage = sizeof(FileTable) + records.capacity() * sizeof(FileRecord) + names.capacity();
+	for (const auto &directory : directories)
+		usage += sizeof(std::string) + directory.capacity() + sizeof(std::pair<std::string_view, uint32_t>) + 2 * sizeof(void *);
+	return usage;
+}
+
+/* Pack the first 8 bytes of a name into an integer with the first byte in the highest position (and zeros after a shorter name). Names
+ * can't contain a zero byte, so comparing two keys gives the same answer as comparing the beginnings of the names with std::string. */
+uint64_t FileTable::GetNameKey(const std::string &name)
+{
+	uint64_t key = 0;
+	for (std::size_t i = 0; i < 8; i++)
+		key = (key << 8) | (i < name.size() ? (unsigned char) name[i] : 0);
+	return key;
+}
+
+//********************
+// Private functions *
+//********************
+
+// Append a name to the name buffer and return where it starts (the caller must hold the lock)
+uint32_t FileTable::AddName(const std::string &name)
+{
+	uint32_t offset = (uint32_t) names.size();
+	names.insert(names.end(), name.begin(), name.end());
+	return offset;
+}
@@ -0,0 +1,72 @@
+// Marcus Schmidt
+// Created on 8/5/23
+
+#ifndef FILE_TABLE
+#define FILE_TABLE
+
+#include "CustomTypes.h"
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/* Storage for everything about the listed images that isn't needed to sort them. Every directory is stored once and referenced by a
+ * 32-bit ID, and the names of every image are packed end to end in a single buffer. Files can be added from several threads at once
+ * (scans run on the thread pool), but the getters don't lock, so the table must only be read once the scan adding to it has finished.
+ * Every viewer window keeps its list in the same table, so each one registers its list (see AddList()) and the table is only ever
+ * rebuilt from all of them together, which renumbers every list at once instead of leaving the others pointing at the wrong files. */
+class FileTable
+{
+public:
+	static FileTable & Get();
+
+	uint32_t AddDirectory(const std::string &path);
+	File AddFile(uint32_t directory, const std::string &name, const std::string &originalName, time_t modifiedTime, MediaType type);
+	void AddList(std::vector<File> *list);
+	void RemoveList(std::vector<File> *list);
+	void Clear();
+	void Compact();
+
+	const std::string & GetDirectory(uint32_t directory) const { return directories[directory]; }
+	std::size_t GetDirectoryCount() const { return directories.size(); }
+	std::string_view GetName(const File &file) const;
+	std::string_view GetOriginalName(const File &file) const;
+	std::string GetPath(const File &file) const;
+	MediaType GetType(const File &file) const { return records[file.id].type; }
+	time_t GetCaptureTime(const File &file) const { return records[file.id].captureTime != 0 ? records[file.id].captureTime : file.modifiedTime; }
+	void SetCaptureTime(const File &file, time_t time) { records[file.id].captureTime = time; } // safe from several threads for different files
+	std::size_t GetFileCount() const { return records.size(); }
+	std::size_t GetListedFileCount() const;
+	std::size_t GetMemoryUsage() const;
+
+	static uint64_t GetNameKey(const std::string &name);
+
+private:
+	/* Where a file's names are in the name buffer. The standardized name shares the original's bytes when they're the same. The capture time
+	 * is only known once the files have been sorted by it (see CaptureTimeCache), and is 0 until then or if the file doesn't have one */
+	struct FileRecord
+	{
+		time_t captureTime = 0;
+		uint32_t nameOffset;
+		uint32_t originalNameOffset;
+		uint16_t nameLength;
+		uint16_t originalNameLength;
+		MediaType type;
+	};
+
+	FileTable() {}
+
+	uint32_t AddName(const std::string &name);
+
+	std::deque<std::string> directories; // a deque so that the views in 'directoryIds' stay valid as directories are added
+	std::unordered_map<std::string_view, uint32_t> directoryIds;
+	std::vector<FileRecord> records;
+	std::vector<char> names;
+	std::vector<std::vector<File> *> lists; // the lists of every viewer, whose files are kept (and renumbered) when the table is compacted
+	std::mutex mutex;
+};
+
+#endif
@@ -0,0 +1,190 @@
+// Marcus Schmidt
+// Created on 8/12/23
+
+#include "FileTypeRegistry.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <cctype>
+#include <iostream>
+
+// The types that are used when there's no config file yet (and that are written to it so there's something to edit)
+FileTypeRegistry::FileTypeRegistry()
+{
+	BuildTable();
+	Add(".png", MediaType::IMAGE);
+	Add(".jpg", MediaType::IMAGE);
+	Add(".jpeg", MediaType::IMAGE);
+	Add(".mp4", MediaType::VIDEO);
+	Add(".mov", MediaType::VIDEO);
+}
+
+/* Replace the types with the ones in a config file. Each line is an extension, "image" or "video", and optionally "off" to leave the type
+ * unchecked when the viewer opens. Blank lines and lines starting with '#' are ignored. If the file doesn't exist, the current types are written to it */
+void FileTypeRegistry::Load(const std::string &path)
+{
+	std::ifstream stream(path);
+	if (!stream)
+	{
+		if (std::filesystem::exists(path))
+			std::cout << "FileTypeRegistry::Load(): Unable to read \"" << path << "\", using the defaults" << std::endl;
+		else if (Save(path))
+			std::cout << "FileTypeRegistry::Load(): Wrote the default file types to \"" << path << "\"" << std::endl;
+		return;
+	}
+
+	std::vector<FileType> previousTypes = types;
+	types.clear();
+	BuildTable();
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(stream, line))
+	{
+		lineNumber++;
+		std::istringstream words(line);
+		std::string extension, mediaType, state;
+		if (!(words >> extension) || extension[0] == '#')
+			continue;
+		words >> mediaType >> state;
+
+		MediaType type = MediaType::UNKNOWN;
+		if (mediaType == "image")
+			type = MediaType::IMAGE;
+		else if (mediaType == "video")
+			type = MediaType::VIDEO;
+
+		if (type == MediaType::UNKNOWN || (!state.empty() && state != "on" && state != "off") || !Add(extension, type, state != "off"))
+			std::cout << "FileTypeRegistry::Load(): Skipping line " << lineNumber << " of \"" << path << "\" (\"" << line << "\")" << std::endl;
+	}
+
+	// A config without a single usable type would hide everything, which is more likely a mistake than what was intended
+	if (types.empty())
+	{
+		std::cout << "FileTypeRegistry::Load(): No file types in \"" << path << "\", using the defaults" << std::endl;
+		types = previousTypes;
+		BuildTable();
+	}
+}
+
+// Add a type for an extension such as ".jpg" (compared without regard to case). Returns false if it's invalid or already present
+bool FileTypeRegistry::Add(std::string extension, MediaType type, bool active)
+{
+	for (std::size_t i = 0; i < extension.size(); i++)
+		extension[i] = tolower(extension[i]);
+
+	uint64_t key;
+	if (extension.size() < 2 || extension[0] != '.' || extension.find('.', 1) != std::string::npos || !GetKey(std::string_view(extension).substr(1), key) || Find("name" + extension) != nullptr)
+		return false;
+
+	types.push_back({ { extension, active }, type });
+	BuildTable();
+	return true;
+}
+
+// Get the type of a file from its name, or nullptr if its extension isn't registered. The extension is found the same way as std::filesystem::path::extension()
+const FileType * FileTypeRegistry::Find(std::string_view fileName) const
+{
+	std::size_t dot = fileName.rfind('.');
+	if (dot == std::string_view::npos || dot == 0)
+		return nullptr;
+
+	uint64_t key;
+	if (!GetKey(fileName.substr(dot + 1), key))
+		return nullptr;
+
+	const Slot &slot = slots[(key * multiplier) >> shift];
+	return (slot.key == key) ? &types[slot.index] : nullptr;
+}
+
+// A string that changes whenever the set of types does (but not when they're toggled), used to tell whether a scan catalog still applies
+std::string FileTypeRegistry::GetSignature() const
+{
+	std::string signature;
+	for (const auto &fileType : types)
+		signature += fileType.name + ":" + std::to_string(static_cast<int>(fileType.type)) + ";";
+
+	return signature;
+}
+
+//********************
+// Private functions *
+//********************
+
+bool FileTypeRegistry::Save(const std::string &path) const
+{
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+	std::ofstream stream(path, std::ios::trunc);
+	stream << "# File types shown by the image viewer: <extension> <image|video> [off]" << std::endl;
+	for (const auto &fileType : types)
+		stream << fileType.name << " " << (fileType.type == MediaType::VIDEO ? "video" : "image") << (fileType.active ? "" : " off") << std::endl;
+
+	return (bool) stream;
+}
+
+/* Find a table size and multiplier that put every extension in its own slot. The table starts at about four slots per type and doubles
+ * whenever a handful of multipliers all collide, which for a few dozen types settles on a table of a few hundred slots. */
+void FileTypeRegistry::BuildTable()
+{
+	int bits = 2;
+	while (((std::size_t) 1 << bits) < 4 * types.size())
+		bits++;
+
+	// Odd multipliers drawn from splitmix64 (Reference: https://prng.di.unimi.it/splitmix64.c)
+	uint64_t state = 0;
+	while (true)
+	{
+		for (int attempt = 0; attempt < 64; attempt++)
+		{
+			uint64_t candidate = (state += 0x9E3779B97F4A7C15);
+			candidate = (candidate ^ (candidate >> 30)) * 0xBF58476D1CE4E5B9;
+			candidate = (candidate ^ (candidate >> 27)) * 0x94D049BB133111EB;
+			candidate = (candidate ^ (candidate >> 31)) | 1;
+
+			std::vector<Slot> candidateSlots((std::size_t) 1 << bits);
+			bool collided = false;
+			for (std::size_t i = 0; i < types.size() && !collided; i++)
+			{
+				// Add() only accepts extensions that fit in a key, but one that didn't could never be found anyway, so it wouldn't need a slot
+				uint64_t key = 0;
+				if (!GetKey(std::string_view(types[i].name).substr(1), key))
+					continue;
+
+				Slot &slot = candidateSlots[(key * candidate) >> (64 - bits)];
+				collided = slot.key != 0;
+				slot = { key, i };
+			}
+
+			if (!collided)
+			{
+				slots = std::move(candidateSlots);
+				multiplier = candidate;
+				shift = 64 - bits;
+				return;
+			}
+		}
+
+		bits++;
+	}
+}
+
+// Pack an extension (without its dot) into an integer, lowercasing it along the way. Returns false if it's empty or too long to fit
+bool FileTypeRegistry::GetKey(std::string_view extension, uint64_t &key)
+{
+	if (extension.empty() || extension.size() > MAX_EXTENSION_LENGTH)
+		return false;
+
+	key = 0;
+	for (char character : extension)
+	{
+		unsigned char byte = (unsigned char) character;
+		if (byte >= 'A' && byte <= 'Z')
+			byte += 'a' - 'A';
+		key = (key << 8) | byte;
+	}
+
+	return true;
+}
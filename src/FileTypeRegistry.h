@@ -0,0 +1,48 @@
+// Marcus Schmidt
+// Created on 8/12/23
+
+#ifndef FILE_TYPE_REGISTRY
+#define FILE_TYPE_REGISTRY
+
+#include "CustomTypes.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* The file types the viewer knows about, loaded from a config file, along with a lookup table that classifies a file name by its extension.
+ * Extensions (up to 8 characters after the dot) are packed into an integer and placed with a multiplicative hash whose multiplier is
+ * chosen so that no two extensions share a slot, so classifying a name is one probe with no allocation no matter how many types there are. */
+class FileTypeRegistry
+{
+public:
+	FileTypeRegistry();
+
+	void Load(const std::string &path);
+	bool Add(std::string extension, MediaType type, bool active = true);
+	void SetActive(std::size_t index, bool active) { types[index].active = active; }
+
+	const std::vector<FileType> & GetTypes() const { return types; }
+	const FileType * Find(std::string_view fileName) const;
+	std::string GetSignature() const;
+
+	constexpr static std::size_t MAX_EXTENSION_LENGTH = 8;
+
+private:
+	struct Slot
+	{
+		uint64_t key = 0; // 0 is never a valid key, so it marks an empty slot
+		std::size_t index = 0;
+	};
+
+	bool Save(const std::string &path) const;
+	void BuildTable();
+	static bool GetKey(std::string_view extension, uint64_t &key);
+
+	std::vector<FileType> types;
+	std::vector<Slot> slots;
+	uint64_t multiplier = 1;
+	int shift = 63;
+};
+
+#endif
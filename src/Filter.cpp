@@ -3,34 +3,181 @@
 
 #include "Filter.h"
 #include "StaticUtilities.h"
+#include "DirectoryReader.h"
+#include "PerceptualHashCache.h"
+#include "Trace.h"
 #include <iostream>
 
 Filter::Filter()
 {
 	type = NONE;
+	match = NAME;
 	path = "";
 }
 
-void Filter::SetFilter(Type _type, std::string _path)
+void Filter::SetFilter(Type _type, std::string _path, Match _match)
 {
 	type = _type;
 	path = _path;
+	match = _match;
 }
 
 Filter * Filter::GetCopy()
 {
 	Filter *copy = new Filter();
-	copy->SetFilter(type, path);
+	copy->SetFilter(type, path, match);
 	return copy;
 }
 
-std::unordered_map<std::string, int> Filter::GetFilterItems()
+std::unordered_map<std::string, Filter::CacheEntry> Filter::cache;
+std::unordered_map<std::string, Filter::ContentCacheEntry> Filter::contentCache;
+std::unordered_map<std::string, Filter::SimilarCacheEntry> Filter::similarCache;
+std::mutex Filter::cacheMutex;
+
+/* Walking the source folder is only necessary the first time it's used or after it changes. Otherwise the previously found items are
+ * returned, which only costs checking the modification time of each directory in the source folder. */
+std::shared_ptr<const std::unordered_map<std::string, int>> Filter::GetFilterItems()
+{
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		auto iterator = cache.find(path);
+		if (iterator != cache.end() && IsCurrent(iterator->second.directoryTimes))
+			return iterator->second.items;
+	}
+
+	Trace::Span span("GetFilterItems");
+	span.SetDetail(path);
+	std::shared_ptr<std::unordered_map<std::string, int>> items = std::make_shared<std::unordered_map<std::string, int>>();
+	CacheEntry entry;
+
+	std::vector<std::string> images = StaticUtilities::RecurseGetImages((std::filesystem::path) path, &entry.directoryTimes);
+	for (const auto &image : images)
+		(*items)[StaticUtilities::StandardizeImageName(image)] = 1;
+
+	entry.items = items;
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	cache[path] = entry;
+
+	return entry.items;
+}
+
+/* The fingerprint of every file in the source folder, found the same way as the names (see GetFilterItems()). Walking the folder only reads
+ * the directories, and fingerprints of files that haven't changed come from the FingerprintCache, so only new files are read */
+std::shared_ptr<const FingerprintItems> Filter::GetFilterFingerprints()
+{
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		auto iterator = contentCache.find(path);
+		if (iterator != contentCache.end() && IsCurrent(iterator->second.directoryTimes))
+			return iterator->second.fingerprints;
+	}
+
+	Trace::Span span("GetFilterFingerprints");
+	span.SetDetail(path);
+	std::shared_ptr<FingerprintItems> fingerprints = std::make_shared<FingerprintItems>();
+	ContentCacheEntry entry;
+
+	std::vector<std::string> paths;
+	std::vector<time_t> modifiedTimes;
+	CollectFiles(path, entry.directoryTimes, paths, modifiedTimes);
+	std::vector<Fingerprint> found = FingerprintCache::Get().Resolve(paths, modifiedTimes);
+	for (std::size_t i = 0; i < found.size(); i++)
+	{
+		if (found[i].size != 0)
+			(*fingerprints)[found[i]].push_back(FingerprintSource{ paths[i], modifiedTimes[i] });
+	}
+
+	entry.fingerprints = fingerprints;
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	contentCache[path] = entry;
+
+	return entry.fingerprints;
+}
+
+/* An index of the perceptual hashes of the images in the source folder, found the same way as the fingerprints (see GetFilterFingerprints()).
+ * Files that can't be decoded as images are left out, and so are images that are still being hashed, in which case the index isn't kept so
+ * that it's built again with them once they're done */
+std::shared_ptr<const SimilarityIndex> Filter::GetFilterSimilarity()
+{
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		auto iterator = similarCache.find(path);
+		if (iterator != similarCache.end() && IsCurrent(iterator->second.directoryTimes))
+			return iterator->second.index;
+	}
+
+	Trace::Span span("GetFilterSimilarity");
+	span.SetDetail(path);
+	SimilarCacheEntry entry;
+
+	std::vector<std::string> paths;
+	std::vector<time_t> modifiedTimes;
+	CollectFiles(path, entry.directoryTimes, paths, modifiedTimes);
+	std::vector<uint64_t> hashes;
+	bool pending = false;
+	for (const PerceptualHash &hash : PerceptualHashCache::Get().Resolve(paths, modifiedTimes))
+	{
+		if (hash.valid)
+			hashes.push_back(hash.bits);
+		pending |= hash.pending;
+	}
+
+	std::shared_ptr<SimilarityIndex> index = std::make_shared<SimilarityIndex>();
+	index->Build(std::move(hashes));
+	entry.index = index;
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	if (!pending)
+		similarCache[path] = entry;
+
+	return entry.index;
+}
+
+void Filter::ClearCache()
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	cache.clear();
+	contentCache.clear();
+	similarCache.clear();
+}
+
+//********************
+// Private functions *
+//********************
+
+// A source folder is unchanged as long as none of its directories have been modified. Adding or removing a directory changes its parent, too
+bool Filter::IsCurrent(const std::vector<std::pair<std::string, int64_t>> &directoryTimes)
+{
+	for (const auto &directory : directoryTimes)
+	{
+		int64_t time;
+		if (!DirectoryReader::GetDirectoryTime(directory.first, time) || time != directory.second)
+			return false;
+	}
+
+	return true;
+}
+
+// Record the path and modification time of every file in a source folder, and the modification time of every directory in it, like RecurseGetImages()
+void Filter::CollectFiles(const std::filesystem::path &directory, std::vector<std::pair<std::string, int64_t>> &directoryTimes, std::vector<std::string> &paths,
+						  std::vector<time_t> &modifiedTimes)
 {
-	std::unordered_map<std::string, int> items;
+	int64_t time = 0;
+	DirectoryReader::GetDirectoryTime(directory.string(), time);
+	directoryTimes.push_back({ directory.string(), time });
 
-	std::vector<std::string> images = StaticUtilities::RecurseGetImages((std::filesystem::path) path);
-	for (const auto &entry : images)
-		items[StaticUtilities::StandardizeImageName(entry)] = 1;
+	DirectoryReader reader(directory.string());
+	while (reader.Next())
+	{
+		time_t modifiedTime;
+		if (reader.GetType() == DirectoryReader::DIRECTORY)
+			CollectFiles(directory / reader.GetName(), directoryTimes, paths, modifiedTimes);
+		else if (reader.GetType() == DirectoryReader::REGULAR_FILE && reader.GetModifiedTime(modifiedTime))
+		{
+			paths.push_back((directory / reader.GetName()).string());
+			modifiedTimes.push_back(modifiedTime);
+		}
+	}
 
-	return items;
+	if (reader.Failed())
+		std::cout << "Filter::CollectFiles(): Unable to read \"" << directory.string() << "\"" << std::endl;
 }
\ No newline at end of file
@@ -4,26 +4,75 @@
 #ifndef FILTER
 #define FILTER
 
+#include "FingerprintCache.h"
+#include "SimilarityIndex.h"
 #include <wx/string.h>
 #include <unordered_map>
 #include <filesystem>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
 
 class Filter
 {
 public:
 	enum Type { NONE, INCLUDE, EXCLUDE };
 
+	/* What makes an image the same as one in the source folder: its standardized name (see StaticUtilities::StandardizeImageName()), its
+	 * contents, which also recognizes renamed copies and tells apart different images that happen to have the same name, or how it looks,
+	 * which also recognizes copies that were resized, recompressed or exported again (see PerceptualHashCache) */
+	enum Match { NAME, CONTENT, SIMILAR };
+
 	Filter();
-	void SetFilter(Type _type, std::string _path);
+	void SetFilter(Type _type, std::string _path, Match _match = NAME);
 	Filter * GetCopy();
 
 	Type GetType() { return type; }
+	Match GetMatch() { return match; }
 	std::string GetPath() { return path; }
-	std::unordered_map<std::string, int> GetFilterItems();
+	std::shared_ptr<const std::unordered_map<std::string, int>> GetFilterItems();
+	std::shared_ptr<const FingerprintItems> GetFilterFingerprints();
+	std::shared_ptr<const SimilarityIndex> GetFilterSimilarity();
+
+	static void ClearCache();
 
 private:
+	// The standardized image names found in a source folder, and the modification time of every directory that was read to find them
+	struct CacheEntry
+	{
+		std::shared_ptr<const std::unordered_map<std::string, int>> items;
+		std::vector<std::pair<std::string, int64_t>> directoryTimes;
+	};
+
+	// The same for the fingerprints of the files in a source folder
+	struct ContentCacheEntry
+	{
+		std::shared_ptr<const FingerprintItems> fingerprints;
+		std::vector<std::pair<std::string, int64_t>> directoryTimes;
+	};
+
+	// And for the perceptual hashes of the images in a source folder
+	struct SimilarCacheEntry
+	{
+		std::shared_ptr<const SimilarityIndex> index;
+		std::vector<std::pair<std::string, int64_t>> directoryTimes;
+	};
+
+	static bool IsCurrent(const std::vector<std::pair<std::string, int64_t>> &directoryTimes);
+	static void CollectFiles(const std::filesystem::path &directory, std::vector<std::pair<std::string, int64_t>> &directoryTimes, std::vector<std::string> &paths,
+							 std::vector<time_t> &modifiedTimes);
+
+	// Every filter with the same source folder (including the copies given to subdirectories) shares one set of items
+	static std::unordered_map<std::string, CacheEntry> cache;
+	static std::unordered_map<std::string, ContentCacheEntry> contentCache;
+	static std::unordered_map<std::string, SimilarCacheEntry> similarCache;
+	static std::mutex cacheMutex;
+
 	Type type;
+	Match match;
 	std::string path;
 };
 
@@ -42,11 +42,12 @@ FilterEditor::FilterEditor(wxWindow *parent, wxWindowID id, const wxString &titl
 void FilterEditor::OnOk(wxCommandEvent &event)
 {
 	// Apply the current selections to all filters
-	int type;
+	int type, match;
 	for (const auto &filterContainer : filterContainers)
 	{
 		type = filterContainer.comboBox->GetSelection();
-		filterContainer.filter->SetFilter(static_cast<Filter::Type>(type), filterContainer.path);
+		match = filterContainer.matchBox->GetSelection();
+		filterContainer.filter->SetFilter(static_cast<Filter::Type>(type), filterContainer.path, static_cast<Filter::Match>(match));
 	}
 
 	// And then close the window
@@ -135,6 +136,11 @@ FilterEditor::FilterContainer FilterEditor::NewFilterContainer(Filter *filter)
 	filterContainer.comboBox = new wxComboBox(this, wxID_APPLY, wxEmptyString, wxDefaultPosition, wxDefaultSize, 3, choices, wxCB_READONLY);
 	filterContainer.comboBox->SetSelection(selection);
 
+	// Create the combo box for how images are matched, which has its own ID so that changing it doesn't add another filter
+	wxString matchChoices[3] = { "File Name", "File Contents", "Similar Looks" };
+	filterContainer.matchBox = new wxComboBox(this, wxID_ANY, wxEmptyString, wxDefaultPosition, wxDefaultSize, 3, matchChoices, wxCB_READONLY);
+	filterContainer.matchBox->SetSelection(static_cast<int>(filter->GetMatch()));
+
 	// Create the directory button
 	int id = StaticUtilities::GetUniqueId();
 	filterContainer.button = new wxButton(this, id, GetDisplayPath(path));
@@ -145,6 +151,8 @@ FilterEditor::FilterContainer FilterEditor::NewFilterContainer(Filter *filter)
 	labelSizer->Add(new wxStaticText(this, wxID_ANY, "Filter Type:"), wxSizerFlags().Right());
 	labelSizer->AddSpacer(20);
 	labelSizer->Add(new wxStaticText(this, wxID_ANY, "Source Folder:"), wxSizerFlags().Right());
+	labelSizer->AddSpacer(20);
+	labelSizer->Add(new wxStaticText(this, wxID_ANY, "Match By:"), wxSizerFlags().Right());
 	filterContainer.sizer->Add(labelSizer, wxSizerFlags().Border(wxLEFT | wxUP, 13));
 
 	// Create the right side of the sizer with the buttons / controls
@@ -153,6 +161,8 @@ FilterEditor::FilterContainer FilterEditor::NewFilterContainer(Filter *filter)
 	buttonSizer->Add(filterContainer.comboBox, wxSizerFlags());
 	buttonSizer->AddSpacer(15);
 	buttonSizer->Add(filterContainer.button, wxSizerFlags());
+	buttonSizer->AddSpacer(15);
+	buttonSizer->Add(filterContainer.matchBox, wxSizerFlags());
 	filterContainer.sizer->Add(buttonSizer, wxSizerFlags().Border(wxLEFT | wxUP | wxRIGHT, 10));
 
 	// Add this newly created sizer to the window
@@ -28,6 +28,7 @@ private:
 		wxBoxSizer *sizer;
 		wxButton *button;
 		wxComboBox *comboBox;
+		wxComboBox *matchBox;
 	};
 
 	DECLARE_EVENT_TABLE();
@@ -0,0 +1,265 @@
+// Marcus Schmidt
+// Created on 10/28/23
+
+#include "FingerprintCache.h"
+#include "CacheFile.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+
+FingerprintCache & FingerprintCache::Get()
+{
+	static FingerprintCache cache;
+	return cache;
+}
+
+// Read the saved fingerprints, unless the file is the one that's already open (every viewer window shares the same cache)
+void FingerprintCache::Load(std::string _path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_path == path)
+		return;
+
+	path = _path;
+	entries.clear();
+	identities.clear();
+	changed = false;
+
+	std::vector<uint64_t> records;
+	CacheFile::Read(path, MAGIC, RECORD_WORDS, records);
+	entries.reserve(records.size() / RECORD_WORDS);
+	for (std::size_t i = 0; i < records.size(); i += RECORD_WORDS)
+	{
+		entries[records[i]] = { (int64_t) records[i + 1], records[i + 2], records[i + 3], records[i + 4], records[i + 5] };
+		if (records[i + 2] != 0)
+			identities[records[i + 2]] = records[i];
+	}
+}
+
+void FingerprintCache::Save()
+{
+	std::string savePath;
+	std::vector<uint64_t> records;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!changed || path.empty())
+			return;
+		changed = false;
+
+		savePath = path;
+		records.reserve(entries.size() * RECORD_WORDS);
+		for (const auto &entry : entries)
+		{
+			records.push_back(entry.first);
+			records.push_back((uint64_t) entry.second.modifiedTime);
+			records.push_back(entry.second.identity);
+			records.push_back(entry.second.size);
+			records.push_back(entry.second.hash);
+			records.push_back(entry.second.fullHash);
+		}
+	}
+
+	CacheFile::Write(savePath, MAGIC, RECORD_WORDS, records);
+}
+
+// Forget every fingerprint (and delete the saved file) so that every file is read again
+void FingerprintCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	entries.clear();
+	identities.clear();
+	changed = false;
+	CacheFile::Remove(path);
+}
+
+/* The fingerprint of every file in 'paths', whose modification times (as the scan catalog recorded them) are in 'modifiedTimes'. The cached ones
+ * are looked up all at once, and the rest are read in batches on the thread pool and added to the cache together at the end */
+std::vector<Fingerprint> FingerprintCache::Resolve(const std::vector<std::string> &paths, const std::vector<time_t> &modifiedTimes)
+{
+	Trace::Span span("ResolveFingerprints");
+	std::vector<Fingerprint> fingerprints(paths.size());
+	std::vector<std::size_t> missing;
+	std::vector<uint64_t> keys(paths.size());
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (std::size_t i = 0; i < paths.size(); i++)
+		{
+			keys[i] = CacheFile::GetKey(paths[i]);
+			auto iterator = entries.find(keys[i]);
+			if (iterator != entries.end() && iterator->second.modifiedTime == (int64_t) modifiedTimes[i])
+				fingerprints[i] = { iterator->second.size, iterator->second.hash };
+			else
+				missing.push_back(i);
+		}
+	}
+	if (missing.empty())
+		return fingerprints;
+
+	// Every task writes to its own part of 'read' and 'fingerprints', so nothing needs a lock until the results are stored
+	std::vector<Entry> read(missing.size());
+	auto ReadBatch = [this, &paths, &modifiedTimes, &keys, &missing, &read, &fingerprints](std::size_t start)
+	{
+		for (std::size_t i = start; i < std::min(start + BATCH_SIZE, missing.size()); i++)
+		{
+			std::size_t file = missing[i];
+			read[i] = Read(paths[file], modifiedTimes[file], keys[file]);
+			fingerprints[file] = { read[i].size, read[i].hash };
+		}
+	};
+
+	ThreadPool &pool = ThreadPool::Get();
+	if (pool.GetThreadCount() > 1 && missing.size() > BATCH_SIZE)
+	{
+		TaskGroup group(pool);
+		for (std::size_t start = 0; start < missing.size(); start += BATCH_SIZE)
+			group.Run([&ReadBatch, start]() { ReadBatch(start); });
+		group.Wait();
+	}
+	else
+	{
+		for (std::size_t start = 0; start < missing.size(); start += BATCH_SIZE)
+			ReadBatch(start);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for (std::size_t i = 0; i < missing.size(); i++)
+		Store(keys[missing[i]], read[i]);
+	return fingerprints;
+}
+
+/* Whether two files with the same fingerprint really have the same contents, by comparing hashes of the whole files. It's only needed when the
+ * fingerprints match, so each file is read in full at most once for as long as it's unchanged */
+bool FingerprintCache::IsSameContent(const std::string &pathA, time_t modifiedTimeA, const std::string &pathB, time_t modifiedTimeB)
+{
+	if (pathA == pathB)
+		return true;
+
+	uint64_t hashA = GetFullHash(pathA, modifiedTimeA);
+	return hashA != 0 && hashA == GetFullHash(pathB, modifiedTimeB);
+}
+
+//********************
+// Private functions *
+//********************
+
+/* Fingerprint one file. The blocks are read through a memory mapping, so only the pages that are sampled are read from the disk. A file that has
+ * been cached under a different path with the same device, inode, modification time and size is the same file renamed, so its entry is reused */
+FingerprintCache::Entry FingerprintCache::Read(const std::string &path, time_t modifiedTime, uint64_t key)
+{
+	Entry entry = { (int64_t) modifiedTime, 0, 0, 0, 0 };
+	struct stat status;
+	if (stat(path.c_str(), &status) != 0 || !S_ISREG(status.st_mode))
+		return entry;
+
+#if defined(__unix__) || defined(__APPLE__)
+	// Windows doesn't report inode numbers through stat(), so files are only ever recognized by their paths there
+	uint64_t device[2] = { (uint64_t) status.st_dev, (uint64_t) status.st_ino };
+	entry.identity = Hash(reinterpret_cast<const unsigned char *>(device), sizeof(device), 0) | 1;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto identity = identities.find(entry.identity);
+		auto cached = (identity != identities.end()) ? entries.find(identity->second) : entries.end();
+		if (cached != entries.end() && cached->second.identity == entry.identity && cached->second.modifiedTime == (int64_t) status.st_mtime
+			&& cached->second.size == (uint64_t) status.st_size && cached->second.size != 0)
+		{
+			Entry renamed = cached->second;
+			renamed.modifiedTime = (int64_t) modifiedTime;
+			return renamed;
+		}
+	}
+#endif
+
+	MappedFile file;
+	if (!file.Open(path, MappedFile::Access::RANDOM))
+		return entry;
+
+	// A small file is hashed whole, which makes its fingerprint a full hash as well
+	const unsigned char *data = file.GetData();
+	entry.size = file.GetSize();
+	if (entry.size <= 3 * SAMPLE_SIZE)
+	{
+		entry.hash = Hash(data, entry.size, entry.size);
+		entry.fullHash = entry.hash | 1;
+	}
+	else
+	{
+		entry.hash = Hash(data, SAMPLE_SIZE, entry.size);
+		entry.hash = Hash(data + (entry.size - SAMPLE_SIZE) / 2, SAMPLE_SIZE, entry.hash);
+		entry.hash = Hash(data + entry.size - SAMPLE_SIZE, SAMPLE_SIZE, entry.hash);
+	}
+
+	return entry;
+}
+
+// The hash of a file's whole contents, or 0 if it can't be read. It's remembered with the fingerprint when the file has one cached
+uint64_t FingerprintCache::GetFullHash(const std::string &path, time_t modifiedTime)
+{
+	uint64_t key = CacheFile::GetKey(path);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto iterator = entries.find(key);
+		if (iterator != entries.end() && iterator->second.modifiedTime == (int64_t) modifiedTime && iterator->second.fullHash != 0)
+			return iterator->second.fullHash;
+	}
+
+	MappedFile file;
+	if (!file.Open(path, MappedFile::Access::SEQUENTIAL))
+		return 0;
+	uint64_t hash = Hash(file.GetData(), file.GetSize(), file.GetSize()) | 1;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto iterator = entries.find(key);
+	if (iterator != entries.end() && iterator->second.modifiedTime == (int64_t) modifiedTime && iterator->second.size == file.GetSize())
+	{
+		iterator->second.fullHash = hash;
+		changed = true;
+	}
+	return hash;
+}
+
+// Must be called with the lock held
+void FingerprintCache::Store(uint64_t key, const Entry &entry)
+{
+	entries[key] = entry;
+	if (entry.identity != 0)
+		identities[entry.identity] = key;
+	changed = true;
+}
+
+/* A fast non-cryptographic 64-bit hash, which only has to tell files apart, not resist anyone trying to make them collide. It follows the
+ * structure of xxHash64 (four independent lanes over 32-byte stripes, so that the multiplications overlap) but isn't compatible with it.
+ * Reference: https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md */
+uint64_t FingerprintCache::Hash(const unsigned char *data, std::size_t size, uint64_t seed)
+{
+	const uint64_t PRIME_1 = 0x9E3779B185EBCA87, PRIME_2 = 0xC2B2AE3D27D4EB4F, PRIME_3 = 0x165667B19E3779F9;
+	auto RotateLeft = [](uint64_t x, int k) { return (x << k) | (x >> (64 - k)); };
+	auto Load = [](const unsigned char *bytes) { uint64_t word; std::memcpy(&word, bytes, sizeof(word)); return word; };
+
+	uint64_t lanes[4] = { seed + PRIME_1 + PRIME_2, seed + PRIME_2, seed, seed - PRIME_1 };
+	std::size_t i = 0;
+	for (; i + 32 <= size; i += 32)
+	{
+		for (int lane = 0; lane < 4; lane++)
+			lanes[lane] = RotateLeft(lanes[lane] + Load(data + i + lane * 8) * PRIME_2, 31) * PRIME_1;
+	}
+
+	uint64_t hash = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) + RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18) + size;
+	for (; i + 8 <= size; i += 8)
+		hash = RotateLeft(hash ^ (RotateLeft(Load(data + i) * PRIME_2, 31) * PRIME_1), 27) * PRIME_1 + PRIME_3;
+	if (i < size)
+	{
+		uint64_t word = 0;
+		std::memcpy(&word, data + i, size - i);
+		hash = RotateLeft(hash ^ (word * PRIME_1), 23) * PRIME_2 + PRIME_3;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PRIME_2;
+	hash ^= hash >> 29;
+	hash *= PRIME_3;
+	hash ^= hash >> 32;
+	return hash;
+}
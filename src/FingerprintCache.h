@@ -0,0 +1,90 @@
+// Marcus Schmidt
+// Created on 10/28/23
+
+#ifndef FINGERPRINT_CACHE
+#define FINGERPRINT_CACHE
+
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* What a file's contents are recognized by: its size and a hash of a few blocks sampled from its start, middle and end. Two files with
+ * different fingerprints are different, but two with the same fingerprint are only probably the same, which their full hashes decide
+ * (see FingerprintCache::IsSameContent()). A size of 0 means the file couldn't be read, and never matches anything. */
+struct Fingerprint
+{
+	uint64_t size;
+	uint64_t hash;
+
+	bool operator==(const Fingerprint &other) const { return size == other.size && hash == other.hash; }
+
+	struct Hasher
+	{
+		std::size_t operator()(const Fingerprint &fingerprint) const { return (std::size_t) (fingerprint.hash ^ (fingerprint.size * 0x9E3779B97F4A7C15)); }
+	};
+};
+
+// A file in a filter's source folder, which an image with the same fingerprint has its full hash compared with
+struct FingerprintSource
+{
+	std::string path;
+	time_t modifiedTime;
+};
+
+/* The fingerprints of the files in a filter's source folder, each with every file that has it. Files with different contents can share a
+ * fingerprint, so an image has to be compared with all of them before it's known not to be in the folder */
+typedef std::unordered_map<Fingerprint, std::vector<FingerprintSource>, Fingerprint::Hasher> FingerprintItems;
+
+/* The content fingerprints of files, for filters that match images by what they contain rather than by their names (see Filter::CONTENT).
+ * Fingerprinting reads a little of every file, so fingerprints are computed in parallel on the thread pool and remembered by a hash of the
+ * path along with the modification time, which lets a refresh look them up without touching the files. A file that isn't found by its path is
+ * looked up by its device and inode number before it's read, so a file that has only been renamed or moved keeps its fingerprint. */
+class FingerprintCache
+{
+public:
+	static FingerprintCache & Get();
+
+	void Load(std::string _path);
+	void Save();
+	void Clear();
+
+	std::vector<Fingerprint> Resolve(const std::vector<std::string> &paths, const std::vector<time_t> &modifiedTimes);
+	bool IsSameContent(const std::string &pathA, time_t modifiedTimeA, const std::string &pathB, time_t modifiedTimeB);
+
+	constexpr static std::size_t BATCH_SIZE = 64; // files fingerprinted by one task
+	constexpr static std::size_t SAMPLE_SIZE = 16384; // bytes hashed at each of the three places in a file; smaller files are hashed whole
+
+private:
+	// A full hash of 0 means it hasn't been computed yet
+	struct Entry
+	{
+		int64_t modifiedTime;
+		uint64_t identity;
+		uint64_t size;
+		uint64_t hash;
+		uint64_t fullHash;
+	};
+
+	FingerprintCache() {}
+
+	Entry Read(const std::string &path, time_t modifiedTime, uint64_t key);
+	uint64_t GetFullHash(const std::string &path, time_t modifiedTime);
+	void Store(uint64_t key, const Entry &entry);
+
+	static uint64_t Hash(const unsigned char *data, std::size_t size, uint64_t seed);
+
+	constexpr static uint64_t VERSION = 1;
+	constexpr static uint64_t MAGIC = 0x46494e4745520000 | VERSION; // "FINGER" and the version
+	constexpr static std::size_t RECORD_WORDS = 6; // the key, modification time, identity, size, hash and full hash (see CacheFile)
+
+	std::string path;
+	std::unordered_map<uint64_t, Entry> entries; // by the hash of the path
+	std::unordered_map<uint64_t, uint64_t> identities; // the key of the last entry stored for every device and inode
+	std::mutex mutex;
+	bool changed = false;
+};
+
+#endif
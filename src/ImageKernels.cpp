@@ -0,0 +1,413 @@
+// Marcus Schmidt
+// Created on 9/16/23
+
+#include "ImageKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// The vector versions are compiled for their instruction sets function by function, so the rest of the program still runs on any x86 processor
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define IMAGE_KERNELS_X86
+#include <immintrin.h>
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+std::atomic<ImageKernels::InstructionSet> ImageKernels::instructionSet(ImageKernels::GetSupported());
+
+// The source columns (or rows) that each destination column covers, and what fraction of the destination pixel each one makes up
+struct Coverage
+{
+	std::vector<int> first;
+	std::vector<int> count;
+	std::vector<float> weights; // 'stride' weights for every destination pixel, starting with the one for 'first'
+	int stride;
+};
+
+// Where the source pixel for each destination pixel is, as source pixel offsets: start + x * stepX + y * stepY
+struct Mapping
+{
+	std::ptrdiff_t start, stepX, stepY;
+	int width, height; // the size of the destination
+};
+
+static Coverage GetCoverage(int size, int newSize)
+{
+	Coverage coverage;
+	double scale = (double) size / newSize;
+	coverage.stride = (int) std::ceil(scale) + 1;
+	coverage.first.resize(newSize);
+	coverage.count.resize(newSize);
+	coverage.weights.assign((std::size_t) newSize * coverage.stride, 0.0f);
+	for (int i = 0; i < newSize; i++)
+	{
+		double start = i * scale, end = std::min((double) size, (i + 1) * scale);
+		int first = std::min(size - 1, (int) start), last = std::max(first, std::min(size - 1, (int) std::ceil(end) - 1));
+		coverage.first[i] = first;
+		coverage.count[i] = last - first + 1;
+		for (int j = first; j <= last; j++)
+			coverage.weights[(std::size_t) i * coverage.stride + j - first] = (float) ((std::min(end, j + 1.0) - std::max(start, (double) j)) / scale);
+	}
+	return coverage;
+}
+
+// See https://exiftool.org/TagNames/EXIF.html (Orientation) for what each value means
+static Mapping GetMapping(int width, int height, int orientation)
+{
+	std::ptrdiff_t w = width, last = (std::ptrdiff_t) (height - 1) * width;
+	switch (orientation)
+	{
+		case 2: return { w - 1, -1, w, width, height }; // mirrored left to right
+		case 3: return { last + w - 1, -1, -w, width, height }; // upside down
+		case 4: return { last, 1, -w, width, height }; // mirrored top to bottom
+		case 5: return { 0, w, 1, height, width }; // mirrored along the diagonal
+		case 6: return { last, -w, 1, height, width }; // turned a quarter clockwise
+		case 7: return { last + w - 1, -w, -1, height, width }; // mirrored along the other diagonal
+		case 8: return { w - 1, w, -1, height, width }; // turned a quarter counterclockwise
+		default: return { 0, 1, w, width, height };
+	}
+}
+
+//**********************
+// Plain C++ versions *
+//**********************
+
+static void AccumulateRowScalar(const unsigned char *row, std::size_t count, float weight, float *sums)
+{
+	for (std::size_t i = 0; i < count; i++)
+		sums[i] += row[i] * weight;
+}
+
+static void ReduceRowScalar(const float *sums, const Coverage &columns, int channels, unsigned char *destination, int newWidth)
+{
+	for (int x = 0; x < newWidth; x++)
+	{
+		const float *weights = &columns.weights[(std::size_t) x * columns.stride];
+		const float *pixel = sums + (std::size_t) columns.first[x] * channels;
+		for (int channel = 0; channel < channels; channel++)
+		{
+			float sum = 0.0f;
+			for (int i = 0; i < columns.count[x]; i++)
+				sum += pixel[i * channels + channel] * weights[i];
+			*destination++ = (unsigned char) std::min(255.0f, sum + 0.5f);
+		}
+	}
+}
+
+template <int channels>
+static void OrientRegion(const unsigned char *source, const Mapping &mapping, unsigned char *destination, int left, int right, int top, int bottom)
+{
+	for (int y = top; y < bottom; y++)
+	{
+		const unsigned char *from = source + (mapping.start + left * mapping.stepX + y * mapping.stepY) * channels;
+		unsigned char *to = destination + ((std::size_t) y * mapping.width + left) * channels;
+		for (int x = left; x < right; x++, from += mapping.stepX * channels, to += channels)
+			for (int channel = 0; channel < channels; channel++)
+				to[channel] = from[channel];
+	}
+}
+
+// Turning an image on its side reads the source down its columns, so it's done in tiles that stay in the cache
+template <int channels>
+static void OrientScalar(const unsigned char *source, const Mapping &mapping, unsigned char *destination)
+{
+	constexpr int TILE = 32;
+	for (int top = 0; top < mapping.height; top += TILE)
+		for (int left = 0; left < mapping.width; left += TILE)
+			OrientRegion<channels>(source, mapping, destination, left, std::min(left + TILE, mapping.width), top, std::min(top + TILE, mapping.height));
+}
+
+static void ConvertToDisplayScalar(const unsigned char *source, std::size_t count, const ImageKernels::Layout &layout, unsigned char *destination)
+{
+	for (std::size_t i = 0; i < count; i++, source += 3, destination += 4)
+	{
+		destination[layout.red] = source[0];
+		destination[layout.green] = source[1];
+		destination[layout.blue] = source[2];
+		destination[layout.alpha] = 255;
+	}
+}
+
+#ifdef IMAGE_KERNELS_X86
+//******************
+// SSSE3 versions *
+//******************
+
+// Four RGB pixels, loaded and stored without touching the bytes after them
+TARGET_SSSE3 static __m128i Load12(const unsigned char *pixels)
+{
+	int32_t last;
+	std::memcpy(&last, pixels + 8, 4);
+	return _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(pixels)), _mm_cvtsi32_si128(last));
+}
+
+TARGET_SSSE3 static void Store12(unsigned char *pixels, __m128i value)
+{
+	_mm_storel_epi64(reinterpret_cast<__m128i *>(pixels), value);
+	int32_t last = _mm_cvtsi128_si32(_mm_srli_si128(value, 8));
+	std::memcpy(pixels + 8, &last, 4);
+}
+
+TARGET_SSSE3 static void AccumulateRowSSSE3(const unsigned char *row, std::size_t count, float weight, float *sums)
+{
+	const __m128 weights = _mm_set1_ps(weight);
+	const __m128i zero = _mm_setzero_si128();
+	std::size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+		__m128i low = _mm_unpacklo_epi8(bytes, zero), high = _mm_unpackhi_epi8(bytes, zero);
+		__m128i words[4] = { _mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero), _mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero) };
+		for (int j = 0; j < 4; j++)
+		{
+			__m128 values = _mm_mul_ps(_mm_cvtepi32_ps(words[j]), weights);
+			_mm_storeu_ps(sums + i + 4 * j, _mm_add_ps(_mm_loadu_ps(sums + i + 4 * j), values));
+		}
+	}
+	AccumulateRowScalar(row + i, count - i, weight, sums + i);
+}
+
+/* Adds up an RGB pixel's three channels in one vector, which reads one float past the last pixel (so 'sums' has a spare one at the end) and
+ * throws that lane away */
+TARGET_SSSE3 static void ReduceRowRGBSSSE3(const float *sums, const Coverage &columns, unsigned char *destination, int newWidth)
+{
+	const __m128 half = _mm_set1_ps(0.5f), maximum = _mm_set1_ps(255.0f);
+	for (int x = 0; x < newWidth; x++, destination += 3)
+	{
+		const float *weights = &columns.weights[(std::size_t) x * columns.stride];
+		const float *pixel = sums + (std::size_t) columns.first[x] * 3;
+		__m128 sum = _mm_setzero_ps();
+		for (int i = 0; i < columns.count[x]; i++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(pixel + i * 3), _mm_set1_ps(weights[i])));
+
+		__m128i values = _mm_cvttps_epi32(_mm_min_ps(maximum, _mm_add_ps(sum, half)));
+		alignas(16) int32_t channels[4];
+		_mm_store_si128(reinterpret_cast<__m128i *>(channels), values);
+		destination[0] = (unsigned char) channels[0];
+		destination[1] = (unsigned char) channels[1];
+		destination[2] = (unsigned char) channels[2];
+	}
+}
+
+/* RGB images are turned 4 pixels by 4 at a time: each source row of the tile is spread out to one pixel per 32-bit lane, the 4x4 block of lanes
+ * is transposed, and each row of the result is packed back into RGB. Mirroring without turning just reverses 4 pixels at a time. The edges
+ * that don't fill a tile are left to the plain version. */
+TARGET_SSSE3 static void OrientRGBSSSE3(const unsigned char *source, const Mapping &mapping, unsigned char *destination)
+{
+	const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i spreadReversed = _mm_setr_epi8(9, 10, 11, -1, 6, 7, 8, -1, 3, 4, 5, -1, 0, 1, 2, -1);
+	const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	const __m128i reverse = _mm_setr_epi8(9, 10, 11, 6, 7, 8, 3, 4, 5, 0, 1, 2, -1, -1, -1, -1);
+	int width = mapping.width & ~3, height = mapping.height & ~3;
+
+	if (mapping.stepX == 1 || mapping.stepX == -1)
+	{
+		for (int y = 0; y < mapping.height; y++)
+		{
+			const unsigned char *from = source + (mapping.start + y * mapping.stepY) * 3;
+			unsigned char *to = destination + (std::size_t) y * mapping.width * 3;
+			if (mapping.stepX == 1)
+				std::memcpy(to, from, (std::size_t) mapping.width * 3);
+			else
+			{
+				for (int x = 0; x < width; x += 4)
+					Store12(to + x * 3, _mm_shuffle_epi8(Load12(from - (x + 3) * 3), reverse));
+				OrientRegion<3>(source, mapping, destination, width, mapping.width, y, y + 1);
+			}
+		}
+		return;
+	}
+
+	// Each destination row of a tile comes from one source column, which runs either way along the source rows
+	const __m128i rowSpread = mapping.stepY > 0 ? spread : spreadReversed;
+	std::ptrdiff_t columnOffset = mapping.stepY > 0 ? 0 : -3;
+	constexpr int BLOCK = 64; // destination columns per pass down the image, so the source rows being read stay in the cache
+	for (int left = 0; left < width; left += BLOCK)
+	{
+		int right = std::min(left + BLOCK, width);
+		for (int y = 0; y < height; y += 4)
+			for (int x = left; x < right; x += 4)
+			{
+				const unsigned char *from = source + (mapping.start + x * mapping.stepX + y * mapping.stepY + columnOffset) * 3;
+				__m128i rows[4];
+				for (int k = 0; k < 4; k++)
+					rows[k] = _mm_shuffle_epi8(Load12(from + k * mapping.stepX * 3), rowSpread);
+
+				__m128i low01 = _mm_unpacklo_epi32(rows[0], rows[1]), low23 = _mm_unpacklo_epi32(rows[2], rows[3]);
+				__m128i high01 = _mm_unpackhi_epi32(rows[0], rows[1]), high23 = _mm_unpackhi_epi32(rows[2], rows[3]);
+				__m128i columns[4] = { _mm_unpacklo_epi64(low01, low23), _mm_unpackhi_epi64(low01, low23), _mm_unpacklo_epi64(high01, high23),
+									   _mm_unpackhi_epi64(high01, high23) };
+
+				unsigned char *to = destination + ((std::size_t) y * mapping.width + x) * 3;
+				for (int j = 0; j < 4; j++)
+					Store12(to + (std::size_t) j * mapping.width * 3, _mm_shuffle_epi8(columns[j], pack));
+			}
+	}
+	OrientRegion<3>(source, mapping, destination, width, mapping.width, 0, mapping.height);
+	OrientRegion<3>(source, mapping, destination, 0, width, height, mapping.height);
+}
+
+// The byte shuffle that spreads 4 RGB pixels into display pixels, with zeros where the alpha goes
+static __m128i GetDisplayShuffle(const ImageKernels::Layout &layout, __m128i &alpha)
+{
+	alignas(16) int8_t shuffle[16], alphaBytes[16] = {};
+	for (int pixel = 0; pixel < 4; pixel++)
+	{
+		shuffle[pixel * 4 + layout.red] = (int8_t) (pixel * 3);
+		shuffle[pixel * 4 + layout.green] = (int8_t) (pixel * 3 + 1);
+		shuffle[pixel * 4 + layout.blue] = (int8_t) (pixel * 3 + 2);
+		shuffle[pixel * 4 + layout.alpha] = -1;
+		alphaBytes[pixel * 4 + layout.alpha] = -1;
+	}
+	alpha = _mm_load_si128(reinterpret_cast<const __m128i *>(alphaBytes));
+	return _mm_load_si128(reinterpret_cast<const __m128i *>(shuffle));
+}
+
+// Each step loads 16 bytes for 4 pixels, so it stops while there are at least 6 pixels left to stay inside the source
+TARGET_SSSE3 static void ConvertToDisplaySSSE3(const unsigned char *source, std::size_t count, const ImageKernels::Layout &layout, unsigned char *destination)
+{
+	__m128i alpha;
+	const __m128i shuffle = GetDisplayShuffle(layout, alpha);
+	std::size_t i = 0;
+	for (; i + 6 <= count; i += 4)
+	{
+		__m128i pixels = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(source + i * 3)), shuffle);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(destination + i * 4), _mm_or_si128(pixels, alpha));
+	}
+	ConvertToDisplayScalar(source + i * 3, count - i, layout, destination + i * 4);
+}
+
+//*****************
+// AVX2 versions *
+//*****************
+
+TARGET_AVX2 static void AccumulateRowAVX2(const unsigned char *row, std::size_t count, float weight, float *sums)
+{
+	const __m256 weights = _mm256_set1_ps(weight);
+	std::size_t i = 0;
+	for (; i + 32 <= count; i += 32)
+		for (int j = 0; j < 32; j += 8)
+		{
+			__m256 values = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(row + i + j))));
+			_mm256_storeu_ps(sums + i + j, _mm256_add_ps(_mm256_loadu_ps(sums + i + j), _mm256_mul_ps(values, weights)));
+		}
+	AccumulateRowScalar(row + i, count - i, weight, sums + i);
+}
+
+// 8 pixels per step, 4 in each half of the register, where the second half's load ends 28 bytes in (so at least 10 pixels have to be left)
+TARGET_AVX2 static void ConvertToDisplayAVX2(const unsigned char *source, std::size_t count, const ImageKernels::Layout &layout, unsigned char *destination)
+{
+	__m128i alpha;
+	const __m128i shuffle = GetDisplayShuffle(layout, alpha);
+	const __m256i shuffles = _mm256_broadcastsi128_si256(shuffle), alphas = _mm256_broadcastsi128_si256(alpha);
+	std::size_t i = 0;
+	for (; i + 10 <= count; i += 8)
+	{
+		const unsigned char *pixels = source + i * 3;
+		__m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels))),
+												_mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + 12)), 1);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(destination + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(bytes, shuffles), alphas));
+	}
+	ConvertToDisplayScalar(source + i * 3, count - i, layout, destination + i * 4);
+}
+#endif
+
+/* Shrink an image by averaging the source pixels that each destination pixel covers (including the fractions of the ones on its edges), which
+ * doesn't alias the way sampling does. The rows are combined first, which is the bulk of the work and runs on whole rows at a time, and then
+ * each destination row is narrowed from its sums */
+void ImageKernels::Downscale(const unsigned char *source, int width, int height, int channels, unsigned char *destination, int newWidth, int newHeight)
+{
+	InstructionSet set = instructionSet;
+	Coverage columns = GetCoverage(width, newWidth), rows = GetCoverage(height, newHeight);
+	std::size_t rowLength = (std::size_t) width * channels;
+	std::vector<float> sums(rowLength + 1);
+
+	for (int y = 0; y < newHeight; y++)
+	{
+		std::fill(sums.begin(), sums.end(), 0.0f);
+		for (int i = 0; i < rows.count[y]; i++)
+		{
+			const unsigned char *row = source + (std::size_t) (rows.first[y] + i) * rowLength;
+			float weight = rows.weights[(std::size_t) y * rows.stride + i];
+#ifdef IMAGE_KERNELS_X86
+			if (set == InstructionSet::AVX2)
+				AccumulateRowAVX2(row, rowLength, weight, sums.data());
+			else if (set == InstructionSet::SSSE3)
+				AccumulateRowSSSE3(row, rowLength, weight, sums.data());
+			else
+#endif
+				AccumulateRowScalar(row, rowLength, weight, sums.data());
+		}
+
+		unsigned char *row = destination + (std::size_t) y * newWidth * channels;
+#ifdef IMAGE_KERNELS_X86
+		if (channels == 3 && set != InstructionSet::SCALAR)
+			ReduceRowRGBSSSE3(sums.data(), columns, row, newWidth);
+		else
+#endif
+			ReduceRowScalar(sums.data(), columns, channels, row, newWidth);
+	}
+}
+
+/* Turn an image the way its Exif orientation says so that it's upright. The destination is the same size as the source, with the width and height
+ * swapped for the orientations that turn the image on its side */
+void ImageKernels::Orient(const unsigned char *source, int width, int height, int channels, int orientation, unsigned char *destination)
+{
+	Mapping mapping = GetMapping(width, height, orientation);
+#ifdef IMAGE_KERNELS_X86
+	if (channels == 3 && instructionSet != InstructionSet::SCALAR)
+	{
+		OrientRGBSSSE3(source, mapping, destination);
+		return;
+	}
+#endif
+
+	if (channels == 3)
+		OrientScalar<3>(source, mapping, destination);
+	else if (channels == 1)
+		OrientScalar<1>(source, mapping, destination);
+}
+
+// Spread RGB pixels out to the 4 bytes per pixel that the screen's bitmaps use, all of them opaque
+void ImageKernels::ConvertToDisplay(const unsigned char *source, std::size_t count, const Layout &layout, unsigned char *destination)
+{
+#ifdef IMAGE_KERNELS_X86
+	InstructionSet set = instructionSet;
+	if (set == InstructionSet::AVX2)
+		ConvertToDisplayAVX2(source, count, layout, destination);
+	else if (set == InstructionSet::SSSE3)
+		ConvertToDisplaySSSE3(source, count, layout, destination);
+	else
+#endif
+		ConvertToDisplayScalar(source, count, layout, destination);
+}
+
+ImageKernels::InstructionSet ImageKernels::GetSupported()
+{
+#ifdef IMAGE_KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return InstructionSet::AVX2;
+	if (__builtin_cpu_supports("ssse3"))
+		return InstructionSet::SSSE3;
+#endif
+	return InstructionSet::SCALAR;
+}
+
+void ImageKernels::SetInstructionSet(InstructionSet set)
+{
+	instructionSet = std::min(set, GetSupported());
+}
+
+const char * ImageKernels::GetName(InstructionSet set)
+{
+	switch (set)
+	{
+		case InstructionSet::AVX2: return "AVX2";
+		case InstructionSet::SSSE3: return "SSSE3";
+		default: return "scalar";
+	}
+}
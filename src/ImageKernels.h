@@ -0,0 +1,41 @@
+// Marcus Schmidt
+// Created on 9/16/23
+
+#ifndef IMAGE_KERNELS
+#define IMAGE_KERNELS
+
+#include <atomic>
+#include <cstddef>
+
+/* The pixel loops behind showing an image: shrinking it to the size it's shown at, turning it the way the camera was held and converting it to
+ * the layout the screen's bitmaps use. Images are packed rows of 'channels' bytes per pixel (3 for wxImage's RGB data, 1 for its alpha), and
+ * nothing here depends on wxWidgets. Each kernel has a plain C++ version and, on x86, SSSE3 and AVX2 versions that are picked when the program
+ * starts based on what the processor supports. */
+class ImageKernels
+{
+public:
+	enum class InstructionSet { SCALAR, SSSE3, AVX2 };
+
+	// Where each channel goes in a 4-byte display pixel
+	struct Layout
+	{
+		int red, green, blue, alpha;
+	};
+
+	static void Downscale(const unsigned char *source, int width, int height, int channels, unsigned char *destination, int newWidth, int newHeight);
+	static void Orient(const unsigned char *source, int width, int height, int channels, int orientation, unsigned char *destination);
+	static void ConvertToDisplay(const unsigned char *source, std::size_t count, const Layout &layout, unsigned char *destination);
+
+	// Exif orientations 5 to 8 turn the image on its side, which swaps its width and height
+	static bool SwapsSides(int orientation) { return orientation >= 5 && orientation <= 8; }
+
+	static InstructionSet GetSupported();
+	static InstructionSet GetInstructionSet() { return instructionSet; }
+	static void SetInstructionSet(InstructionSet set); // limited to what's supported, mostly so the benchmark can compare the versions
+	static const char * GetName(InstructionSet set);
+
+private:
+	static std::atomic<InstructionSet> instructionSet;
+};
+
+#endif
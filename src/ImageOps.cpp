@@ -0,0 +1,105 @@
+// Marcus Schmidt
+// Created on 9/16/23
+
+#include "ImageOps.h"
+#include "ImageKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <wx/rawbmp.h>
+
+/* Let the image handler decode an image that's about to be loaded at a reduced size, but never smaller than it needs to be to Fit() 'size'. The
+ * JPEG handler only decodes 1/2, 1/4 or 1/8 of the coefficients, and wxImage then keeps halving whatever it got, both until the image fits within
+ * the maximum, so the result can be little more than half the maximum. With a maximum of twice the size, the last halving (if there was one)
+ * left the image at least as large as the size in the dimension that stopped it, which is all that fitting it needs. Other formats ignore
+ * the options and are decoded at full size */
+void ImageOps::LimitDecodeSize(wxImage &image, const wxSize &size)
+{
+	if (size.GetWidth() <= 0 || size.GetHeight() <= 0)
+		return;
+	image.SetOption(wxIMAGE_OPTION_MAX_WIDTH, 2 * size.GetWidth());
+	image.SetOption(wxIMAGE_OPTION_MAX_HEIGHT, 2 * size.GetHeight());
+}
+
+/* Shrink an image to fit inside 'size', keeping its aspect ratio. Images that already fit (and empty sizes) are returned as they are. A mask
+ * colour wouldn't survive its pixels being averaged with their neighbours, so an image with a mask is shrunk with the mask turned into alpha */
+wxImage ImageOps::Fit(const wxImage &original, const wxSize &size)
+{
+	if (!original.IsOk() || size.GetWidth() <= 0 || size.GetHeight() <= 0
+		|| (original.GetWidth() <= size.GetWidth() && original.GetHeight() <= size.GetHeight()))
+		return original;
+
+	wxImage image = original;
+	if (image.HasMask() && !image.HasAlpha())
+	{
+		image = original.Copy();
+		image.InitAlpha();
+	}
+
+	double scale = std::min((double) size.GetWidth() / image.GetWidth(), (double) size.GetHeight() / image.GetHeight());
+	int width = std::max(1, (int) std::lround(image.GetWidth() * scale)), height = std::max(1, (int) std::lround(image.GetHeight() * scale));
+
+	// wxImage frees its data with free(), so it has to come from malloc()
+	unsigned char *data = static_cast<unsigned char *>(std::malloc((std::size_t) width * height * 3));
+	ImageKernels::Downscale(image.GetData(), image.GetWidth(), image.GetHeight(), 3, data, width, height);
+	wxImage fitted(width, height, data);
+	if (image.HasAlpha())
+	{
+		unsigned char *alpha = static_cast<unsigned char *>(std::malloc((std::size_t) width * height));
+		ImageKernels::Downscale(image.GetAlpha(), image.GetWidth(), image.GetHeight(), 1, alpha, width, height);
+		fitted.SetAlpha(alpha);
+	}
+	return fitted;
+}
+
+// Turn an image upright according to its Exif orientation (1 to 8, where 1 means it already is). Pixels are only moved, so a mask colour still applies
+wxImage ImageOps::Orient(const wxImage &image, int orientation)
+{
+	if (!image.IsOk() || orientation < 2 || orientation > 8)
+		return image;
+
+	int width = image.GetWidth(), height = image.GetHeight();
+	int newWidth = ImageKernels::SwapsSides(orientation) ? height : width, newHeight = ImageKernels::SwapsSides(orientation) ? width : height;
+	unsigned char *data = static_cast<unsigned char *>(std::malloc((std::size_t) width * height * 3));
+	ImageKernels::Orient(image.GetData(), width, height, 3, orientation, data);
+	wxImage oriented(newWidth, newHeight, data);
+	if (image.HasAlpha())
+	{
+		unsigned char *alpha = static_cast<unsigned char *>(std::malloc((std::size_t) width * height));
+		ImageKernels::Orient(image.GetAlpha(), width, height, 1, orientation, alpha);
+		oriented.SetAlpha(alpha);
+	}
+	if (image.HasMask())
+		oriented.SetMaskColour(image.GetMaskRed(), image.GetMaskGreen(), image.GetMaskBlue());
+	return oriented;
+}
+
+/* Make a bitmap for the screen by writing the image's pixels straight into the bitmap's memory in the layout the platform uses. Images with
+ * transparency need their alpha premultiplied on some platforms, so those (and anything the raw access doesn't work for) go through wxWidgets'
+ * own conversion. The scale factor is how many of the image's pixels make up one of the window's (see wxWindow::GetContentScaleFactor()) */
+wxBitmap ImageOps::CreateBitmap(const wxImage &image, double scaleFactor)
+{
+	wxBitmap bitmap;
+	if (image.IsOk() && !image.HasAlpha() && !image.HasMask() && bitmap.Create(image.GetWidth(), image.GetHeight(), 32))
+	{
+		wxAlphaPixelData pixels(bitmap);
+		if (pixels)
+		{
+			const ImageKernels::Layout layout = { wxAlphaPixelFormat::RED, wxAlphaPixelFormat::GREEN, wxAlphaPixelFormat::BLUE, wxAlphaPixelFormat::ALPHA };
+			wxAlphaPixelData::Iterator row(pixels);
+			const unsigned char *source = image.GetData();
+			for (int y = 0; y < image.GetHeight(); y++, source += (std::size_t) image.GetWidth() * 3)
+			{
+				ImageKernels::ConvertToDisplay(source, image.GetWidth(), layout, reinterpret_cast<unsigned char *>(row.m_ptr));
+				row.OffsetY(pixels, 1);
+			}
+		}
+		else
+			bitmap = wxBitmap(image);
+	}
+	else
+		bitmap = wxBitmap(image);
+
+	bitmap.SetScaleFactor(scaleFactor);
+	return bitmap;
+}
@@ -0,0 +1,20 @@
+// Marcus Schmidt
+// Created on 9/16/23
+
+#ifndef IMAGE_OPS
+#define IMAGE_OPS
+
+#include <wx/bitmap.h>
+#include <wx/image.h>
+
+// The image kernels (see ImageKernels.h) applied to wxImages, keeping the alpha channel along with the pixels
+class ImageOps
+{
+public:
+	static void LimitDecodeSize(wxImage &image, const wxSize &size);
+	static wxImage Fit(const wxImage &image, const wxSize &size);
+	static wxImage Orient(const wxImage &image, int orientation);
+	static wxBitmap CreateBitmap(const wxImage &image, double scaleFactor = 1.0);
+};
+
+#endif
@@ -0,0 +1,401 @@
+// Marcus Schmidt
+// Created on 8/19/23
+
+#include "ImagePrefetcher.h"
+#include "ThreadPool.h"
+#include "ExifReader.h"
+#include "ImageKernels.h"
+#include "ImageOps.h"
+#include "MovieReader.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <unordered_set>
+#include <wx/log.h>
+#include <wx/mstream.h>
+
+ImagePrefetcher::ImagePrefetcher()
+{
+	shared = std::make_shared<Shared>();
+}
+
+// Tasks that haven't started yet will find nothing left to decode, and a decode that's already running finishes on its own and is thrown away
+ImagePrefetcher::~ImagePrefetcher()
+{
+	std::lock_guard<std::mutex> lock(shared->mutex);
+	for (auto &entry : shared->entries)
+		entry.second->removed = true;
+	shared->entries.clear();
+	shared->queue.clear();
+	shared->recent.clear();
+	shared->bytes = 0;
+	shared->requestDecoded = nullptr;
+}
+
+/* Record that the image at 'index' is being shown and return the positions of the images that should be decoded around it, most important
+ * first. A step of one in either direction (wrapping around the ends like the arrow keys do) sets the direction, and anything else is a jump */
+std::vector<int> ImagePrefetcher::Navigate(int index, int count)
+{
+	if (previousIndex >= 0 && count > 1 && index == (previousIndex + 1) % count)
+		direction = 1;
+	else if (previousIndex >= 0 && count > 1 && index == (previousIndex - 1 + count) % count)
+		direction = -1;
+	else
+		direction = 0;
+	previousIndex = index;
+
+	int ahead = (direction == 0) ? WINDOW_SIZE / 2 : WINDOW_SIZE - 1;
+	int behind = WINDOW_SIZE - ahead;
+	int forward = (direction < 0) ? -1 : 1;
+
+	// Take the nearest images first, and at each distance the one in the direction of travel first
+	std::vector<int> indices;
+	for (int distance = 1; count > 0 && distance <= std::max(ahead, behind); distance++)
+	{
+		for (int side : { forward, -forward })
+		{
+			if (distance > ((side == forward) ? ahead : behind))
+				continue;
+
+			int candidate = ((index + side * distance) % count + count) % count;
+			if (candidate != index && std::find(indices.begin(), indices.end(), candidate) == indices.end())
+				indices.push_back(candidate);
+		}
+	}
+
+	return indices;
+}
+
+/* Queue the requested images (in order of importance) to be decoded if they aren't already. Images that were waiting to be decoded but
+ * are no longer wanted are dropped, while decoded images stay in the cache until they're evicted. One task is handed to the thread pool
+ * per new image, and each task decodes whichever waiting image is the most important when it runs. */
+void ImagePrefetcher::Prefetch(const Request &current, const std::vector<Request> &requests)
+{
+	std::vector<std::shared_ptr<Entry>> newEntries;
+	{
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		std::unordered_set<std::string> wanted;
+		wanted.insert(current.path);
+		for (const auto &request : requests)
+			wanted.insert(request.path);
+
+		for (auto iterator = shared->entries.begin(); iterator != shared->entries.end();)
+		{
+			auto next = std::next(iterator);
+			if (iterator->second->state == State::QUEUED && wanted.count(iterator->first) == 0)
+				Remove(iterator);
+			iterator = next;
+		}
+
+		// The image that's been requested for display stays first in line
+		shared->queue.clear();
+		auto requested = shared->entries.find(shared->requestedPath);
+		if (shared->requestDecoded && requested != shared->entries.end() && requested->second->state == State::QUEUED)
+			shared->queue.push_back(requested->second);
+
+		for (const auto &request : requests)
+		{
+			// A file that has changed since it was decoded, or that was decoded too small for the display area, has to be decoded again
+			std::shared_ptr<Entry> entry;
+			auto iterator = shared->entries.find(request.path);
+			if (iterator != shared->entries.end() && IsCurrent(*iterator->second, request.modifiedTime))
+				entry = iterator->second;
+			else
+			{
+				if (iterator != shared->entries.end())
+					Remove(iterator);
+				entry = AddEntry(request);
+				newEntries.push_back(entry);
+			}
+
+			if (entry->state == State::QUEUED && std::find(shared->queue.begin(), shared->queue.end(), entry) == shared->queue.end())
+				shared->queue.push_back(entry);
+		}
+
+		Trim();
+	}
+
+	/* Hand out the mapping of the new files before their decodes, which starts reading them from disk in the background while the workers are
+	 * still busy with the images ahead of them. Opening and mapping a file can wait on the disk, so it's done on the pool rather than here. A
+	 * worker that gets to an entry before its file is attached just maps the file itself. Videos aren't mapped, since only their small poster
+	 * frames are read */
+	std::shared_ptr<Shared> tasksShared = shared;
+	for (const auto &entry : newEntries)
+	{
+		if (!entry->video)
+			ThreadPool::Get().Submit([tasksShared, entry]() { MapFile(*tasksShared, entry); });
+	}
+	for (std::size_t i = 0; i < newEntries.size(); i++)
+		ThreadPool::Get().Submit([tasksShared]() { DecodeNext(tasksShared); });
+}
+
+/* Ask for an image to show. If it has already been decoded (or failed to decode) this returns true with the image, which is invalid if the file
+ * couldn't be decoded. Otherwise the image is put first in line to be decoded and this returns false right away, and 'decoded' is called
+ * from the decoding thread once it's ready, at which point asking again returns it. Only the latest request is answered, so asking for a
+ * different image before the first is ready means 'decoded' is never called for the first. */
+bool ImagePrefetcher::RequestImage(const Request &request, wxImage &image, std::function<void()> decoded)
+{
+	const std::string &path = request.path;
+	int newEntries = 0;
+	{
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		std::shared_ptr<Entry> entry;
+		auto iterator = shared->entries.find(path);
+		if (iterator != shared->entries.end() && IsCurrent(*iterator->second, request.modifiedTime))
+			entry = iterator->second;
+		else
+		{
+			if (iterator != shared->entries.end())
+				Remove(iterator);
+			entry = AddEntry(request);
+			newEntries++;
+		}
+
+		if (entry->state == State::READY || entry->state == State::FAILED)
+		{
+			shared->statistics.hits++;
+			shared->requestedPath.clear();
+			shared->requestDecoded = nullptr;
+			shared->recent.splice(shared->recent.begin(), shared->recent, entry->position);
+			Trim();
+			image = entry->image;
+			return true;
+		}
+
+		if (entry->state == State::QUEUED)
+		{
+			// Nothing has started on it yet, so move it ahead of the images that are only being prefetched
+			shared->statistics.misses++;
+			shared->queue.erase(std::remove(shared->queue.begin(), shared->queue.end(), entry), shared->queue.end());
+			shared->queue.push_front(entry);
+		}
+		else
+			shared->statistics.waits++;
+
+		shared->requestedPath = path;
+		shared->requestDecoded = decoded;
+	}
+
+	std::shared_ptr<Shared> tasksShared = shared;
+	for (int i = 0; i < newEntries; i++)
+		ThreadPool::Get().Submit([tasksShared]() { DecodeNext(tasksShared); });
+	return false;
+}
+
+/* Set the size in pixels of the area images are shown in, or an empty size to decode them at full resolution. Images that were decoded at
+ * least this large are still used, while the others are decoded again the next time they're asked for. Returns true if the size has grown
+ * past what the cached images were decoded for, in which case the image on screen should be asked for again to get a sharper copy. */
+bool ImagePrefetcher::SetTargetSize(const wxSize &size)
+{
+	// Round up so that dragging the edge of the window doesn't decode the image again on every step
+	wxSize roundedSize;
+	if (size.GetWidth() > 0 && size.GetHeight() > 0)
+	{
+		roundedSize.SetWidth((size.GetWidth() + TARGET_STEP - 1) / TARGET_STEP * TARGET_STEP);
+		roundedSize.SetHeight((size.GetHeight() + TARGET_STEP - 1) / TARGET_STEP * TARGET_STEP);
+	}
+
+	bool sharper = !Covers(targetSize, roundedSize);
+	targetSize = roundedSize;
+	return sharper;
+}
+
+// Change how many bytes of decoded images may be kept, releasing the least recently used ones right away if the cache is now over budget
+void ImagePrefetcher::SetBudget(std::size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(shared->mutex);
+	budget = bytes;
+	Trim();
+}
+
+ImageCacheStatistics ImagePrefetcher::GetStatistics()
+{
+	std::lock_guard<std::mutex> lock(shared->mutex);
+	ImageCacheStatistics statistics = shared->statistics;
+	statistics.images = shared->recent.size();
+	statistics.bytes = shared->bytes;
+	statistics.budget = budget;
+	return statistics;
+}
+
+//********************
+// Private functions *
+//********************
+
+// Decode the most important image that's still waiting, if there is one
+void ImagePrefetcher::DecodeNext(std::shared_ptr<Shared> shared)
+{
+	std::shared_ptr<Entry> entry;
+	{
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		if (shared->queue.empty())
+			return;
+
+		entry = shared->queue.front();
+		shared->queue.pop_front();
+		entry->state = State::DECODING;
+	}
+
+	Decode(*shared, std::move(entry));
+}
+
+// Map the file of an entry that's waiting to be decoded, unless its decode has already started or it has been dropped
+void ImagePrefetcher::MapFile(Shared &shared, std::shared_ptr<Entry> entry)
+{
+	{
+		std::lock_guard<std::mutex> lock(shared.mutex);
+		if (entry->state != State::QUEUED || entry->removed)
+			return;
+	}
+
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+	if (!file->Open(entry->path))
+		return;
+
+	std::lock_guard<std::mutex> lock(shared.mutex);
+	if (entry->state == State::QUEUED && !entry->removed)
+		entry->file = std::move(file);
+}
+
+/* Decode an entry that has been marked as DECODING and publish the result, telling the GUI if it's the image it asked for. The new image counts
+ * as the most recently used one, but it's only evicted later from the GUI thread (see Trim()) */
+void ImagePrefetcher::Decode(Shared &shared, std::shared_ptr<Entry> entry)
+{
+	/* Images are read from the file that was mapped when they were queued (or are mapped now if they weren't). Videos are shown as their poster
+	 * frame until they're opened, which is a small image that's read into memory */
+	Trace::Span span(entry->video ? "DecodePoster" : "DecodeImage");
+	span.SetDetail(entry->path);
+	std::shared_ptr<MappedFile> file;
+	{
+		std::lock_guard<std::mutex> lock(shared.mutex);
+		file = std::move(entry->file);
+	}
+	std::vector<unsigned char> poster;
+	const unsigned char *data = nullptr;
+	std::size_t size = 0;
+	if (entry->video)
+	{
+		if (MovieReader::ReadPoster(entry->path, poster))
+		{
+			data = poster.data();
+			size = poster.size();
+		}
+	}
+	else
+	{
+		if (file == nullptr)
+		{
+			file = std::make_shared<MappedFile>();
+			file->Open(entry->path);
+		}
+		data = file->GetData();
+		size = file->GetSize();
+	}
+
+	// Cameras store photos the way the sensor was held and record which way is up, so a photo taken on its side is decoded with its sides swapped
+	int orientation = entry->video ? 1 : ExifReader::ReadOrientation(data, size);
+	wxSize targetSize = entry->targetSize;
+	if (ImageKernels::SwapsSides(orientation))
+		targetSize = wxSize(targetSize.GetHeight(), targetSize.GetWidth());
+
+	// Failures are reported when the image is shown, so don't let wxWidgets pop up its own message from a worker thread
+	wxImage image;
+	bool loaded = false;
+	{
+		// Let the JPEG handler scale the image down while decoding, as far as it can while staying at least the target size
+		wxLogNull noLog;
+		ImageOps::LimitDecodeSize(image, targetSize);
+
+		// The decoder reads the mapped file directly, which leaves the kernel's page cache as the only copy of the file's contents
+		if (data != nullptr)
+		{
+			wxMemoryInputStream stream(data, size);
+			loaded = image.LoadFile(stream);
+		}
+	}
+
+	// The decoder only scales by powers of two, so finish the job by fitting the image to the target, and then turn it upright
+	if (loaded)
+	{
+		image = ImageOps::Orient(ImageOps::Fit(image, targetSize), orientation);
+		Trace::Count(Trace::Counter::IMAGES_DECODED);
+	}
+
+	/* wxImage shares its data with a reference count that isn't thread-safe, so the decoding thread lets go of both the image and the entry
+	 * while the lock is held. After that the image is only copied and released on the GUI thread */
+	std::lock_guard<std::mutex> lock(shared.mutex);
+	entry->image = image;
+	image.Destroy();
+	entry->state = loaded ? State::READY : State::FAILED;
+	if (!entry->removed)
+	{
+		entry->bytes = loaded ? (std::size_t) entry->image.GetWidth() * entry->image.GetHeight() * (entry->image.HasAlpha() ? 4 : 3) : 0;
+		shared.bytes += entry->bytes;
+		shared.recent.push_front(entry->path);
+		entry->position = shared.recent.begin();
+
+		// Let the GUI know if this is the image it's waiting for
+		if (shared.requestDecoded && entry->path == shared.requestedPath)
+		{
+			std::function<void()> decoded = std::move(shared.requestDecoded);
+			shared.requestDecoded = nullptr;
+			shared.requestedPath.clear();
+			decoded();
+		}
+	}
+	entry.reset();
+}
+
+// Add an entry to be decoded at the current target size (the caller must hold the lock and have removed any entry already there for the path)
+std::shared_ptr<ImagePrefetcher::Entry> ImagePrefetcher::AddEntry(const Request &request)
+{
+	std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+	entry->path = request.path;
+	entry->modifiedTime = request.modifiedTime;
+	entry->video = request.video;
+	entry->targetSize = targetSize;
+	shared->entries.emplace(request.path, entry);
+	return entry;
+}
+
+// Whether an entry can be used for the given version of its file at the current target size
+bool ImagePrefetcher::IsCurrent(const Entry &entry, time_t modifiedTime) const
+{
+	return entry.modifiedTime == modifiedTime && Covers(entry.targetSize, targetSize);
+}
+
+// Whether an image decoded to fit one size is at least as sharp as one decoded to fit another (an empty size being full resolution)
+bool ImagePrefetcher::Covers(const wxSize &decodedSize, const wxSize &targetSize)
+{
+	if (decodedSize.GetWidth() <= 0)
+		return true;
+	return targetSize.GetWidth() > 0 && decodedSize.GetWidth() >= targetSize.GetWidth() && decodedSize.GetHeight() >= targetSize.GetHeight();
+}
+
+// Take an entry out of the cache (the caller must hold the lock)
+void ImagePrefetcher::Remove(std::unordered_map<std::string, std::shared_ptr<Entry>>::iterator iterator)
+{
+	Entry &entry = *iterator->second;
+	if (entry.state == State::READY || entry.state == State::FAILED)
+	{
+		shared->recent.erase(entry.position);
+		shared->bytes -= entry.bytes;
+	}
+	else if (entry.state == State::QUEUED)
+		shared->queue.erase(std::remove(shared->queue.begin(), shared->queue.end(), iterator->second), shared->queue.end());
+
+	entry.removed = true;
+	shared->entries.erase(iterator);
+}
+
+/* Evict the least recently used images until the cache fits in its budget, always keeping the most recent one since it's the one on screen
+ * (the caller must hold the lock). This only runs on the GUI thread, since that's the only thread that's allowed to release decoded images */
+void ImagePrefetcher::Trim()
+{
+	while (shared->bytes > budget && shared->recent.size() > 1)
+	{
+		Remove(shared->entries.find(shared->recent.back()));
+		shared->statistics.evictions++;
+	}
+}
@@ -0,0 +1,111 @@
+// Marcus Schmidt
+// Created on 8/19/23
+
+#ifndef IMAGE_PREFETCHER
+#define IMAGE_PREFETCHER
+
+#include "MappedFile.h"
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <wx/image.h>
+
+// How well the decoded image cache is doing, for reporting to the user
+struct ImageCacheStatistics
+{
+	uint64_t hits = 0; // the image was already decoded
+	uint64_t waits = 0; // the image was still being prefetched, so only the rest of its decode was waited for
+	uint64_t misses = 0; // the image hadn't started decoding when it was asked for
+	uint64_t evictions = 0;
+	std::size_t images = 0;
+	std::size_t bytes = 0;
+	std::size_t budget = 0;
+};
+
+/* Decodes the images around the one on screen on the thread pool and keeps recently decoded images in memory, so that moving to the next or
+ * previous image (or back to one seen a moment ago) only has to display an image that's already decoded. The window of prefetched images leans
+ * towards the direction the user is moving through the list: browsing forwards keeps most of the window ahead of the current image, browsing
+ * backwards keeps most of it behind, and a jump splits it evenly. Decoded images are kept until their total size goes over the budget, at which
+ * point the least recently used ones are released. Images are decoded only as large as the area they're shown in (see SetTargetSize()), which
+ * for JPEGs skips most of the decoding work as well as the memory. The image to display is asked for without blocking (see RequestImage()).
+ * Videos are handled the same way through their poster frames. Everything except the decoding itself must be called from the GUI thread. */
+class ImagePrefetcher
+{
+public:
+	/* An image to decode ahead of time. The modification time tells a changed file apart from the version that was decoded. For videos, the
+	 * image is the poster frame (see MovieReader::ReadPoster()) */
+	struct Request
+	{
+		std::string path;
+		time_t modifiedTime;
+		bool video = false;
+	};
+
+	ImagePrefetcher();
+	~ImagePrefetcher();
+
+	std::vector<int> Navigate(int index, int count);
+	void Prefetch(const Request &current, const std::vector<Request> &requests);
+	bool RequestImage(const Request &request, wxImage &image, std::function<void()> decoded);
+	bool SetTargetSize(const wxSize &size);
+	void SetBudget(std::size_t bytes);
+	ImageCacheStatistics GetStatistics();
+
+	constexpr static int WINDOW_SIZE = 4; // how many images around the current one are decoded ahead of time
+	constexpr static std::size_t DEFAULT_BUDGET = (std::size_t) 512 << 20;
+	constexpr static int TARGET_STEP = 256; // target sizes are rounded up to a multiple of this
+
+private:
+	enum class State { QUEUED, DECODING, READY, FAILED };
+
+	struct Entry
+	{
+		std::string path;
+		time_t modifiedTime;
+		bool video;
+		wxSize targetSize; // the size the image is decoded to fit, or an empty size for full resolution
+		State state = State::QUEUED;
+		bool removed = false; // set once the entry has left the cache, so that a decode finishing afterwards isn't counted
+		wxImage image;
+		std::size_t bytes = 0;
+		std::list<std::string>::iterator position; // where the entry is in 'recent' once it has been decoded
+		std::shared_ptr<MappedFile> file; // the file mapped ahead of decoding so that it's read in the background
+	};
+
+	// Everything the decoding tasks touch, which is kept alive by the tasks themselves in case the prefetcher is destroyed before they run
+	struct Shared
+	{
+		std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+		std::deque<std::shared_ptr<Entry>> queue; // the entries still waiting to be decoded, most important first
+		std::list<std::string> recent; // decoded entries from most to least recently used
+		std::size_t bytes = 0;
+		ImageCacheStatistics statistics;
+		std::string requestedPath; // the image the GUI is waiting for, if any
+		std::function<void()> requestDecoded; // called from the decoding thread once the requested image is ready
+		std::mutex mutex;
+	};
+
+	static void DecodeNext(std::shared_ptr<Shared> shared);
+	static void MapFile(Shared &shared, std::shared_ptr<Entry> entry);
+	static void Decode(Shared &shared, std::shared_ptr<Entry> entry);
+	std::shared_ptr<Entry> AddEntry(const Request &request);
+	bool IsCurrent(const Entry &entry, time_t modifiedTime) const;
+	static bool Covers(const wxSize &decodedSize, const wxSize &targetSize);
+	void Remove(std::unordered_map<std::string, std::shared_ptr<Entry>>::iterator iterator);
+	void Trim();
+
+	std::shared_ptr<Shared> shared;
+	std::size_t budget = DEFAULT_BUDGET;
+	wxSize targetSize; // full resolution until the display area is known
+	int previousIndex = -1;
+	int direction = 0;
+};
+
+#endif
@@ -4,6 +4,16 @@
 #include "ImageViewer.h"
 #include "FilterEditor.h"
 #include "StaticUtilities.h"
+#include "ScanCatalog.h"
+#include "CaptureTimeCache.h"
+#include "FingerprintCache.h"
+#include "PerceptualHashCache.h"
+#include "DirectoryReader.h"
+#include "ExifReader.h"
+#include "FileTable.h"
+#include "ThumbnailCache.h"
+#include "ImageOps.h"
+#include "Trace.h"
 #include <wx/menu.h>
 #include <wx/panel.h>
 #include <wx/stattext.h>
@@ -12,7 +22,17 @@
 #include <wx/bitmap.h>
 #include <wx/stdpaths.h>
 #include <wx/tokenzr.h>
+#include <wx/textdlg.h>
+#include <wx/filedlg.h>
+#include <wx/font.h>
+#include <wx/mstream.h>
+#include <wx/log.h>
 #include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
 #include <cctype>
 #include <iostream>
@@ -21,12 +41,37 @@ ImageViewer::ImageViewer(wxWindow *parent, wxWindowID id, const wxString &title,
 			: wxFrame(parent, id, title, wxDefaultPosition, wxSize(700, 500))
 {
 	rootPath = path;
+	windowTitle = title;
+	shuffleSeed = StaticUtilities::GetRandomSeed();
+	FileTable::Get().AddList(&files);
 
 	// Get the default Documents folder and modify it to lead to the user Application folder
 	applicationDirectory = std::string(wxStandardPaths::Get().GetDocumentsDir());
 	applicationDirectory.erase(applicationDirectory.size() - 9, 9);
 	applicationDirectory = applicationDirectory.append("Applications/Total Photo/");
 
+	// Load the record of previously scanned directories so that refreshing only re-reads the ones that have changed
+	ScanCatalog::Get().Load(applicationDirectory + "scan.catalog");
+	ThumbnailCache::Get().Load(applicationDirectory + "thumbnails.cache");
+	CaptureTimeCache::Get().Load(applicationDirectory + "capture.cache");
+	FingerprintCache::Get().Load(applicationDirectory + "fingerprints.cache");
+	PerceptualHashCache::Get().Load(applicationDirectory + "similarity.cache");
+
+	// Apply changes to the watched directories as they happen. The watcher reports from its own thread, so hand the changes to the GUI thread
+	if (DirectoryWatcher::IsSupported())
+	{
+		watcher = std::make_unique<DirectoryWatcher>([this](std::set<std::string> changedDirectories, std::set<std::string> changedTrees, bool overflowed)
+		{
+			CallAfter([this, changedDirectories, changedTrees, overflowed]() { OnDirectoriesChanged(changedDirectories, changedTrees, overflowed); });
+		});
+	}
+
+	// Images are hashed in the background when they're first compared by how they look, and the list is collected again once they all are
+	PerceptualHashCache::Get().Listen(this, [this](std::size_t remaining) { CallAfter([this, remaining]() { OnHashProgress(remaining); }); });
+
+	// The same for capture times, which are read in the background the first time images are sorted by them
+	CaptureTimeCache::Get().Listen(this, [this](std::size_t remaining) { CallAfter([this, remaining]() { OnCaptureTimeProgress(remaining); }); });
+
 	//**************
 	// Create menu *
 	//**************
@@ -35,12 +80,21 @@ ImageViewer::ImageViewer(wxWindow *parent, wxWindowID id, const wxString &title,
 	wxMenu *sortMenu = new wxMenu();
 	sortMenu->Append(static_cast<int>(SortMethod::NAME), "Name", wxEmptyString, wxITEM_RADIO);
 	sortMenu->Append(static_cast<int>(SortMethod::DATE), "Date Modified", wxEmptyString, wxITEM_RADIO);
+	sortMenu->Append(static_cast<int>(SortMethod::CAPTURE_DATE), "Date Taken", wxEmptyString, wxITEM_RADIO);
 	sortMenu->Append(static_cast<int>(SortMethod::RANDOM), "Random", wxEmptyString, wxITEM_RADIO);
+	sortMenu->AppendSeparator();
+	sortMenu->Append(static_cast<int>(MenuId::RESHUFFLE), "Reshuffle");
+	sortMenu->Append(static_cast<int>(MenuId::SHUFFLE_SEED), "Shuffle Seed...");
 
 	wxMenu *controlsMenu = new wxMenu();
 	controlsMenu->Append(wxID_NEW, "Open Another Viewer");
 	controlsMenu->Append(wxID_REFRESH, "Refresh Viewer");
+	controlsMenu->Append(wxID_CLEAR, "Rebuild Scan Catalog");
+	controlsMenu->Append(static_cast<int>(MenuId::CACHE_BUDGET), "Image Cache Size...");
 	controlsMenu->Append(wxID_FIRST, "Jump to First Image");
+	controlsMenu->AppendSeparator();
+	traceItem = controlsMenu->Append(static_cast<int>(MenuId::RECORD_TRACE), "Record Trace", wxEmptyString, wxITEM_CHECK);
+	controlsMenu->Append(static_cast<int>(MenuId::EXPORT_TRACE), "Export Trace...");
 
 	wxMenu *viewMenu = new wxMenu();
 	wxMenuItem *nameItem = new wxMenuItem(viewMenu, wxID_PRINT, "Image Name", wxEmptyString, wxITEM_CHECK);
@@ -52,6 +106,10 @@ ImageViewer::ImageViewer(wxWindow *parent, wxWindowID id, const wxString &title,
 	wxMenuItem *backgroundItem = new wxMenuItem(viewMenu, wxID_SELECT_COLOR, "Dark Background", wxEmptyString, wxITEM_CHECK);
 	//backgroundItem->Check();
 	viewMenu->Append(backgroundItem);
+	viewMenu->Append(wxID_ZOOM_100, "Actual Pixels", wxEmptyString, wxITEM_CHECK);
+	thumbnailsItem = viewMenu->Append(wxID_VIEW_LARGEICONS, "Thumbnails", wxEmptyString, wxITEM_CHECK);
+	viewMenu->Append(static_cast<int>(MenuId::STATISTICS_OVERLAY), "Performance Statistics", wxEmptyString, wxITEM_CHECK);
+	viewMenu->Append(static_cast<int>(MenuId::HIDE_NEAR_DUPLICATES), "Hide Near-Duplicates", wxEmptyString, wxITEM_CHECK);
 
 	// Top-level menu with sorting options and to open new viewer
 	wxMenu *viewerMenu = new wxMenu();
@@ -99,13 +157,8 @@ ImageViewer::ImageViewer(wxWindow *parent, wxWindowID id, const wxString &title,
 	// Create the file types sub-panel *
 	//**********************************
 
-	// This should be reworked to be more customizable and programatic
-	FileType types[5];
-	types[0] = { { ".png", true }, MediaType::IMAGE };
-	types[1] = { { ".jpg", true }, MediaType::IMAGE };
-	types[2] = { { ".jpeg", true }, MediaType::IMAGE };
-	types[3] = { { ".mp4", true }, MediaType::VIDEO };
-	types[4] = { { ".mov", true }, MediaType::VIDEO };
+	// The file types come from a config file in the application directory, which is created with the defaults the first time
+	fileTypes.Load(applicationDirectory + "filetypes.conf");
 
 	wxPanel *typesPanel = new wxPanel(controlPanel, wxID_ANY, wxDefaultPosition, wxDefaultSize,
 									  wxTAB_TRAVERSAL | wxBORDER_SIMPLE);
@@ -115,11 +168,10 @@ ImageViewer::ImageViewer(wxWindow *parent, wxWindowID id, const wxString &title,
 	typesSizer->Add(new wxStaticText(typesPanel, wxID_ANY, "File Types:"), wxSizerFlags().Border(wxALL, 5));
 
 	// Add a checkbox for each file type
-	for (const auto &entry : types)
+	for (std::size_t i = 0; i < fileTypes.GetTypes().size(); i++)
 	{
-		fileTypes.push_back(entry);
-
-		int id = GetId(ImageViewer::ListType::FILE_TYPES, (int) fileTypes.size() - 1);
+		const FileType &entry = fileTypes.GetTypes()[i];
+		int id = GetId(ImageViewer::ListType::FILE_TYPES, (int) i);
 		wxCheckBox *checkbox = new wxCheckBox(typesPanel, id, entry.name);
 		if (entry.active)
 			checkbox->SetValue(true);
@@ -141,13 +193,36 @@ ImageViewer::ImageViewer(wxWindow *parent, wxWindowID id, const wxString &title,
 	imageBitmap = new wxStaticBitmap(imagePanel, wxID_ANY, wxBitmap(1,1));
 	imageBitmap->SetScaleMode(wxStaticBitmap::Scale_AspectFit);
 	imageSizer->Add(imageBitmap, wxSizerFlags(1).Expand());
-	mediaCtrl = new wxMediaCtrl(imagePanel, wxID_ANY);
-	mediaCtrl->ShowPlayerControls();
-	mediaCtrl->Hide();
-	imageSizer->Add(mediaCtrl, wxSizerFlags(1).Expand());
+	for (MediaPlayer *media : { &player, &preroll })
+	{
+		media->control = new wxMediaCtrl(imagePanel, wxID_ANY);
+		media->control->ShowPlayerControls();
+		media->control->Hide();
+		media->control->Bind(wxEVT_MEDIA_LOADED, &ImageViewer::OnMediaLoaded, this);
+		imageSizer->Add(media->control, wxSizerFlags(1).Expand());
+	}
+	thumbnailGrid = new ThumbnailGrid(imagePanel, files, [this](int index, bool open) { OnThumbnailSelected(index, open); });
+	thumbnailGrid->Hide();
+	imageSizer->Add(thumbnailGrid, wxSizerFlags(1).Expand());
 	imageSizer->SetMinSize(700, 500);
 	imagePanel->SetSizer(imageSizer);
 
+	// The statistics overlay isn't part of the sizer so that it sits on top of whatever the panel is showing
+	statisticsOverlay = new wxStaticText(imagePanel, wxID_ANY, "", wxPoint(10, 10));
+	statisticsOverlay->SetFont(wxFontInfo(11).Family(wxFONTFAMILY_TELETYPE));
+	statisticsOverlay->SetForegroundColour(*wxWHITE);
+	statisticsOverlay->SetBackgroundColour(*wxBLACK);
+	statisticsOverlay->Hide();
+	statisticsTimer.SetOwner(this);
+	Bind(wxEVT_TIMER, &ImageViewer::OnStatisticsTimer, this, statisticsTimer.GetId());
+
+	// Images are decoded to fit the panel, so the decoder needs to know whenever its size changes
+	imagePanel->Bind(wxEVT_SIZE, &ImageViewer::OnImageResized, this);
+
+	// Videos are only opened once the user stays on a file for a moment (see OnMediaTimer())
+	mediaTimer.SetOwner(this);
+	Bind(wxEVT_TIMER, &ImageViewer::OnMediaTimer, this, mediaTimer.GetId());
+
 	//**************************
 	// Configure entire window *
 	//**************************
@@ -169,6 +244,16 @@ ImageViewer::ImageViewer(wxWindow *parent, wxWindowID id, const wxString &title,
 	splitter->SetSashPosition(defaultPanelWidth);
 }
 
+ImageViewer::~ImageViewer()
+{
+	// Stop the watcher thread before anything it could report to is destroyed
+	watcher.reset();
+	PerceptualHashCache::Get().Cancel(this);
+	CaptureTimeCache::Get().Cancel(this);
+	ThumbnailCache::Get().Save();
+	FileTable::Get().RemoveList(&files);
+}
+
 void ImageViewer::OnRefresh(wxCommandEvent &event)
 {
 	GetImages();
@@ -177,11 +262,32 @@ void ImageViewer::OnRefresh(wxCommandEvent &event)
 	splitter->SetFocusIgnoringChildren();
 }
 
+void ImageViewer::OnRebuildCatalog(wxCommandEvent &event)
+{
+	// Throw away everything that has been recorded and rescan every directory from scratch
+	ScanCatalog::Get().Clear();
+	CaptureTimeCache::Get().Clear();
+	FingerprintCache::Get().Clear();
+	PerceptualHashCache::Get().Clear();
+	Filter::ClearCache();
+	GetImages();
+
+	splitter->SetFocusIgnoringChildren();
+}
+
 void ImageViewer::OnToggleName(wxCommandEvent &event)
 {
 	showImageName = !showImageName;
 }
 
+void ImageViewer::OnToggleNearDuplicates(wxCommandEvent &event)
+{
+	hideNearDuplicates = !hideNearDuplicates;
+	GetImages();
+
+	splitter->SetFocusIgnoringChildren();
+}
+
 void ImageViewer::OnFirstFile(wxCommandEvent &event)
 {
 	imageIndex = 0;
@@ -207,6 +313,19 @@ void ImageViewer::OnToggleBackground(wxCommandEvent &event)
 		this->SetBackgroundColour(BACKGROUND_LIGHT);
 }
 
+void ImageViewer::OnToggleActualSize(wxCommandEvent &event)
+{
+	// Show the image pixel for pixel (cropped to the panel) instead of fitting it, which needs it decoded at full resolution
+	actualSize = !actualSize;
+	imageBitmap->SetScaleMode(actualSize ? wxStaticBitmap::Scale_None : wxStaticBitmap::Scale_AspectFit);
+	UpdateImageSize(true);
+}
+
+void ImageViewer::OnToggleThumbnails(wxCommandEvent &event)
+{
+	ShowThumbnails(!thumbnailGrid->IsShown());
+}
+
 void ImageViewer::OnSortChanged(wxCommandEvent &event)
 {
 	// Update the sorting method and recollect the images
@@ -217,6 +336,99 @@ void ImageViewer::OnSortChanged(wxCommandEvent &event)
 	splitter->SetFocusIgnoringChildren();
 }
 
+void ImageViewer::OnReshuffle(wxCommandEvent &event)
+{
+	SetShuffleSeed(StaticUtilities::GetRandomSeed());
+}
+
+void ImageViewer::OnShuffleSeed(wxCommandEvent &event)
+{
+	// Show the current seed so that it can be noted down, and accept a different one to reproduce an earlier order
+	wxTextEntryDialog dialog(this, "Seed for the random order:", "Shuffle Seed", std::to_string(shuffleSeed));
+	if (dialog.ShowModal() == wxID_OK)
+	{
+		unsigned long long seed;
+		if (dialog.GetValue().ToULongLong(&seed))
+			SetShuffleSeed(seed);
+		else
+			std::cout << "OnShuffleSeed(): \"" << dialog.GetValue() << "\" is not a valid seed" << std::endl;
+	}
+
+	splitter->SetFocusIgnoringChildren();
+}
+
+void ImageViewer::OnCacheBudget(wxCommandEvent &event)
+{
+	// Show how the cache has been doing so that the size can be judged, and accept a new size in megabytes
+	ImageCacheStatistics statistics = prefetcher.GetStatistics();
+	std::string message = "Memory for decoded images in MB (" + std::to_string(statistics.images) + " images using "
+		+ std::to_string(statistics.bytes >> 20) + " MB; " + std::to_string(statistics.hits) + " hits, " + std::to_string(statistics.waits)
+		+ " prefetch waits, " + std::to_string(statistics.misses) + " misses, " + std::to_string(statistics.evictions) + " evictions):";
+	wxTextEntryDialog dialog(this, message, "Image Cache Size", std::to_string(statistics.budget >> 20));
+	if (dialog.ShowModal() == wxID_OK)
+	{
+		unsigned long long megabytes;
+		if (dialog.GetValue().ToULongLong(&megabytes))
+		{
+			prefetcher.SetBudget((std::size_t) megabytes << 20);
+			std::cout << "OnCacheBudget(): Decoded image cache is now " << megabytes << " MB" << std::endl;
+		}
+		else
+			std::cout << "OnCacheBudget(): \"" << dialog.GetValue() << "\" is not a valid size" << std::endl;
+	}
+
+	splitter->SetFocusIgnoringChildren();
+}
+
+void ImageViewer::OnRecordTrace(wxCommandEvent &event)
+{
+	// Each recording starts over, so a trace exported afterwards only covers what happened while it was on
+	if (Trace::IsEnabled())
+		Trace::Stop();
+	else
+		Trace::Start();
+	traceItem->Check(Trace::IsEnabled());
+}
+
+void ImageViewer::OnExportTrace(wxCommandEvent &event)
+{
+	// Export what has been recorded so far, which can be done while recording carries on
+	wxFileDialog dialog(this, "Export Trace", applicationDirectory, "trace.json", "Trace files (*.json)|*.json", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+	if (dialog.ShowModal() == wxID_OK)
+	{
+		std::string path = dialog.GetPath().utf8_string();
+		if (Trace::Export(path))
+			std::cout << "OnExportTrace(): Wrote the trace to \"" << path << "\"" << std::endl;
+		else
+			std::cout << "OnExportTrace(): Unable to write \"" << path << "\"" << std::endl;
+	}
+
+	splitter->SetFocusIgnoringChildren();
+}
+
+void ImageViewer::OnToggleStatistics(wxCommandEvent &event)
+{
+	if (statisticsOverlay->IsShown())
+	{
+		statisticsTimer.Stop();
+		statisticsOverlay->Hide();
+		return;
+	}
+
+	// The overlay shows what's being recorded, so there's nothing to show without a recording
+	if (!Trace::IsEnabled())
+	{
+		Trace::Start();
+		traceItem->Check(true);
+	}
+
+	statisticsOverlay->Show();
+	statisticsOverlay->Raise();
+	wxTimerEvent timerEvent;
+	OnStatisticsTimer(timerEvent);
+	statisticsTimer.Start(STATISTICS_INTERVAL);
+}
+
 void ImageViewer::OnDirectoryToggled(wxCommandEvent &event)
 {
 	// Find the directory
@@ -288,7 +500,7 @@ void ImageViewer::OnDirectoryOverflow(wxCommandEvent &event)
 void ImageViewer::OnFileTypeToggled(wxCommandEvent &event)
 {
 	int index = GetIndex(ImageViewer::ListType::FILE_TYPES, event.GetId());
-	fileTypes[index].active = !fileTypes[index].active;
+	fileTypes.SetActive(index, !fileTypes.GetTypes()[index].active);
 }
 
 void ImageViewer::OnKeyPress(wxKeyEvent &event)
@@ -301,7 +513,7 @@ void ImageViewer::OnKeyPress(wxKeyEvent &event)
 		if (keyCode == WXK_RIGHT)
 		{
 			imageIndex++;
-			if (imageIndex >= files.size())
+			if (imageIndex >= (int) files.size())
 				imageIndex = 0;
 
 			LoadFile(imageIndex);
@@ -314,6 +526,8 @@ void ImageViewer::OnKeyPress(wxKeyEvent &event)
 
 			LoadFile(imageIndex);
 		}
+		else if (keyCode == WXK_RETURN && thumbnailGrid->IsShown())
+			ShowThumbnails(false);
 		else
 			std::cout << "OnKeyPress(): Key code not recognized" << std::endl;
 	}
@@ -321,6 +535,135 @@ void ImageViewer::OnKeyPress(wxKeyEvent &event)
 		std::cout << "OnKeyPress(): No files" << std::endl;
 }
 
+// Clicking a thumbnail makes its file the current one, and double-clicking it also goes back to showing that file on its own
+void ImageViewer::OnThumbnailSelected(int index, bool open)
+{
+	imageIndex = index;
+	if (open)
+		ShowThumbnails(false);
+
+	splitter->SetFocusIgnoringChildren();
+}
+
+// An image asked for by LoadFile() has been decoded, which only matters if no other file has been loaded since
+void ImageViewer::OnImageDecoded(uint64_t generation)
+{
+	if (generation != loadGeneration || imageIndex >= (int) files.size() || thumbnailGrid->IsShown())
+		return;
+
+	// A video's poster frame isn't needed once the video itself is on screen, and a video without one keeps the blank screen it has
+	std::string path = FileTable::Get().GetPath(files[imageIndex]);
+	bool video = FileTable::Get().GetType(files[imageIndex]) == MediaType::VIDEO;
+	if (video && player.path == path && player.control->IsShown())
+		return;
+
+	wxImage image;
+	if (prefetcher.RequestImage({ path, files[imageIndex].modifiedTime, video }, image, [this, generation]() { CallAfter([this, generation]() { OnImageDecoded(generation); }); })
+		&& (!video || image.IsOk()))
+		ShowImage(image, path);
+}
+
+void ImageViewer::OnImageResized(wxSizeEvent &event)
+{
+	event.Skip();
+	UpdateImageSize(false);
+}
+
+// A player has finished opening its video, which starts playing straight away if it's the one for the file on screen
+void ImageViewer::OnMediaLoaded(wxMediaEvent &event)
+{
+	MediaPlayer &media = event.GetEventObject() == player.control ? player : preroll;
+	media.loaded = true;
+	if (&media == &player && imageIndex < (int) files.size() && !thumbnailGrid->IsShown() && FileTable::Get().GetPath(files[imageIndex]) == player.path)
+		ShowVideo();
+}
+
+/* The user has stayed on the current file for a moment, so open it if it's a video, and open the video they're most likely to move to next in
+ * the hidden player so that it can be shown as soon as they get to it. Opening a video can block the GUI thread on some media backends, so
+ * only one is opened per tick: after opening the current video, the timer is started again for the next one, and moving to another file in
+ * the meantime restarts it for that file instead */
+void ImageViewer::OnMediaTimer(wxTimerEvent &event)
+{
+	if (imageIndex >= (int) files.size() || thumbnailGrid->IsShown())
+		return;
+
+	const FileTable &table = FileTable::Get();
+	std::string path = table.GetPath(files[imageIndex]);
+	if (table.GetType(files[imageIndex]) == MediaType::VIDEO && player.path != path)
+	{
+		OpenVideo(player, path);
+		if (!nextVideo.empty() && nextVideo != player.path && nextVideo != preroll.path)
+			mediaTimer.StartOnce(MEDIA_DELAY);
+		return;
+	}
+
+	if (!nextVideo.empty() && nextVideo != player.path && nextVideo != preroll.path)
+		OpenVideo(preroll, nextVideo);
+}
+
+// Show the counters and the spans that have taken the most time since recording started, along with how the image cache is doing
+void ImageViewer::OnStatisticsTimer(wxTimerEvent &event)
+{
+	std::string text = Trace::IsEnabled() ? "Recording\n" : "Not recording\n";
+	char line[96];
+	for (int i = 0; i < static_cast<int>(Trace::Counter::COUNT); i++)
+	{
+		Trace::Counter counter = static_cast<Trace::Counter>(i);
+		std::snprintf(line, sizeof(line), "%-22s %12llu\n", Trace::GetName(counter), (unsigned long long) Trace::GetCount(counter));
+		text += line;
+	}
+
+	std::vector<Trace::SpanTotal> totals = Trace::GetSpanTotals();
+	for (std::size_t i = 0; i < totals.size() && i < 8; i++)
+	{
+		std::snprintf(line, sizeof(line), "%-18s %8llu x %10.1f ms\n", totals[i].name, (unsigned long long) totals[i].count, totals[i].milliseconds);
+		text += line;
+	}
+
+	ImageCacheStatistics statistics = prefetcher.GetStatistics();
+	std::snprintf(line, sizeof(line), "Image cache: %llu hits, %llu waits, %llu misses", (unsigned long long) statistics.hits,
+				  (unsigned long long) statistics.waits, (unsigned long long) statistics.misses);
+	text += line;
+
+	statisticsOverlay->SetLabel(text);
+}
+
+/* Show how many images are left to hash in the title while the list depends on how images look, and collect the list again once they're all
+ * done. Only the images whose hashes were missing are decoded, so this doesn't happen again for the same images */
+void ImageViewer::OnHashProgress(std::size_t remaining)
+{
+	if (remaining > 0 && (hideNearDuplicates || similarRules))
+	{
+		SetTitle(wxString::Format("%s (comparing images, %llu left)", windowTitle, (unsigned long long) remaining));
+		return;
+	}
+
+	SetTitle(windowTitle);
+	if (remaining == 0 && (hideNearDuplicates || similarRules))
+	{
+		PerceptualHashCache::Get().Save();
+		GetImages(true);
+	}
+}
+
+/* Show how many capture times are left to read in the title while the images are sorted by them, and sort again once they're all read. Until
+ * then the images that haven't been read are sorted by their modification times */
+void ImageViewer::OnCaptureTimeProgress(std::size_t remaining)
+{
+	if (remaining > 0 && sortMethod == SortMethod::CAPTURE_DATE)
+	{
+		SetTitle(wxString::Format("%s (reading dates, %llu left)", windowTitle, (unsigned long long) remaining));
+		return;
+	}
+
+	SetTitle(windowTitle);
+	if (remaining == 0 && sortMethod == SortMethod::CAPTURE_DATE)
+	{
+		CaptureTimeCache::Get().Save();
+		GetImages(true);
+	}
+}
+
 std::vector<Directory> ImageViewer::GetSubdirectories(Directory *directory)
 {
 	// Construct a filepath to the provided directory by moving up the chain of parents to the root filepath
@@ -357,27 +700,275 @@ std::vector<Directory> ImageViewer::GetSubdirectories(Directory *directory)
 	return subdirectories;
 }
 
-void ImageViewer::GetImages()
+/* Collect every image again and show the first one, or with 'keepCurrent' keep showing the image that's on screen (see OnDirectoriesChanged())
+ * if it's still listed */
+void ImageViewer::GetImages(bool keepCurrent)
 {
+	Trace::Span span("GetImages");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	DirectoryReader::ResetStatistics();
+
+	// The current image is remembered by its path, since the file table is about to be rebuilt
+	std::string currentDirectory, currentName;
+	if (keepCurrent && imageIndex < (int) files.size())
+	{
+		currentDirectory = FileTable::Get().GetDirectory(files[imageIndex].directory);
+		currentName = FileTable::Get().GetOriginalName(files[imageIndex]);
+	}
+
+	// Every image is about to be listed again, so drop the old images' names from the file table (keeping any other viewer's)
 	files.clear();
+	FileTable::Get().Compact();
 
-	// For every directory...
+	// Collect a sorted run of images for every directory before merging them all at once
+	std::vector<std::vector<File>> runs;
+	std::vector<ScanRoot> scanRoots;
 	for (Directory directory : directories)
+		StaticUtilities::RecurseGetImages(rootPath, sortMethod, fileTypes, &directory, runs, &scanRoots);
+
+	// And then retrieve the valid images in the root directory
+	std::shared_ptr<ScanRules> rootRules = std::make_shared<ScanRules>();
+	std::vector<File> rootFiles;
+	StaticUtilities::GetDirectoryImages(rootPath.string(), fileTypes, *rootRules->filterItems, rootRules->defaultValidity, rootFiles);
+	StaticUtilities::SortFiles(rootFiles, sortMethod);
+	runs.push_back(std::move(rootFiles));
+	scanRoots.push_back({ rootPath.string(), false, rootRules });
+
+	files = StaticUtilities::MergeVectors(runs, sortMethod);
+	similarRules = false;
+	for (const auto &scanRoot : scanRoots)
+		similarRules |= !scanRoot.rules->includedSimilar.empty() || !scanRoot.rules->excludedSimilar.empty();
+
+	// Near-duplicates are hidden before shuffling, so that the random order shows the same image of each group as the name order
+	if (hideNearDuplicates)
+		StaticUtilities::HideNearDuplicates(files);
+	if (sortMethod == SortMethod::RANDOM)
+		StaticUtilities::ShuffleFiles(files, shuffleSeed);
+	thumbnailGrid->FilesChanged();
+
+	// Record any directories that had to be re-read so that the next refresh can skip them
+	ScanCatalog::Get().Save();
+	CaptureTimeCache::Get().Save();
+	FingerprintCache::Get().Save();
+	PerceptualHashCache::Get().Save();
+
+	// Watch every directory that was just scanned so that later changes can be applied without another full scan
+	if (watcher != nullptr)
 	{
-		// Recursively obtain the directory's images and merge them with the main list
-		std::vector<File> newFiles = StaticUtilities::RecurseGetImages(rootPath, sortMethod, fileTypes, &directory);
-		StaticUtilities::MergeVectors(files, newFiles, sortMethod);
+		watcher->Clear();
+		watchedDirectories.clear();
+		for (const auto &scanRoot : scanRoots)
+			WatchDirectory(scanRoot.path, scanRoot);
 	}
 
-	// And then retrieve the valid images in the root directory
-	std::unordered_map<std::string, int> filterItems;
-	for (const auto &entry : std::filesystem::directory_iterator(rootPath))
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << "GetImages(): Collected " << files.size() << " files in " << elapsed.count() << " ms" << std::endl;
+
+	// Report how many system calls the scan needed, which is what dominates a scan when the directories aren't already in memory
+	ScanStatistics statistics = DirectoryReader::GetStatistics();
+	std::cout << "GetImages(): " << statistics.GetSystemCalls() << " system calls (" << statistics.directoryStats << " directory stat, "
+		<< statistics.directoryOpens << " open, " << statistics.directoryReads << " read, " << statistics.directoryCloses << " close, "
+		<< statistics.fileStats << " file stat) for " << statistics.entries << " entries";
+	if (!files.empty())
+		std::cout << ", " << (double) statistics.GetSystemCalls() / files.size() << " per file";
+	std::cout << std::endl;
+
+	// Report what the list costs per image, counting both the entries themselves and the names and directories they refer to
+	if (!files.empty())
 	{
-		if (entry.is_regular_file() && StaticUtilities::IsActiveExtension(fileTypes, entry.path().extension().string()))
-			StaticUtilities::ProcessImage(entry, files, sortMethod, fileTypes, filterItems, true);
+		std::size_t listMemory = files.capacity() * sizeof(File);
+		std::size_t tableMemory = FileTable::Get().GetMemoryUsage();
+		std::cout << "GetImages(): " << (double) (listMemory + tableMemory) / files.size() << " bytes per file (" << listMemory << " list, "
+			<< tableMemory << " table for " << FileTable::Get().GetDirectoryCount() << " directories)" << std::endl;
+	}
+
+	const FileTable &table = FileTable::Get();
+	for (int i = 0; keepCurrent && i < (int) files.size(); i++)
+	{
+		if (table.GetOriginalName(files[i]) == currentName && table.GetDirectory(files[i].directory) == currentDirectory)
+		{
+			imageIndex = i;
+			return;
+		}
 	}
 
+	if (!keepCurrent || imageIndex >= (int) files.size())
+		imageIndex = 0;
 	if (files.size() > 0)
+		LoadFile(imageIndex);
+}
+
+/* Apply a batch of changes reported by the directory watcher directly to the list of files. Every changed directory has its images
+ * replaced with a fresh listing of just that directory, and every changed subdirectory has its whole tree replaced (or removed if
+ * it's gone). The new images are sorted on their own and merged into the list, and the current image stays on screen if it still exists. */
+void ImageViewer::OnDirectoriesChanged(std::set<std::string> changedDirectories, std::set<std::string> changedTrees, bool overflowed)
+{
+	// The watcher saw these change, so don't let the catalog trust a modification time that may not have moved on (see ScanCatalog)
+	ScanCatalog &catalog = ScanCatalog::Get();
+	for (const auto &path : changedDirectories)
+		catalog.Invalidate(path);
+	for (const auto &path : changedTrees)
+		catalog.InvalidateTree(path);
+
+	/* Which image of a group of near-duplicates is shown depends on the whole list, and the hidden ones aren't in it to bring back, so collect
+	 * the images again instead. Only the directories that changed are read again (see ScanCatalog) and the hashes are cached, so it's quick.
+	 * The same goes for changes that were lost because the watcher's queue overflowed, where any directory could have changed */
+	if (hideNearDuplicates || overflowed)
+	{
+		GetImages(true);
+		return;
+	}
+
+	FileTable &table = FileTable::Get();
+	std::string currentDirectory, currentName;
+	if (imageIndex < (int) files.size())
+	{
+		currentDirectory = table.GetDirectory(files[imageIndex].directory);
+		currentName = table.GetOriginalName(files[imageIndex]);
+	}
+
+	std::vector<File> changedFiles;
+	std::set<std::string> replacedPaths;
+	std::vector<std::string> replacedTrees;
+	for (const auto &path : changedDirectories)
+	{
+		// Skip directories inside a changed tree, since the whole tree is replaced below
+		bool inChangedTree = false;
+		for (const auto &tree : changedTrees)
+		{
+			if (path == tree || path.compare(0, tree.size() + 1, tree + "/") == 0)
+				inChangedTree = true;
+		}
+
+		auto watched = watchedDirectories.find(path);
+		if (watched != watchedDirectories.end() && !inChangedTree)
+		{
+			replacedPaths.insert(path + "/");
+			std::vector<File> directoryFiles;
+			StaticUtilities::GetDirectoryImages(path, fileTypes, *watched->second.rules->filterItems, watched->second.rules->defaultValidity, directoryFiles);
+			StaticUtilities::ApplyContentRules(directoryFiles, *watched->second.rules);
+			std::move(directoryFiles.begin(), directoryFiles.end(), std::back_inserter(changedFiles));
+		}
+	}
+
+	for (const auto &path : changedTrees)
+	{
+		// Only subdirectories inside a tree that's scanned recursively contribute images, since other directories are listed explicitly
+		auto parent = watchedDirectories.find(path.substr(0, path.rfind('/')));
+		if (parent == watchedDirectories.end() || !parent->second.recursive)
+			continue;
+
+		// Forget the old tree entirely and then rescan it if it still exists (e.g. it was created or moved in rather than removed)
+		replacedTrees.push_back(path + "/");
+		watcher->UnwatchTree(path);
+		for (auto iterator = watchedDirectories.begin(); iterator != watchedDirectories.end();)
+		{
+			if (iterator->first == path || iterator->first.compare(0, path.size() + 1, path + "/") == 0)
+				iterator = watchedDirectories.erase(iterator);
+			else
+				iterator++;
+		}
+
+		if (std::filesystem::is_directory(path))
+		{
+			ScanRoot scanRoot = parent->second;
+			std::vector<File> treeFiles = StaticUtilities::RecurseGetImages(path, sortMethod, fileTypes, *scanRoot.rules->filterItems, scanRoot.rules->defaultValidity);
+			StaticUtilities::ApplyContentRules(treeFiles, *scanRoot.rules);
+			std::move(treeFiles.begin(), treeFiles.end(), std::back_inserter(changedFiles));
+			WatchDirectory(path, scanRoot);
+		}
+	}
+
+	if (replacedPaths.empty() && replacedTrees.empty())
+		return;
+
+	// A random order is the name order shuffled with the current seed, so return to the name order to apply the changes and then shuffle again
+	if (sortMethod == SortMethod::RANDOM)
+		StaticUtilities::UnshuffleFiles(files, shuffleSeed);
+
+	// Work out which directories are being replaced once, rather than comparing the path of every image
+	std::vector<bool> replacedDirectories(table.GetDirectoryCount(), false);
+	for (uint32_t i = 0; i < replacedDirectories.size(); i++)
+	{
+		const std::string &path = table.GetDirectory(i);
+		if (replacedPaths.count(path) > 0)
+			replacedDirectories[i] = true;
+		for (const auto &tree : replacedTrees)
+		{
+			if (path.compare(0, tree.size(), tree) == 0)
+				replacedDirectories[i] = true;
+		}
+	}
+
+	// Remove every image that's about to be replaced in a single pass, which keeps the rest of the list in order
+	files.erase(std::remove_if(files.begin(), files.end(), [&replacedDirectories](const File &file)
+	{
+		return file.directory < replacedDirectories.size() && replacedDirectories[file.directory];
+	}), files.end());
+
+	std::vector<std::vector<File>> runs;
+	runs.push_back(std::move(files));
+	StaticUtilities::SortFiles(changedFiles, sortMethod);
+	runs.push_back(std::move(changedFiles));
+	files = StaticUtilities::MergeVectors(runs, sortMethod);
+	if (sortMethod == SortMethod::RANDOM)
+		StaticUtilities::ShuffleFiles(files, shuffleSeed);
+	ScanCatalog::Get().Save();
+	CaptureTimeCache::Get().Save();
+	FingerprintCache::Get().Save();
+	PerceptualHashCache::Get().Save();
+
+	// The names of removed images stay in the table until it's rebuilt, so rebuild it once they take up as much space as the lists themselves
+	if (table.GetFileCount() > 2 * table.GetListedFileCount())
+		table.Compact();
+	thumbnailGrid->FilesChanged();
+
+	// Keep showing the same image at its new position, or show whichever image has taken the old one's place if it was removed
+	for (int i = 0; i < (int) files.size(); i++)
+	{
+		if (table.GetOriginalName(files[i]) == currentName && table.GetDirectory(files[i].directory) == currentDirectory)
+		{
+			imageIndex = i;
+			return;
+		}
+	}
+
+	if (imageIndex >= (int) files.size())
+		imageIndex = 0;
+	if (files.size() > 0)
+		LoadFile(imageIndex);
+}
+
+// Watch a directory with the rules it was scanned with, along with all of its subdirectories if it was scanned recursively
+void ImageViewer::WatchDirectory(std::string path, const ScanRoot &scanRoot)
+{
+	watcher->Watch(path);
+	watchedDirectories[path] = scanRoot;
+
+	if (scanRoot.recursive)
+	{
+		std::shared_ptr<const CatalogDirectory> directory = ScanCatalog::Get().ListDirectory(path, fileTypes);
+		if (directory != nullptr)
+		{
+			for (const auto &subdirectory : directory->subdirectories)
+				WatchDirectory(path + "/" + subdirectory, scanRoot);
+		}
+	}
+}
+
+// Change the seed of the random order and reorder the current images in O(n) without rescanning them
+void ImageViewer::SetShuffleSeed(uint64_t seed)
+{
+	if (sortMethod == SortMethod::RANDOM)
+	{
+		StaticUtilities::UnshuffleFiles(files, shuffleSeed);
+		StaticUtilities::ShuffleFiles(files, seed);
+		thumbnailGrid->FilesChanged();
+	}
+	shuffleSeed = seed;
+	std::cout << "SetShuffleSeed(): Random order seed is " << shuffleSeed << std::endl;
+
+	if (sortMethod == SortMethod::RANDOM && files.size() > 0)
 	{
 		imageIndex = 0;
 		LoadFile(imageIndex);
@@ -417,55 +1008,71 @@ void ImageViewer::PrintActive(std::vector<ToggledString> vector, std::string nam
 
 void ImageViewer::PrintFile(File file)
 {
-	std::cout << "\"" << file.originalName << "\" file:" << std::endl;
-	std::cout << "-- Path: " << file.path << std::endl;
+	std::cout << "\"" << FileTable::Get().GetOriginalName(file) << "\" file:" << std::endl;
+	std::cout << "-- Path: " << FileTable::Get().GetDirectory(file.directory) << std::endl;
 	std::cout << "-- Modified: " << asctime(localtime(&file.modifiedTime)) << std::endl << std::endl;
 }
 
 void ImageViewer::LoadFile(int index)
 {
-	if (index >= files.size())
+	Trace::Span span("LoadFile");
+	if (index < 0 || index >= (int) files.size())
 	{
 		std::cout << "LoadFile(): Invalid index" << std::endl;
 		return;
 	}
 
-	std::string path = files[index].path + files[index].originalName;
-	if (files[index].type == MediaType::IMAGE)
+	// Any image still being decoded for an earlier call is no longer wanted
+	loadGeneration++;
+
+	// While the thumbnails are shown, moving to a file only selects it in the grid
+	if (thumbnailGrid->IsShown())
 	{
-		static wxImage image;
-		if (image.LoadFile(path))
-		{
-			// If the media player is visible, toggle it and the image bitmap's visibility
-			if (mediaCtrl->IsShown())
-			{
-				mediaCtrl->Hide();
-				imageBitmap->Show();
-			}
+		thumbnailGrid->SetSelection(index);
+		return;
+	}
 
-			// Update the displayed bitmap and resize it to fit the window
-			imageBitmap->SetBitmap(wxBitmap(image));
-			imageSizer->Layout();
-			image.Destroy();
-		}
-		else
-			std::cout << "LoadFile(): Failed to load image \"" << path << "\"" << std::endl;
+	const FileTable &table = FileTable::Get();
+	std::string path = table.GetPath(files[index]);
+	MediaType type = table.GetType(files[index]);
+	if (type == MediaType::IMAGE)
+	{
+		/* The image has usually been decoded already by the prefetcher, which leaves only the conversion to a bitmap. Otherwise its embedded
+		 * preview (or the previous file) stays on screen while it's decoded in the background, and it's shown when it's ready unless another
+		 * file has been loaded in the meantime, so holding down an arrow key never waits for a decode */
+		wxImage image;
+		uint64_t generation = loadGeneration;
+		if (prefetcher.RequestImage({ path, files[index].modifiedTime }, image, [this, generation]() { CallAfter([this, generation]() { OnImageDecoded(generation); }); }))
+			ShowImage(image, path);
+		else if (!ShowPreview(path) && player.control->IsShown())
+			player.control->Stop();
 	}
-	else if (files[index].type == MediaType::VIDEO)
+	else if (type == MediaType::VIDEO)
 	{
-		if (mediaCtrl->Load(path))
+		/* Opening a video can keep the media backend busy for a while, so it's never done here. A video that's already open (usually because
+		 * it was opened ahead of time in the hidden player) is shown right away, and otherwise its poster frame is shown until the user has
+		 * stayed on it long enough for it to be opened (see OnMediaTimer()) */
+		if (preroll.path == path)
 		{
-			// If the image bitmap is visible, toggle it and the media player's visibility
-			if (imageBitmap->IsShown())
-			{
-				imageBitmap->Hide();
-				mediaCtrl->Show();
-			}
-
-			mediaCtrl->Play();
+			HideVideo();
+			std::swap(player, preroll);
 		}
+
+		if (player.path == path)
+			ShowVideo();
 		else
-			std::cout << "LoadFile(): Failed to load video \"" << path << "\"" << std::endl;
+		{
+			// The previous video is taken off the screen even if there's no poster frame to show in its place
+			bool videoShown = player.control->IsShown();
+			HideVideo();
+			wxImage poster;
+			uint64_t generation = loadGeneration;
+			if (prefetcher.RequestImage({ path, files[index].modifiedTime, true }, poster, [this, generation]() { CallAfter([this, generation]() { OnImageDecoded(generation); }); })
+				&& poster.IsOk())
+				ShowImage(poster, path);
+			else if (videoShown)
+				imageBitmap->SetBitmap(wxBitmap(1, 1));
+		}
 	}
 	else
 		std::cout << "LoadFile(): Unrecognized media type for file \"" << path << "\"" << std::endl;
@@ -473,8 +1080,147 @@ void ImageViewer::LoadFile(int index)
 	// Update the name of the window with the image name if enabled
 	std::string name = "Image Viewer";
 	if (showImageName)
-		name += " - " + files[index].originalName;
+		name += " - " + std::string(table.GetOriginalName(files[index]));
 	this->SetLabel(name);
+
+	// Start decoding the images (and the poster frames of the videos) the user is likely to look at next
+	std::vector<ImagePrefetcher::Request> requests;
+	nextVideo.clear();
+	for (int neighbor : prefetcher.Navigate(index, (int) files.size()))
+	{
+		MediaType neighborType = table.GetType(files[neighbor]);
+		if (neighborType != MediaType::IMAGE && neighborType != MediaType::VIDEO)
+			continue;
+
+		requests.push_back({ table.GetPath(files[neighbor]), files[neighbor].modifiedTime, neighborType == MediaType::VIDEO });
+		if (neighborType == MediaType::VIDEO && nextVideo.empty())
+			nextVideo = requests.back().path;
+	}
+	prefetcher.Prefetch({ path, files[index].modifiedTime, type == MediaType::VIDEO }, requests);
+
+	// Restarting the timer on every file means nothing is opened while the user is still moving
+	mediaTimer.StartOnce(MEDIA_DELAY);
+}
+
+/* Tell the decoder how large images are shown (in physical pixels, to stay sharp on high-DPI screens), and show the current image again if
+ * the size changed (so that it's fit to the new size) or if 'reload' is set */
+void ImageViewer::UpdateImageSize(bool reload)
+{
+	wxSize size;
+	if (!actualSize)
+	{
+		double scale = imagePanel->GetContentScaleFactor();
+		size = wxSize((int) std::ceil(imagePanel->GetClientSize().GetWidth() * scale), (int) std::ceil(imagePanel->GetClientSize().GetHeight() * scale));
+	}
+
+	if (size != displaySize)
+		reload = true;
+	displaySize = size;
+	prefetcher.SetTargetSize(size);
+	if (reload && imageIndex < (int) files.size() && FileTable::Get().GetType(files[imageIndex]) == MediaType::IMAGE)
+		LoadFile(imageIndex);
+}
+
+// Switch between the grid of thumbnails and the current file on its own
+void ImageViewer::ShowThumbnails(bool show)
+{
+	thumbnailsItem->Check(show);
+	if (show)
+	{
+		HideVideo();
+		imageBitmap->Hide();
+		thumbnailGrid->Show();
+		imageSizer->Layout();
+		thumbnailGrid->SetSelection(imageIndex);
+	}
+	else
+	{
+		// LoadFile() picks whichever of the bitmap and the media player the file needs
+		thumbnailGrid->Hide();
+		imageBitmap->Show();
+		imageSizer->Layout();
+		if (imageIndex < (int) files.size())
+			LoadFile(imageIndex);
+	}
+
+	// The arrow keys keep moving through the files (and Return opens the selected one) while the grid is shown
+	splitter->SetFocusIgnoringChildren();
+}
+
+// Put a decoded image on screen in place of whatever was shown before
+void ImageViewer::ShowImage(const wxImage &image, const std::string &path)
+{
+	if (image.IsOk())
+	{
+		HideVideo();
+
+		/* Decoded images are only fit to the nearest step above the panel's size (see ImagePrefetcher::SetTargetSize()), so fit them the rest of
+		 * the way here. That leaves nothing for the bitmap control's own scaling to do, except for images smaller than the panel */
+		imageBitmap->SetBitmap(ImageOps::CreateBitmap(ImageOps::Fit(image, displaySize), imagePanel->GetContentScaleFactor()));
+		imageSizer->Layout();
+	}
+	else
+		std::cout << "LoadFile(): Failed to load image \"" << path << "\"" << std::endl;
+}
+
+/* Show the small JPEG that cameras embed in a photo's Exif data, scaled up to fill the panel, which only takes the first few kilobytes of the
+ * file. Returns false if there isn't one (or it's not worth showing), in which case nothing changes */
+bool ImageViewer::ShowPreview(const std::string &path)
+{
+	std::vector<unsigned char> thumbnail;
+	int orientation;
+	if (actualSize || !ExifReader::ReadThumbnail(path, thumbnail, orientation))
+		return false;
+
+	wxImage preview;
+	{
+		wxLogNull noLog;
+		wxMemoryInputStream stream(thumbnail.data(), thumbnail.size());
+		if (!preview.LoadFile(stream, wxBITMAP_TYPE_JPEG))
+			return false;
+	}
+
+	ShowImage(ImageOps::Orient(preview, orientation), path);
+	return true;
+}
+
+// Show the video player in place of the image bitmap and play its video, once the backend has opened it (see OnMediaLoaded())
+void ImageViewer::ShowVideo()
+{
+	if (!player.loaded)
+		return;
+
+	if (!player.control->IsShown())
+	{
+		imageBitmap->Hide();
+		player.control->Show();
+		imageSizer->Layout();
+	}
+	player.control->Play();
+}
+
+// Stop the video on screen (if there is one) and show the image bitmap in its place
+void ImageViewer::HideVideo()
+{
+	if (!player.control->IsShown())
+		return;
+
+	player.control->Stop();
+	player.control->Hide();
+	imageBitmap->Show();
+	imageSizer->Layout();
+}
+
+// Start opening a video in a player. The backend reports when it's done (see OnMediaLoaded()), so this doesn't wait for it
+void ImageViewer::OpenVideo(MediaPlayer &media, const std::string &path)
+{
+	media.path = path;
+	media.loaded = false;
+	if (!media.control->Load(path))
+	{
+		std::cout << "LoadFile(): Failed to load video \"" << path << "\"" << std::endl;
+		media.path.clear();
+	}
 }
 
 void ImageViewer::RecurseActivationState(std::vector<Directory> &subdirectories, bool active)
@@ -498,7 +1244,7 @@ void ImageViewer::AddSubdirectories(wxBoxSizer *sizer, std::vector<Directory> &s
 	{
 		// Add the sorted subdirectories to the panel
 		std::string indicesPath;
-		for (int i = 0; i < subdirectories.size(); i++)
+		for (int i = 0; i < (int) subdirectories.size(); i++)
 		{
 			if (subdirectories[i].parent != nullptr)
 				indicesPath = subdirectories[i].parent->indicesPath + ":" + std::to_string(i);
@@ -550,9 +1296,9 @@ Directory * ImageViewer::FindDirectory(std::string path)
 	{
 		int index = std::stoi(localTokenizer.GetNextToken().ToStdString());
 
-		if (directory == nullptr && index >= 0 && index < directories.size())
+		if (directory == nullptr && index >= 0 && index < (int) directories.size())
 			directory = &directories[index];
-		else if (directory != nullptr && index >= 0 && index < directory->subdirectories.size())
+		else if (directory != nullptr && index >= 0 && index < (int) directory->subdirectories.size())
 			directory = &(directory->subdirectories[index]);
 		else
 			return nullptr;
@@ -564,11 +1310,22 @@ Directory * ImageViewer::FindDirectory(std::string path)
 // Don't catch wxID_NEW because the event will rise to TotalPhoto.cpp
 BEGIN_EVENT_TABLE(ImageViewer, wxFrame)
 EVT_MENU(wxID_REFRESH, ImageViewer::OnRefresh)
+EVT_MENU(wxID_CLEAR, ImageViewer::OnRebuildCatalog)
 EVT_MENU(wxID_PRINT, ImageViewer::OnToggleName)
 EVT_MENU(wxID_FIRST, ImageViewer::OnFirstFile)
 EVT_MENU(wxID_SETUP, ImageViewer::OnToggleSplit)
 EVT_MENU(wxID_SELECT_COLOR, ImageViewer::OnToggleBackground)
+EVT_MENU(wxID_ZOOM_100, ImageViewer::OnToggleActualSize)
+EVT_MENU(wxID_VIEW_LARGEICONS, ImageViewer::OnToggleThumbnails)
 EVT_MENU(static_cast<int>(SortMethod::NAME), ImageViewer::OnSortChanged)
 EVT_MENU(static_cast<int>(SortMethod::DATE), ImageViewer::OnSortChanged)
+EVT_MENU(static_cast<int>(SortMethod::CAPTURE_DATE), ImageViewer::OnSortChanged)
 EVT_MENU(static_cast<int>(SortMethod::RANDOM), ImageViewer::OnSortChanged)
+EVT_MENU(static_cast<int>(ImageViewer::MenuId::RESHUFFLE), ImageViewer::OnReshuffle)
+EVT_MENU(static_cast<int>(ImageViewer::MenuId::SHUFFLE_SEED), ImageViewer::OnShuffleSeed)
+EVT_MENU(static_cast<int>(ImageViewer::MenuId::CACHE_BUDGET), ImageViewer::OnCacheBudget)
+EVT_MENU(static_cast<int>(ImageViewer::MenuId::RECORD_TRACE), ImageViewer::OnRecordTrace)
+EVT_MENU(static_cast<int>(ImageViewer::MenuId::EXPORT_TRACE), ImageViewer::OnExportTrace)
+EVT_MENU(static_cast<int>(ImageViewer::MenuId::STATISTICS_OVERLAY), ImageViewer::OnToggleStatistics)
+EVT_MENU(static_cast<int>(ImageViewer::MenuId::HIDE_NEAR_DUPLICATES), ImageViewer::OnToggleNearDuplicates)
 END_EVENT_TABLE()
\ No newline at end of file
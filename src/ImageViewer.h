@@ -6,9 +6,17 @@
 
 #include "Filter.h"
 #include "CustomTypes.h"
+#include "DirectoryWatcher.h"
+#include "FileTypeRegistry.h"
+#include "ImagePrefetcher.h"
+#include "ThumbnailGrid.h"
 #include <string>
 #include <vector>
+#include <set>
+#include <memory>
+#include <unordered_map>
 #include <filesystem>
+#include <cstdint>
 #include <wx/frame.h>
 #include <wx/event.h>
 #include <wx/statbmp.h>
@@ -18,33 +26,65 @@
 #include <wx/scrolwin.h>
 #include <wx/colour.h>
 #include <wx/mediactrl.h>
+#include <wx/timer.h>
+#include <wx/stattext.h>
 
 class ImageViewer : public wxFrame
 {
 public:
 	ImageViewer(wxWindow *parent, wxWindowID id, const wxString &title, std::string path);
+	~ImageViewer();
 
 private:
 	DECLARE_EVENT_TABLE();
 
 	enum class ListType { DIRECTORIES = 0, FILE_TYPES = 1, BUTTONS = 2 };
+	enum class MenuId { RESHUFFLE = wxID_HIGHEST + 10, SHUFFLE_SEED = wxID_HIGHEST + 11, CACHE_BUDGET = wxID_HIGHEST + 12, RECORD_TRACE = wxID_HIGHEST + 13,
+						 EXPORT_TRACE = wxID_HIGHEST + 14, STATISTICS_OVERLAY = wxID_HIGHEST + 15, HIDE_NEAR_DUPLICATES = wxID_HIGHEST + 16 };
+
+	// A media player and the video it has opened (or is opening)
+	struct MediaPlayer
+	{
+		wxMediaCtrl *control = nullptr;
+		std::string path;
+		bool loaded = false; // the backend has finished opening the video, so it can be played straight away
+	};
 
 	// Event functions
 	void OnRefresh(wxCommandEvent &event);
+	void OnRebuildCatalog(wxCommandEvent &event);
 	void OnToggleName(wxCommandEvent &event);
 	void OnFirstFile(wxCommandEvent &event);
 	void OnToggleSplit(wxCommandEvent &event);
 	void OnToggleBackground(wxCommandEvent &event);
+	void OnToggleActualSize(wxCommandEvent &event);
+	void OnToggleThumbnails(wxCommandEvent &event);
 	void OnSortChanged(wxCommandEvent &event);
+	void OnReshuffle(wxCommandEvent &event);
+	void OnShuffleSeed(wxCommandEvent &event);
+	void OnCacheBudget(wxCommandEvent &event);
+	void OnRecordTrace(wxCommandEvent &event);
+	void OnExportTrace(wxCommandEvent &event);
+	void OnToggleStatistics(wxCommandEvent &event);
+	void OnToggleNearDuplicates(wxCommandEvent &event);
 	void OnDirectoryToggled(wxCommandEvent &event);
 	void OnDirectoryExpanded(wxCommandEvent &event);
 	void OnDirectoryOverflow(wxCommandEvent &event);
 	void OnFileTypeToggled(wxCommandEvent &event);
 	void OnKeyPress(wxKeyEvent &event);
+	void OnThumbnailSelected(int index, bool open);
+	void OnImageDecoded(uint64_t generation);
+	void OnImageResized(wxSizeEvent &event);
+	void OnMediaLoaded(wxMediaEvent &event);
+	void OnMediaTimer(wxTimerEvent &event);
+	void OnStatisticsTimer(wxTimerEvent &event);
+	void OnHashProgress(std::size_t remaining);
+	void OnCaptureTimeProgress(std::size_t remaining);
+	void OnDirectoriesChanged(std::set<std::string> changedDirectories, std::set<std::string> changedTrees, bool overflowed);
 
 	// Getters
 	std::vector<Directory> GetSubdirectories(Directory *directory);
-	void GetImages();
+	void GetImages(bool keepCurrent = false);
 	int GetId(ListType type, int index);
 	int GetIndex(ListType type, int id);
 
@@ -54,6 +94,15 @@ private:
 
 	// Miscellaneous functions
 	void LoadFile(int index);
+	void ShowImage(const wxImage &image, const std::string &path);
+	bool ShowPreview(const std::string &path);
+	void ShowVideo();
+	void HideVideo();
+	void OpenVideo(MediaPlayer &media, const std::string &path);
+	void SetShuffleSeed(uint64_t seed);
+	void UpdateImageSize(bool reload);
+	void ShowThumbnails(bool show);
+	void WatchDirectory(std::string path, const ScanRoot &scanRoot);
 	void RecurseActivationState(std::vector<Directory> &subdirectories, bool active);
 	void AddSubdirectories(wxBoxSizer *sizer, std::vector<Directory> &subdirectories);
 	Directory * FindDirectory(std::string path);
@@ -61,11 +110,20 @@ private:
 	// Constant variables
 	const wxColour BACKGROUND_LIGHT = wxColour(236, 236, 236);
 	const wxColour BACKGROUND_DARK = wxColour(24, 24, 24);
+	const int MEDIA_DELAY = 250; // how long (in milliseconds) to stay on a file before opening videos, so that browsing past them costs nothing
+	const int STATISTICS_INTERVAL = 500; // how often (in milliseconds) the statistics overlay is updated
 
 	// Vector variables
 	std::vector<Directory> directories;
-	std::vector<FileType> fileTypes;
+	FileTypeRegistry fileTypes;
 	std::vector<File> files;
+	std::unordered_map<std::string, ScanRoot> watchedDirectories;
+
+	// Watches the scanned directories for changes, or nullptr if watching isn't supported on this platform
+	std::unique_ptr<DirectoryWatcher> watcher;
+
+	// Decodes the images next to the current one in the background and keeps recently shown images decoded
+	ImagePrefetcher prefetcher;
 
 	// GUI element variables
 	wxSplitterWindow *splitter;
@@ -73,7 +131,14 @@ private:
 	wxPanel *imagePanel;
 	wxScrolledWindow *directoryPanel;
 	wxStaticBitmap *imageBitmap;
-	wxMediaCtrl *mediaCtrl;
+	MediaPlayer player; // the player that's shown for videos
+	MediaPlayer preroll; // a hidden player that opens the next video ahead of time
+	wxTimer mediaTimer;
+	ThumbnailGrid *thumbnailGrid;
+	wxMenuItem *thumbnailsItem;
+	wxMenuItem *traceItem;
+	wxStaticText *statisticsOverlay; // drawn over the image panel while it's turned on, showing what the trace is recording
+	wxTimer statisticsTimer;
 	wxBoxSizer *imageSizer;
 	wxBoxSizer *topSizer;
 
@@ -81,8 +146,16 @@ private:
 	std::filesystem::path rootPath;
 	std::string applicationDirectory;
 	SortMethod sortMethod = SortMethod::NAME;
+	uint64_t shuffleSeed;
 	bool showImageName = false;
+	bool hideNearDuplicates = false; // only show the first of every group of images that look the same (see StaticUtilities::HideNearDuplicates())
+	bool similarRules = false; // some directory is filtered by how its images look (see Filter::SIMILAR), so the list changes as they're hashed
+	wxString windowTitle;
+	bool actualSize = false;
+	wxSize displaySize; // the image panel's size in physical pixels, or empty when images are shown at their actual size
 	int imageIndex = 0;
+	std::string nextVideo; // the video the user is likely to move to next, which is opened in the preroll player
+	uint64_t loadGeneration = 0; // counts calls to LoadFile() so that a decode finishing late can tell it's no longer wanted
 	int defaultPanelWidth;
 };
 
@@ -0,0 +1,181 @@
+// Marcus Schmidt
+// Created on 9/9/23
+
+#include "MappedFile.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <iterator>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+// Where a registered file is mapped. The start is set last and cleared first, so a mapping the handler can see is always complete
+struct Mapping
+{
+	std::atomic<uintptr_t> start { 0 };
+	std::atomic<std::size_t> length { 0 };
+};
+
+static Mapping mappings[MappedFile::MAX_MAPPINGS];
+static uintptr_t pageSize = 4096;
+static std::once_flag handlerInstalled;
+static struct sigaction previousAction; // whatever handled SIGBUS before, which gets every bus error that isn't in a mapped file
+
+/* Reading a page of a mapped file that's past its end raises SIGBUS. If the page belongs to one of the mapped files, it's replaced with a page
+ * of zeros and the read is tried again, which then succeeds. Anything else is passed on to the handler that was installed before this one, or
+ * if that was the default action, the default is put back so that the faulting instruction ends the program when it runs again.
+ * POSIX doesn't list mmap() as safe to call in a signal handler. It's relied on here because on Linux (and the BSDs and macOS) it's a plain
+ * system call that takes no user-space locks; a platform where that isn't so would need the replacement page mapped some other way */
+static void HandleBusError(int signal, siginfo_t *info, void *context)
+{
+	uintptr_t address = reinterpret_cast<uintptr_t>(info->si_addr);
+	for (Mapping &mapping : mappings)
+	{
+		uintptr_t start = mapping.start.load(std::memory_order_acquire);
+		if (start != 0 && start != UINTPTR_MAX && address - start < mapping.length.load(std::memory_order_relaxed))
+		{
+			void *page = reinterpret_cast<void *>(address & ~(pageSize - 1));
+			if (mmap(page, pageSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED)
+				return;
+			break;
+		}
+	}
+
+	if (previousAction.sa_flags & SA_SIGINFO)
+		previousAction.sa_sigaction(signal, info, context);
+	else if (previousAction.sa_handler == SIG_DFL || previousAction.sa_handler == SIG_IGN)
+	{
+		// A bus error can't be ignored (the instruction would just fault again), so an ignored one ends the program like the default does
+		struct sigaction defaultAction = {};
+		defaultAction.sa_handler = SIG_DFL;
+		sigemptyset(&defaultAction.sa_mask);
+		sigaction(SIGBUS, &defaultAction, nullptr);
+	}
+	else
+		previousAction.sa_handler(signal);
+}
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+// Map a file, replacing whatever was mapped before. Returns false if it can't be opened or is empty
+bool MappedFile::Open(const std::string &path, Access access)
+{
+	Close();
+
+#if defined(__unix__) || defined(__APPLE__)
+	int descriptor = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (descriptor < 0)
+		return false;
+
+	struct stat status;
+	if (fstat(descriptor, &status) == 0 && status.st_size > 0 && Map(descriptor, (std::size_t) status.st_size) && slot >= 0)
+	{
+		// A file that's read from start to end (like an image by its decoder) is worth reading ahead aggressively, starting right away
+		void *mapping = const_cast<unsigned char *>(data);
+		if (access == Access::SEQUENTIAL)
+		{
+			madvise(mapping, size, MADV_SEQUENTIAL);
+			madvise(mapping, size, MADV_WILLNEED);
+		}
+		else
+			madvise(mapping, size, MADV_RANDOM);
+	}
+	close(descriptor);
+#else
+	std::ifstream stream(path, std::ios::binary);
+	contents.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+	if (!contents.empty())
+	{
+		data = contents.data();
+		size = contents.size();
+	}
+#endif
+
+	return data != nullptr;
+}
+
+void MappedFile::Close()
+{
+#if defined(__unix__) || defined(__APPLE__)
+	if (slot >= 0)
+	{
+		mappings[slot].start.store(0, std::memory_order_release);
+		munmap(const_cast<unsigned char *>(data), size);
+		slot = -1;
+	}
+#endif
+	contents.clear();
+	contents.shrink_to_fit();
+	data = nullptr;
+	size = 0;
+}
+
+//********************
+// Private functions *
+//********************
+
+/* Map an open file and register the mapping with the bus error handler, installing it the first time. If every registration is taken the file
+ * is read into memory instead, which can't fault. Returns false if the file can't be mapped or read */
+bool MappedFile::Map(int descriptor, std::size_t length)
+{
+#if defined(__unix__) || defined(__APPLE__)
+	std::call_once(handlerInstalled, []()
+	{
+		pageSize = (uintptr_t) sysconf(_SC_PAGESIZE);
+		struct sigaction action = {};
+		action.sa_sigaction = HandleBusError;
+		action.sa_flags = SA_SIGINFO;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGBUS, &action, &previousAction);
+	});
+
+	for (int i = 0; i < MAX_MAPPINGS; i++)
+	{
+		// Claim the slot with a placeholder start so that no other file takes it, then fill it in once the file is mapped
+		uintptr_t free = 0;
+		if (!mappings[i].start.compare_exchange_strong(free, UINTPTR_MAX, std::memory_order_acquire))
+			continue;
+
+		void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (mapping == MAP_FAILED)
+		{
+			mappings[i].start.store(0, std::memory_order_release);
+			return false;
+		}
+
+		mappings[i].length.store(length, std::memory_order_relaxed);
+		mappings[i].start.store(reinterpret_cast<uintptr_t>(mapping), std::memory_order_release);
+		data = static_cast<const unsigned char *>(mapping);
+		size = length;
+		slot = i;
+		return true;
+	}
+
+	// The file can shrink while it's being read, so whatever was actually read is kept
+	contents.resize(length);
+	std::size_t total = 0;
+	ssize_t count;
+	while (total < length && (count = pread(descriptor, contents.data() + total, length - total, (off_t) total)) > 0)
+		total += (std::size_t) count;
+	contents.resize(total);
+	if (total == 0)
+		return false;
+	data = contents.data();
+	size = total;
+	return true;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,45 @@
+// Marcus Schmidt
+// Created on 9/9/23
+
+#ifndef MAPPED_FILE
+#define MAPPED_FILE
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/* A whole file mapped into memory for reading, which lets a decoder read it straight from the page cache instead of through the buffers of a
+ * file stream. Mapping a file also asks the system to start reading it in the background, so a file that's mapped a little before it's needed
+ * is usually in memory by the time it's read. On platforms without memory mapping the file is read into memory instead.
+ * A file that's truncated while it's mapped (say, saved again in place by an editor) would make reading the part that's gone raise SIGBUS and
+ * end the program, so the pages that are gone are replaced with zeros instead (see MappedFile.cpp) and the read carries on, which at worst
+ * makes the decode fail. Every mapping is registered so that a bus error anywhere else still ends the program as usual. */
+class MappedFile
+{
+public:
+	// How the file will be read, which decides how the system reads ahead
+	enum class Access { SEQUENTIAL, RANDOM };
+
+	MappedFile() {}
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+	~MappedFile();
+
+	bool Open(const std::string &path, Access access = Access::SEQUENTIAL);
+	void Close();
+
+	const unsigned char * GetData() const { return data; }
+	std::size_t GetSize() const { return size; }
+
+	constexpr static int MAX_MAPPINGS = 1024; // how many files can be mapped at once; any more are read into memory instead
+
+private:
+	bool Map(int descriptor, std::size_t length);
+
+	const unsigned char *data = nullptr;
+	std::size_t size = 0;
+	int slot = -1; // where the mapping is registered, or -1 if the file isn't mapped
+	std::vector<unsigned char> contents; // holds the file on platforms without memory mapping, or when it can't be registered
+};
+
+#endif
@@ -0,0 +1,137 @@
+// Marcus Schmidt
+// Created on 9/23/23
+
+#include "MovieReader.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+/* Get a still image to show for a video until it's opened. Cameras that record to memory cards often write one next to the video, as a small
+ * JPEG with the same name and a .THM extension, and videos that went through iTunes-style tagging can have cover art. Returns false if there's
+ * neither, or if what's there doesn't look like a JPEG or PNG. */
+bool MovieReader::ReadPoster(const std::string &path, std::vector<unsigned char> &poster)
+{
+	std::filesystem::path sidecar(path);
+	for (const char *extension : { ".THM", ".thm" })
+	{
+		sidecar.replace_extension(extension);
+		std::ifstream stream(sidecar, std::ios::binary | std::ios::ate);
+		if (stream && ReadRange(stream, 0, (uint64_t) stream.tellg(), poster) && IsImage(poster))
+			return true;
+	}
+
+	return ReadCoverArt(path, poster);
+}
+
+/* Get when the video was recorded from the creation time in moov/mvhd, which is in seconds since 1904 (UTC, although some cameras write their
+ * local time). The time is 32 bits after the version and flags in version 0 of the box, and 64 bits in version 1. A time of zero means it wasn't set
+ * Reference: https://developer.apple.com/documentation/quicktime-file-format/movie_header_atom */
+bool MovieReader::ReadCaptureTime(const std::string &path, time_t &time)
+{
+	std::ifstream stream(path, std::ios::binary | std::ios::ate);
+	if (!stream)
+		return false;
+
+	uint64_t start = 0, end = (uint64_t) stream.tellg();
+	std::vector<unsigned char> header;
+	if (!FindBox(stream, start, end, "moov", start, end) || !FindBox(stream, start, end, "mvhd", start, end) || !ReadRange(stream, start, std::min(end, start + 12), header)
+		|| header.size() < 8)
+		return false;
+
+	uint64_t created = 0;
+	std::size_t length = (header[0] == 1) ? 8 : 4;
+	if (header.size() < 4 + length)
+		return false;
+	for (std::size_t i = 4; i < 4 + length; i++)
+		created = (created << 8) | header[i];
+
+	// Seconds between 1904 and 1970, where time_t starts
+	const uint64_t EPOCH_OFFSET = 2082844800;
+	if (created <= EPOCH_OFFSET)
+		return false;
+
+	time = (time_t) (created - EPOCH_OFFSET);
+	return true;
+}
+
+//********************
+// Private functions *
+//********************
+
+// Cover art is stored in moov/udta/meta/ilst/covr/data, after 8 bytes that give its type and language
+bool MovieReader::ReadCoverArt(const std::string &path, std::vector<unsigned char> &poster)
+{
+	std::ifstream stream(path, std::ios::binary | std::ios::ate);
+	if (!stream)
+		return false;
+
+	uint64_t start = 0, end = (uint64_t) stream.tellg();
+	if (!FindBox(stream, start, end, "moov", start, end) || !FindBox(stream, start, end, "udta", start, end) || !FindBox(stream, start, end, "meta", start, end))
+		return false;
+
+	// In MP4 files 'meta' starts with a version and flags before its boxes, while in QuickTime files it doesn't, where a box's size can't be zero
+	std::vector<unsigned char> header;
+	if (ReadRange(stream, start, start + 4, header) && std::memcmp(header.data(), "\0\0\0\0", 4) == 0)
+		start += 4;
+
+	return FindBox(stream, start, end, "ilst", start, end) && FindBox(stream, start, end, "covr", start, end) && FindBox(stream, start, end, "data", start, end)
+		   && end - start > 8 && ReadRange(stream, start + 8, end, poster) && IsImage(poster);
+}
+
+/* Find the first box of a type among the boxes between 'start' and 'end', and get where its contents are (after its header). A box starts with
+ * its size (including the header) and its type, with 64-bit sizes stored after the type when the 32-bit size is 1 and a size of 0 meaning that
+ * the box runs to the end of its parent */
+bool MovieReader::FindBox(std::ifstream &stream, uint64_t start, uint64_t end, const char *type, uint64_t &contentStart, uint64_t &contentEnd)
+{
+	uint64_t position = start;
+	while (end - position >= 8)
+	{
+		unsigned char header[16];
+		stream.clear();
+		stream.seekg((std::streamoff) position);
+		if (!stream.read(reinterpret_cast<char *>(header), 8))
+			return false;
+
+		uint64_t size = ((uint64_t) header[0] << 24) | ((uint64_t) header[1] << 16) | ((uint64_t) header[2] << 8) | header[3];
+		uint64_t headerSize = 8;
+		if (size == 1)
+		{
+			if (end - position < 16 || !stream.read(reinterpret_cast<char *>(header + 8), 8))
+				return false;
+			size = 0;
+			for (int i = 8; i < 16; i++)
+				size = (size << 8) | header[i];
+			headerSize = 16;
+		}
+		else if (size == 0)
+			size = end - position;
+
+		if (size < headerSize || size > end - position)
+			return false;
+
+		if (std::memcmp(header + 4, type, 4) == 0)
+		{
+			contentStart = position + headerSize;
+			contentEnd = position + size;
+			return true;
+		}
+		position += size;
+	}
+	return false;
+}
+
+bool MovieReader::ReadRange(std::ifstream &stream, uint64_t start, uint64_t end, std::vector<unsigned char> &bytes)
+{
+	if (end <= start || end - start > MAX_POSTER_BYTES)
+		return false;
+
+	bytes.resize((std::size_t) (end - start));
+	stream.clear();
+	stream.seekg((std::streamoff) start);
+	return (bool) stream.read(reinterpret_cast<char *>(bytes.data()), bytes.size());
+}
+
+bool MovieReader::IsImage(const std::vector<unsigned char> &bytes)
+{
+	return bytes.size() >= 8 && ((bytes[0] == 0xFF && bytes[1] == 0xD8) || std::memcmp(bytes.data(), "\x89PNG\r\n\x1a\n", 8) == 0);
+}
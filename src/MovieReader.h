@@ -0,0 +1,32 @@
+// Marcus Schmidt
+// Created on 9/23/23
+
+#ifndef MOVIE_READER
+#define MOVIE_READER
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/* Reads metadata from MP4 and QuickTime videos without opening them in a media player, by walking the boxes ("atoms" in QuickTime) that the
+ * files are made of. Only box headers are read on the way to the box that's wanted, so even a video several gigabytes long takes a handful of
+ * small reads wherever its metadata is stored. */
+class MovieReader
+{
+public:
+	static bool ReadPoster(const std::string &path, std::vector<unsigned char> &poster);
+	static bool ReadCaptureTime(const std::string &path, time_t &time);
+
+	constexpr static std::size_t MAX_POSTER_BYTES = 4 << 20;
+
+private:
+	static bool ReadCoverArt(const std::string &path, std::vector<unsigned char> &poster);
+	static bool FindBox(std::ifstream &stream, uint64_t start, uint64_t end, const char *type, uint64_t &contentStart, uint64_t &contentEnd);
+	static bool ReadRange(std::ifstream &stream, uint64_t start, uint64_t end, std::vector<unsigned char> &bytes);
+	static bool IsImage(const std::vector<unsigned char> &bytes);
+};
+
+#endif
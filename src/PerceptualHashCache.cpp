@@ -0,0 +1,249 @@
+// Marcus Schmidt
+// Created on 11/4/23
+
+#include "PerceptualHashCache.h"
+#include "CacheFile.h"
+#include "ExifReader.h"
+#include "ImageKernels.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#ifndef HEADLESS
+#include <wx/image.h>
+#include <wx/log.h>
+#include <wx/mstream.h>
+#endif
+#include <algorithm>
+
+PerceptualHashCache & PerceptualHashCache::Get()
+{
+	static PerceptualHashCache cache;
+	return cache;
+}
+
+// Drop the images that haven't been started and wait for every task to finish before the members go away (see ~ThumbnailCache())
+PerceptualHashCache::~PerceptualHashCache()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	queue.clear();
+	listeners.clear();
+	tasksFinished.wait(lock, [this]() { return tasks == 0; });
+}
+
+// Read the saved hashes, unless the file is the one that's already open (every viewer window shares the same cache)
+void PerceptualHashCache::Load(std::string _path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_path == path)
+		return;
+
+	path = _path;
+	entries.clear();
+	changed = false;
+
+	std::vector<uint64_t> records;
+	CacheFile::Read(path, MAGIC, RECORD_WORDS, records);
+	entries.reserve(records.size() / RECORD_WORDS);
+	for (std::size_t i = 0; i < records.size(); i += RECORD_WORDS)
+		entries[records[i]] = { (int64_t) records[i + 1], records[i + 2], records[i + 3] != 0 };
+}
+
+void PerceptualHashCache::Save()
+{
+	std::string savePath;
+	std::vector<uint64_t> records;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!changed || path.empty())
+			return;
+		changed = false;
+
+		savePath = path;
+		records.reserve(entries.size() * RECORD_WORDS);
+		for (const auto &entry : entries)
+		{
+			records.push_back(entry.first);
+			records.push_back((uint64_t) entry.second.modifiedTime);
+			records.push_back(entry.second.hash);
+			records.push_back(entry.second.valid ? 1 : 0);
+		}
+	}
+
+	CacheFile::Write(savePath, MAGIC, RECORD_WORDS, records);
+}
+
+// Forget every hash (and delete the saved file) so that every image is decoded again. Images that are being hashed right now are still stored
+void PerceptualHashCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	entries.clear();
+	for (const Job &job : queue)
+		queued.erase(job.key);
+	queue.clear();
+	changed = false;
+	CacheFile::Remove(path);
+}
+
+/* The perceptual hash of every file in 'paths', whose modification times are in 'modifiedTimes', as far as it's known. The cached ones are looked
+ * up all at once, and the rest are reported as pending and queued to be hashed in the background (see Listen()) */
+std::vector<PerceptualHash> PerceptualHashCache::Resolve(const std::vector<std::string> &paths, const std::vector<time_t> &modifiedTimes)
+{
+	Trace::Span span("ResolvePerceptualHashes");
+	std::vector<PerceptualHash> hashes(paths.size(), PerceptualHash{ 0, false });
+	std::size_t newJobs = 0;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (std::size_t i = 0; i < paths.size(); i++)
+		{
+			uint64_t key = CacheFile::GetKey(paths[i]);
+			auto iterator = entries.find(key);
+			if (iterator != entries.end() && iterator->second.modifiedTime == (int64_t) modifiedTimes[i])
+				hashes[i] = { iterator->second.hash, iterator->second.valid };
+#ifndef HEADLESS
+			else
+			{
+				hashes[i].pending = true;
+				if (queued.insert(key).second)
+				{
+					queue.push_back({ key, paths[i], modifiedTimes[i] });
+					newJobs++;
+				}
+			}
+#endif
+		}
+		tasks += (newJobs + BATCH_SIZE - 1) / BATCH_SIZE;
+	}
+
+	// Images can't be decoded without the GUI library, so in a HEADLESS build whatever isn't cached stays unknown and nothing is queued
+	for (std::size_t task = 0; task < (newJobs + BATCH_SIZE - 1) / BATCH_SIZE; task++)
+	{
+		ThreadPool::Get().Submit([this]()
+		{
+			HashNext();
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--tasks == 0)
+				tasksFinished.notify_all();
+		});
+	}
+	return hashes;
+}
+
+/* Call 'progress' with the number of images that are still waiting to be hashed whenever a batch of them has been, which is from a worker thread
+ * with the cache locked. It's called with 0 once every image that was queued has been hashed */
+void PerceptualHashCache::Listen(const void *owner, std::function<void(std::size_t)> progress)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	listeners[owner] = progress;
+}
+
+// Stop telling an owner about progress, which must be done before the owner is destroyed
+void PerceptualHashCache::Cancel(const void *owner)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	listeners.erase(owner);
+}
+
+/* The difference hash of an image given as packed RGB pixels, turned upright first with its Exif orientation so that a copy that was rotated
+ * when it was exported has the same hash. Returns false if the image is too small to have one */
+bool PerceptualHashCache::HashPixels(const unsigned char *pixels, int width, int height, int orientation, uint64_t &hash)
+{
+	// Integer weights for the luma of Rec. 601, which add up to 256
+	std::vector<unsigned char> grey((std::size_t) width * height);
+	for (std::size_t i = 0; i < grey.size(); i++)
+		grey[i] = (unsigned char) ((pixels[i * 3] * 77 + pixels[i * 3 + 1] * 150 + pixels[i * 3 + 2] * 29) >> 8);
+
+	if (orientation > 1 && orientation <= 8)
+	{
+		std::vector<unsigned char> upright(grey.size());
+		ImageKernels::Orient(grey.data(), width, height, 1, orientation, upright.data());
+		grey.swap(upright);
+		if (ImageKernels::SwapsSides(orientation))
+			std::swap(width, height);
+	}
+	if (width < HASH_WIDTH || height < HASH_HEIGHT)
+		return false;
+
+	unsigned char shrunk[HASH_WIDTH * HASH_HEIGHT];
+	ImageKernels::Downscale(grey.data(), width, height, 1, shrunk, HASH_WIDTH, HASH_HEIGHT);
+
+	hash = 0;
+	for (int y = 0; y < HASH_HEIGHT; y++)
+	{
+		for (int x = 0; x < HASH_WIDTH - 1; x++)
+		{
+			if (shrunk[y * HASH_WIDTH + x] < shrunk[y * HASH_WIDTH + x + 1])
+				hash |= (uint64_t) 1 << (y * (HASH_WIDTH - 1) + x);
+		}
+	}
+	return true;
+}
+
+//********************
+// Private functions *
+//********************
+
+// Hash the next batch of images that are waiting, if there are any, and store them together
+void PerceptualHashCache::HashNext()
+{
+	std::vector<Job> batch;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		while (batch.size() < BATCH_SIZE && !queue.empty())
+		{
+			batch.push_back(std::move(queue.front()));
+			queue.pop_front();
+		}
+	}
+	if (batch.empty())
+		return;
+
+	Trace::Span span("HashImages");
+	std::vector<PerceptualHash> hashes(batch.size(), PerceptualHash{ 0, false });
+#ifndef HEADLESS
+	for (std::size_t i = 0; i < batch.size(); i++)
+		hashes[i].valid = ComputeHash(batch[i].path, hashes[i].bits);
+#endif
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for (std::size_t i = 0; i < batch.size(); i++)
+	{
+		entries[batch[i].key] = { (int64_t) batch[i].modifiedTime, hashes[i].bits, hashes[i].valid };
+		queued.erase(batch[i].key);
+	}
+	changed = true;
+
+	for (const auto &listener : listeners)
+		listener.second(queued.size());
+}
+
+#ifndef HEADLESS
+// Decode an image at a reduced size (see ThumbnailCache::GenerateNext()) and hash it. Returns false if it isn't an image that can be decoded
+bool PerceptualHashCache::ComputeHash(const std::string &path, uint64_t &hash)
+{
+	// Only look at the start of the file to tell whether it's an image at all, so that a video isn't read ahead just to find out
+	MappedFile file;
+	if (!file.Open(path, MappedFile::Access::RANDOM))
+		return false;
+
+	wxLogNull noLog;
+	{
+		wxMemoryInputStream probe(file.GetData(), file.GetSize());
+		if (!wxImage::CanRead(probe))
+			return false;
+	}
+
+	if (!file.Open(path))
+		return false;
+	wxMemoryInputStream stream(file.GetData(), file.GetSize());
+	wxImage image;
+	image.SetOption(wxIMAGE_OPTION_MAX_WIDTH, DECODE_SIZE);
+	image.SetOption(wxIMAGE_OPTION_MAX_HEIGHT, DECODE_SIZE);
+	if (!image.LoadFile(stream) || !image.IsOk())
+		return false;
+	int orientation = ExifReader::ReadOrientation(file.GetData(), file.GetSize());
+	file.Close();
+
+	return HashPixels(image.GetData(), image.GetWidth(), image.GetHeight(), orientation, hash);
+}
+#endif
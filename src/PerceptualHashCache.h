@@ -0,0 +1,90 @@
+// Marcus Schmidt
+// Created on 11/4/23
+
+#ifndef PERCEPTUAL_HASH_CACHE
+#define PERCEPTUAL_HASH_CACHE
+
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// A perceptual hash, or not 'valid' if the file isn't an image that can be decoded or it's still 'pending' (being hashed in the background)
+struct PerceptualHash
+{
+	uint64_t bits;
+	bool valid;
+	bool pending = false;
+};
+
+/* The perceptual hashes of images, which stay nearly the same when an image is resized, recompressed or exported again, so images that look
+ * the same can be found by comparing them (see SimilarityIndex). Each one is a difference hash (dHash): the image is shrunk to 9x8 shades of
+ * grey and every bit records whether a pixel is darker than the one to its right. Images are decoded at a reduced size for it, the same way
+ * thumbnails are, and the hashes are remembered by a hash of the path along with the modification time. Decoding a whole library takes
+ * minutes, so it's never waited for: the images that aren't cached yet are hashed in batches on the thread pool in the background, and whoever
+ * is listening is told how many are left as they're done. Decoding needs the GUI library, so a HEADLESS build only uses the hashes that are
+ * already cached.
+ * Reference: https://www.hackerfactor.com/blog/index.php?/archives/529-Kind-of-Like-That.html */
+class PerceptualHashCache
+{
+public:
+	static PerceptualHashCache & Get();
+
+	void Load(std::string _path);
+	void Save();
+	void Clear();
+
+	std::vector<PerceptualHash> Resolve(const std::vector<std::string> &paths, const std::vector<time_t> &modifiedTimes);
+	void Listen(const void *owner, std::function<void(std::size_t)> progress);
+	void Cancel(const void *owner);
+
+	static bool HashPixels(const unsigned char *pixels, int width, int height, int orientation, uint64_t &hash);
+
+	constexpr static std::size_t BATCH_SIZE = 16; // images decoded by one task, fewer than the other caches read since decoding takes longer
+	constexpr static int DECODE_SIZE = 64; // the size images are decoded at, which is plenty to shrink to 9x8 from
+	constexpr static int HASH_WIDTH = 9;
+	constexpr static int HASH_HEIGHT = 8;
+
+private:
+	struct Entry
+	{
+		int64_t modifiedTime;
+		uint64_t hash;
+		bool valid;
+	};
+
+	struct Job
+	{
+		uint64_t key;
+		std::string path;
+		time_t modifiedTime;
+	};
+
+	PerceptualHashCache() {}
+	~PerceptualHashCache();
+
+	void HashNext();
+	static bool ComputeHash(const std::string &path, uint64_t &hash);
+
+	constexpr static uint64_t VERSION = 1;
+	constexpr static uint64_t MAGIC = 0x5048415348000000 | VERSION; // "PHASH" and the version
+	constexpr static std::size_t RECORD_WORDS = 4; // the key, modification time, hash and whether it's valid (see CacheFile)
+
+	std::string path;
+	std::unordered_map<uint64_t, Entry> entries;
+	std::deque<Job> queue; // images waiting to be hashed
+	std::unordered_set<uint64_t> queued; // the keys of the images that are waiting or being hashed
+	std::unordered_map<const void *, std::function<void(std::size_t)>> listeners;
+	std::size_t tasks = 0; // tasks handed to the pool that haven't finished yet
+	std::condition_variable tasksFinished;
+	std::mutex mutex;
+	bool changed = false;
+};
+
+#endif
@@ -0,0 +1,310 @@
+// Marcus Schmidt
+// Created on 7/15/23
+
+#include "ScanCatalog.h"
+#include "StaticUtilities.h"
+#include "DirectoryReader.h"
+#include "Trace.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <iostream>
+
+// Helpers to read and write the catalog's binary format. Strings are stored as a length followed by their characters.
+static void WriteInt(std::ofstream &stream, int64_t value)
+{
+	stream.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void WriteString(std::ofstream &stream, const std::string &value)
+{
+	WriteInt(stream, (int64_t) value.size());
+	stream.write(value.data(), value.size());
+}
+
+static bool ReadInt(std::ifstream &stream, int64_t &value)
+{
+	return (bool) stream.read(reinterpret_cast<char *>(&value), sizeof(value));
+}
+
+static bool ReadString(std::ifstream &stream, std::string &value)
+{
+	// Reject impossible lengths so that a corrupted file can't trigger a huge allocation
+	int64_t size;
+	if (!ReadInt(stream, size) || size < 0 || size > 1 << 20)
+		return false;
+
+	value.resize(size);
+	return (bool) stream.read(&value[0], size);
+}
+
+ScanCatalog & ScanCatalog::Get()
+{
+	static ScanCatalog catalog;
+	return catalog;
+}
+
+// Read the catalog file, unless it's the one that's already open (every viewer window shares the same catalog, which may not be saved yet)
+void ScanCatalog::Load(std::string _path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_path == path)
+		return;
+
+	path = _path;
+	directories.clear();
+	fileTypesSignature = "";
+	changed = false;
+
+	std::ifstream stream(path, std::ios::binary);
+	if (!stream)
+		return;
+
+	bool valid = true;
+	int64_t version, directoryCount;
+	valid = ReadInt(stream, version) && version == VERSION && ReadString(stream, fileTypesSignature) && ReadInt(stream, directoryCount);
+	for (int64_t i = 0; valid && i < directoryCount; i++)
+	{
+		std::string directoryPath;
+		int64_t fileCount, subdirectoryCount;
+		std::shared_ptr<CatalogDirectory> directory = std::make_shared<CatalogDirectory>();
+		valid = ReadString(stream, directoryPath) && ReadInt(stream, directory->modifiedTime) && ReadInt(stream, directory->readTime)
+			&& ReadInt(stream, fileCount);
+
+		for (int64_t j = 0; valid && j < fileCount; j++)
+		{
+			CatalogFile file;
+			int64_t time, type;
+			valid = ReadString(stream, file.name) && ReadString(stream, file.nameStandardized) && ReadInt(stream, time) && ReadInt(stream, type);
+			file.modifiedTime = (time_t) time;
+			file.type = static_cast<MediaType>(type);
+			directory->files.push_back(file);
+		}
+
+		valid = valid && ReadInt(stream, subdirectoryCount);
+		for (int64_t j = 0; valid && j < subdirectoryCount; j++)
+		{
+			std::string name;
+			int64_t position;
+			valid = ReadString(stream, name) && ReadInt(stream, position) && position >= 0 && position <= (int64_t) directory->files.size();
+			directory->subdirectories.push_back(name);
+			directory->subdirectoryPositions.push_back(position);
+		}
+
+		if (valid)
+			directories[directoryPath] = directory;
+	}
+
+	if (!valid)
+	{
+		std::cout << "ScanCatalog::Load(): Discarding unreadable catalog \"" << path << "\"" << std::endl;
+		directories.clear();
+		fileTypesSignature = "";
+	}
+}
+
+void ScanCatalog::Save()
+{
+	// Take a snapshot of the entries so that the file can be written without blocking a scan
+	std::string signature;
+	std::map<std::string, std::shared_ptr<const CatalogDirectory>> snapshot;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!changed || path.empty())
+			return;
+		signature = fileTypesSignature;
+		snapshot = directories;
+		changed = false;
+	}
+
+	// Write to a temporary file first and then replace the old catalog, so that a partially written catalog is never loaded
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+	std::string temporaryPath = path + ".tmp";
+	{
+		std::ofstream stream(temporaryPath, std::ios::binary | std::ios::trunc);
+		WriteInt(stream, VERSION);
+		WriteString(stream, signature);
+		WriteInt(stream, (int64_t) snapshot.size());
+		for (const auto &entry : snapshot)
+		{
+			WriteString(stream, entry.first);
+			WriteInt(stream, entry.second->modifiedTime);
+			WriteInt(stream, entry.second->readTime);
+			WriteInt(stream, (int64_t) entry.second->files.size());
+			for (const auto &file : entry.second->files)
+			{
+				WriteString(stream, file.name);
+				WriteString(stream, file.nameStandardized);
+				WriteInt(stream, (int64_t) file.modifiedTime);
+				WriteInt(stream, static_cast<int64_t>(file.type));
+			}
+
+			WriteInt(stream, (int64_t) entry.second->subdirectories.size());
+			for (std::size_t i = 0; i < entry.second->subdirectories.size(); i++)
+			{
+				WriteString(stream, entry.second->subdirectories[i]);
+				WriteInt(stream, (int64_t) entry.second->subdirectoryPositions[i]);
+			}
+		}
+
+		if (!stream)
+		{
+			std::cout << "ScanCatalog::Save(): Unable to write \"" << temporaryPath << "\"" << std::endl;
+			std::filesystem::remove(temporaryPath, error);
+			return;
+		}
+	}
+
+	std::filesystem::rename(temporaryPath, path, error);
+	if (error)
+		std::cout << "ScanCatalog::Save(): Unable to replace \"" << path << "\" (" << error.message() << ")" << std::endl;
+}
+
+// Forget every recorded directory (and delete the saved file) so that the next scan rebuilds the catalog from scratch
+void ScanCatalog::Clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	directories.clear();
+	staleDirectories.clear();
+	changed = false;
+
+	std::error_code error;
+	if (!path.empty())
+		std::filesystem::remove(path, error);
+}
+
+/* Return the contents of a directory, re-reading it only if its modification time doesn't match the recorded one or the recorded listing was
+ * read too soon after that time to be sure it's complete. Returns nullptr if it can't be read */
+std::shared_ptr<const CatalogDirectory> ScanCatalog::ListDirectory(const std::string &path, const FileTypeRegistry &fileTypes)
+{
+	// The time is checked before the directory is read, so a change made while it's being read will cause another read next time
+	int64_t modifiedTime;
+	if (!DirectoryReader::GetDirectoryTime(path, modifiedTime))
+	{
+		std::cout << "ScanCatalog::ListDirectory(): Unable to read \"" << path << "\"" << std::endl;
+		return nullptr;
+	}
+
+	std::string signature = fileTypes.GetSignature();
+	std::shared_ptr<const CatalogDirectory> previous;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// The recorded files depend on which file types exist, so start over if they've changed
+		if (signature != fileTypesSignature)
+		{
+			directories.clear();
+			fileTypesSignature = signature;
+			changed = true;
+		}
+
+		auto iterator = directories.find(path);
+		bool stale = staleDirectories.erase(path) > 0;
+		if (iterator != directories.end())
+		{
+			const CatalogDirectory &recorded = *iterator->second;
+			if (!stale && recorded.modifiedTime == modifiedTime && recorded.readTime - recorded.modifiedTime >= DirectoryReader::GetTimeSpan(TIMESTAMP_GRANULARITY))
+				return iterator->second;
+			previous = iterator->second;
+		}
+	}
+
+	std::shared_ptr<const CatalogDirectory> directory = ReadDirectory(path, modifiedTime, fileTypes);
+	if (directory == nullptr || !caching)
+		return directory;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	directories[path] = directory;
+	changed = true;
+
+	// Drop the recorded trees of any subdirectories that have since been removed or renamed
+	if (previous != nullptr)
+	{
+		for (const auto &name : previous->subdirectories)
+		{
+			if (std::find(directory->subdirectories.begin(), directory->subdirectories.end(), name) == directory->subdirectories.end())
+				RemoveTree(path + "/" + name);
+		}
+	}
+
+	return directory;
+}
+
+/* Make the next ListDirectory() of a directory read it again even if its time hasn't changed, for a directory that's known to have changed
+ * (by the directory watcher, say), since a change within the same tick of the file system's clock leaves the time as it was */
+void ScanCatalog::Invalidate(const std::string &path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	staleDirectories.insert(path);
+}
+
+// Forget a directory and every directory beneath it, so that they're all read again the next time they're listed
+void ScanCatalog::InvalidateTree(const std::string &path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	RemoveTree(path);
+	changed = true;
+}
+
+//********************
+// Private functions *
+//********************
+
+std::shared_ptr<const CatalogDirectory> ScanCatalog::ReadDirectory(const std::string &path, int64_t modifiedTime, const FileTypeRegistry &fileTypes)
+{
+	Trace::Span span("ReadDirectory");
+	span.SetDetail(path);
+	Trace::Count(Trace::Counter::DIRECTORIES_READ);
+
+	std::shared_ptr<CatalogDirectory> directory = std::make_shared<CatalogDirectory>();
+	directory->modifiedTime = modifiedTime;
+	directory->readTime = DirectoryReader::GetCurrentTime();
+
+	DirectoryReader reader(path);
+	while (reader.Next())
+	{
+		if (reader.GetType() == DirectoryReader::DIRECTORY)
+		{
+			directory->subdirectories.push_back(reader.GetName());
+			directory->subdirectoryPositions.push_back(directory->files.size());
+		}
+		else if (reader.GetType() == DirectoryReader::REGULAR_FILE)
+		{
+			// Files that aren't one of the known types can never be shown, so they aren't worth a stat() call or a spot in the catalog
+			std::string name = reader.GetName();
+			const FileType *fileType = fileTypes.Find(name);
+			if (fileType == nullptr)
+				continue;
+
+			time_t time;
+			if (!reader.GetModifiedTime(time))
+			{
+				std::cout << "ScanCatalog::ReadDirectory(): Unable to obtain time for \"" << path << "/" << name << "\"" << std::endl;
+				time = 0;
+			}
+
+			directory->files.push_back({ name, StaticUtilities::StandardizeImageName(name), time, fileType->type });
+		}
+	}
+
+	if (reader.Failed())
+	{
+		std::cout << "ScanCatalog::ReadDirectory(): Unable to read \"" << path << "\"" << std::endl;
+		return nullptr;
+	}
+
+	return directory;
+}
+
+// Remove the entry for a directory and every directory beneath it (the caller must hold the lock)
+void ScanCatalog::RemoveTree(const std::string &path)
+{
+	directories.erase(path);
+
+	std::string prefix = path + "/";
+	auto iterator = directories.lower_bound(prefix);
+	while (iterator != directories.end() && iterator->first.compare(0, prefix.size(), prefix) == 0)
+		iterator = directories.erase(iterator);
+}
@@ -0,0 +1,74 @@
+// Marcus Schmidt
+// Created on 7/15/23
+
+#ifndef SCAN_CATALOG
+#define SCAN_CATALOG
+
+#include "CustomTypes.h"
+#include "FileTypeRegistry.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+struct CatalogFile
+{
+	std::string name;
+	std::string nameStandardized;
+	time_t modifiedTime;
+	MediaType type;
+};
+
+/* Everything a scan needs to know about one directory. Subdirectory 'i' was listed after the first 'subdirectoryPositions[i]' files,
+ * which lets a scan visit the files and subdirectories in the same order as a directory iterator. */
+struct CatalogDirectory
+{
+	int64_t modifiedTime;
+	int64_t readTime; // when the directory started being read, in the same units as 'modifiedTime'
+	std::vector<CatalogFile> files;
+	std::vector<std::string> subdirectories;
+	std::vector<std::size_t> subdirectoryPositions;
+};
+
+/* A persistent record of every directory that has been scanned, so that a rescan only has to re-read the directories whose
+ * modification time has changed since the last time. Only files with a known file type are recorded. The catalog is just a cache:
+ * if the file is missing, unreadable or from another version it's discarded and rebuilt by the next scan.
+ * Modification times only change once per tick of the file system's clock, so a file added in the same tick that a directory was read in
+ * doesn't change its time. Like git's index, a listing that was read within TIMESTAMP_GRANULARITY of the directory's modification time isn't
+ * trusted and is read again next time. */
+class ScanCatalog
+{
+public:
+	static ScanCatalog & Get();
+
+	void Load(std::string _path);
+	void Save();
+	void Clear();
+	void SetCaching(bool enabled) { caching = enabled; } // with caching off, listings are returned without being kept, so nothing is saved either
+
+	std::shared_ptr<const CatalogDirectory> ListDirectory(const std::string &path, const FileTypeRegistry &fileTypes);
+	void Invalidate(const std::string &path);
+	void InvalidateTree(const std::string &path);
+
+private:
+	ScanCatalog() {}
+
+	std::shared_ptr<const CatalogDirectory> ReadDirectory(const std::string &path, int64_t modifiedTime, const FileTypeRegistry &fileTypes);
+	void RemoveTree(const std::string &path);
+
+	const static uint32_t VERSION = 3; // 3: listings record when they were read
+	const static int TIMESTAMP_GRANULARITY = 2; // seconds, the coarsest tick of a common file system (FAT and exFAT, as on camera cards)
+
+	std::string path;
+	std::string fileTypesSignature;
+	std::map<std::string, std::shared_ptr<const CatalogDirectory>> directories;
+	std::set<std::string> staleDirectories; // directories that are read again by the next ListDirectory() whatever their time is
+	std::mutex mutex;
+	bool changed = false;
+	bool caching = true;
+};
+
+#endif
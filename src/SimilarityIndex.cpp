@@ -0,0 +1,241 @@
+// Marcus Schmidt
+// Created on 11/4/23
+
+#include "SimilarityIndex.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+
+/* Index 'hashes', which are given IDs by their positions. The hashes are sorted once and each table is then filled in that order with a
+ * counting sort, which keeps every bucket sorted by hash so that copies of the same hash are next to each other (see FindGroups()) */
+void SimilarityIndex::Build(std::vector<uint64_t> _hashes)
+{
+	hashes = std::move(_hashes);
+	std::vector<uint32_t> order(hashes.size());
+	for (uint32_t id = 0; id < order.size(); id++)
+		order[id] = id;
+	std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return hashes[a] < hashes[b]; });
+
+	for (int table = 0; table < TABLES; table++)
+	{
+		offsets[table].assign(((std::size_t) 1 << CHUNK_BITS) + 1, 0);
+		for (uint64_t hash : hashes)
+			offsets[table][GetChunk(hash, table) + 1]++;
+		for (std::size_t i = 1; i < offsets[table].size(); i++)
+			offsets[table][i] += offsets[table][i - 1];
+
+		// Fill every bucket from its start, advancing a copy of the offsets as each one is filled
+		std::vector<uint32_t> next(offsets[table].begin(), offsets[table].end() - 1);
+		buckets[table].resize(hashes.size());
+		ids[table].resize(hashes.size());
+		for (uint32_t id : order)
+		{
+			uint32_t position = next[GetChunk(hashes[id], table)]++;
+			buckets[table][position] = hashes[id];
+			ids[table][position] = id;
+		}
+	}
+}
+
+// The IDs of every indexed hash within 'distance' bits of 'hash' (at most MAXIMUM_DISTANCE), in increasing order
+void SimilarityIndex::FindSimilar(uint64_t hash, int distance, std::vector<uint32_t> &matches) const
+{
+	matches.clear();
+	Search(hash, distance, [&matches](uint32_t id) { matches.push_back(id); return false; });
+
+	// A hash that's close in more than one chunk is found in more than one table
+	std::sort(matches.begin(), matches.end());
+	matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+}
+
+// Whether any indexed hash is within 'distance' bits of 'hash', which stops at the first one found
+bool SimilarityIndex::HasSimilar(uint64_t hash, int distance) const
+{
+	return Search(hash, distance, [](uint32_t id) { return true; });
+}
+
+/* Group the indexed hashes that are within 'distance' bits of each other (at most MAXIMUM_DISTANCE), transitively, and return the group of
+ * every ID as the lowest ID in it. Rather than searching for every hash in turn, each table's buckets are compared with themselves and with
+ * the buckets a bit away from them, which finds the same matches while reading the buckets in order. Matches are joined into the groups as
+ * they're found instead of being collected, since a group of k look-alikes has k * k / 2 of them (once for every table they match in). The
+ * tables are split into ranges of buckets that are compared on the thread pool, by one task per thread that each keep groups of their own,
+ * which are joined together at the end */
+std::vector<uint32_t> SimilarityIndex::FindGroups(int distance) const
+{
+	const uint32_t values = (uint32_t) 1 << CHUNK_BITS;
+	const uint32_t rangesPerTable = (values + VALUES_PER_TASK - 1) / VALUES_PER_TASK;
+	const uint32_t ranges = TABLES * rangesPerTable;
+	std::atomic<uint32_t> nextRange(0);
+	auto FindRanges = [this, distance, rangesPerTable, ranges, &nextRange](Groups &groups)
+	{
+		for (uint32_t range = nextRange++; range < ranges; range = nextRange++)
+		{
+			uint32_t first = (range % rangesPerTable) * VALUES_PER_TASK;
+			FindGroups((int) (range / rangesPerTable), first, first + VALUES_PER_TASK, distance, groups);
+		}
+	};
+
+	ThreadPool &pool = ThreadPool::Get();
+	std::vector<Groups> found(std::max(pool.GetThreadCount(), 1u), Groups(hashes.size()));
+	if (found.size() > 1 && hashes.size() > 1)
+	{
+		TaskGroup group(pool);
+		for (std::size_t task = 0; task < found.size(); task++)
+			group.Run([&FindRanges, &found, task]() { FindRanges(found[task]); });
+		group.Wait();
+	}
+	else if (hashes.size() > 1)
+		FindRanges(found[0]);
+
+	Groups &groups = found[0];
+	for (std::size_t task = 1; task < found.size(); task++)
+	{
+		for (uint32_t id = 0; id < hashes.size(); id++)
+		{
+			uint32_t root = found[task].Find(id);
+			if (root != id)
+			{
+				uint32_t a = groups.Find(id), b = groups.Find(root);
+				if (a != b)
+					groups.Join(a, b);
+			}
+		}
+	}
+
+	std::vector<uint32_t> roots(hashes.size());
+	for (uint32_t id = 0; id < hashes.size(); id++)
+		roots[id] = groups.Find(id);
+	return roots;
+}
+
+//********************
+// Private functions *
+//********************
+
+/* Join the matches in one table among the buckets from 'firstValue' up to (but not including) 'lastValue' into 'groups': the matches within
+ * each bucket, and those between it and every bucket with a chunk value a bit higher, so that every pair of buckets is compared once. Copies
+ * of the same hash are next to each other in a bucket and match exactly the same hashes, so they're joined straight away and only the first of
+ * them is compared with anything, which keeps a library full of identical images (black frames, screenshots) from taking quadratic time */
+void SimilarityIndex::FindGroups(int table, uint32_t firstValue, uint32_t lastValue, int distance, Groups &groups) const
+{
+	distance = std::min(distance, MAXIMUM_DISTANCE);
+	const uint32_t *tableOffsets = offsets[table].data();
+	const uint64_t *tableBuckets = buckets[table].data();
+	const uint32_t *tableIds = ids[table].data();
+
+	// Compare one hash with a run of others, which is the loop that all of the time goes into. A match already in the same group is skipped
+	auto CompareRun = [&](uint32_t i, uint32_t start, uint32_t end)
+	{
+		uint64_t hash = tableBuckets[i];
+		uint32_t root = groups.Find(tableIds[i]);
+		for (uint32_t j = start; j < end; j++)
+		{
+			if (GetDistance(hash, tableBuckets[j]) > distance || (j > start && tableBuckets[j] == tableBuckets[j - 1]))
+				continue;
+			uint32_t other = groups.Find(tableIds[j]);
+			if (other != root)
+				root = groups.Join(root, other);
+		}
+	};
+
+	for (uint32_t value = firstValue; value < lastValue; value++)
+	{
+		uint32_t start = tableOffsets[value], end = tableOffsets[value + 1];
+		for (uint32_t i = start, next; i < end; i = next)
+		{
+			uint32_t root = groups.Find(tableIds[i]);
+			for (next = i + 1; next < end && tableBuckets[next] == tableBuckets[i]; next++)
+			{
+				uint32_t other = groups.Find(tableIds[next]);
+				if (other != root)
+					root = groups.Join(root, other);
+			}
+			CompareRun(i, next, end);
+
+			if (distance < TABLES)
+				continue;
+			for (int bit = 0; bit < CHUNK_BITS; bit++)
+			{
+				uint32_t other = value ^ (1u << bit);
+				if (other > value)
+					CompareRun(i, tableOffsets[other], tableOffsets[other + 1]);
+			}
+		}
+	}
+}
+
+SimilarityIndex::Groups::Groups(std::size_t count) : parents(count)
+{
+	for (uint32_t id = 0; id < count; id++)
+		parents[id] = id;
+}
+
+// The lowest ID in the group of 'id', halving the path to it on the way
+uint32_t SimilarityIndex::Groups::Find(uint32_t id)
+{
+	while (parents[id] != id)
+	{
+		parents[id] = parents[parents[id]];
+		id = parents[id];
+	}
+	return id;
+}
+
+// Join two different groups given by their roots, keeping the lower one, and return it
+uint32_t SimilarityIndex::Groups::Join(uint32_t rootA, uint32_t rootB)
+{
+	if (rootA > rootB)
+		std::swap(rootA, rootB);
+	parents[rootB] = rootA;
+	return rootA;
+}
+
+/* Call 'visit' with the ID of every hash within 'distance' bits, stopping early if it returns true. If no chunk of a hash were within
+ * distance / TABLES bits of the same chunk of 'hash', the hashes would differ by more than 'distance' bits altogether, so only the buckets of
+ * the chunk values that close need to be looked through (just the chunk's own value for distances under TABLES). The buckets are scattered
+ * across the index, so where each one starts is requested from memory for all of them before any are read, which lets the cache misses overlap
+ * instead of being waited for one at a time */
+template <typename Visitor>
+bool SimilarityIndex::Search(uint64_t hash, int distance, Visitor visit) const
+{
+	if (hashes.empty())
+		return false;
+
+	distance = std::min(distance, MAXIMUM_DISTANCE);
+	int probes = (distance >= TABLES) ? CHUNK_BITS + 1 : 1;
+	uint32_t values[TABLES][CHUNK_BITS + 1];
+	for (int table = 0; table < TABLES; table++)
+	{
+		uint32_t chunk = GetChunk(hash, table);
+		for (int probe = 0; probe < probes; probe++)
+		{
+			values[table][probe] = (probe == 0) ? chunk : chunk ^ (1u << (probe - 1));
+			__builtin_prefetch(&offsets[table][values[table][probe]]);
+		}
+	}
+
+	uint32_t starts[TABLES][CHUNK_BITS + 1], ends[TABLES][CHUNK_BITS + 1];
+	for (int table = 0; table < TABLES; table++)
+	{
+		for (int probe = 0; probe < probes; probe++)
+		{
+			starts[table][probe] = offsets[table][values[table][probe]];
+			ends[table][probe] = offsets[table][values[table][probe] + 1];
+			__builtin_prefetch(buckets[table].data() + starts[table][probe]);
+		}
+	}
+
+	for (int table = 0; table < TABLES; table++)
+	{
+		for (int probe = 0; probe < probes; probe++)
+		{
+			for (uint32_t i = starts[table][probe]; i < ends[table][probe]; i++)
+			{
+				if (GetDistance(buckets[table][i], hash) <= distance && visit(ids[table][i]))
+					return true;
+			}
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,60 @@
+// Marcus Schmidt
+// Created on 11/4/23
+
+#ifndef SIMILARITY_INDEX
+#define SIMILARITY_INDEX
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* Finds the perceptual hashes (see PerceptualHashCache) within a small Hamming distance of a given hash, which is how images that look the same
+ * are found. It's a multi-index hash table: every hash is split into TABLES chunks of 16 bits and filed under each of them. Two hashes that
+ * differ in at most MAXIMUM_DISTANCE bits can't differ in two or more bits of every chunk, so at least one of their chunks is within a bit of
+ * the other's, and a search only has to look through 17 buckets in each table instead of every hash. The buckets are stored one after another
+ * in a single array per table, holding copies of the hashes (ordered by hash within each bucket) so that a search compares them in order
+ * instead of looking each one up, which costs 56 bytes per hash altogether (the hash, and a copy and its ID in every table) plus a fixed 1 MB.
+ * Reference: https://www.cs.toronto.edu/~norouzi/research/papers/multi_index_hashing.pdf */
+class SimilarityIndex
+{
+public:
+	void Build(std::vector<uint64_t> _hashes);
+
+	void FindSimilar(uint64_t hash, int distance, std::vector<uint32_t> &matches) const;
+	bool HasSimilar(uint64_t hash, int distance) const;
+	std::vector<uint32_t> FindGroups(int distance) const;
+
+	uint64_t GetHash(uint32_t id) const { return hashes[id]; }
+	std::size_t GetSize() const { return hashes.size(); }
+
+	static int GetDistance(uint64_t a, uint64_t b) { return __builtin_popcountll(a ^ b); }
+
+	constexpr static int TABLES = 4;
+	constexpr static int CHUNK_BITS = 64 / TABLES;
+	constexpr static int MAXIMUM_DISTANCE = 2 * TABLES - 1; // the largest distance that can be found by searching within one bit of each chunk
+	constexpr static int NEAR_DUPLICATE_DISTANCE = 6; // resized, recompressed or re-exported copies of an image rarely differ by more than this
+	constexpr static uint32_t VALUES_PER_TASK = 4096; // chunk values whose buckets are compared in one go by FindGroups()
+
+private:
+	// A union-find over IDs in which every group is represented by its lowest ID
+	struct Groups
+	{
+		std::vector<uint32_t> parents;
+
+		Groups(std::size_t count);
+		uint32_t Find(uint32_t id);
+		uint32_t Join(uint32_t rootA, uint32_t rootB);
+	};
+
+	template <typename Visitor> bool Search(uint64_t hash, int distance, Visitor visit) const;
+	void FindGroups(int table, uint32_t firstValue, uint32_t lastValue, int distance, Groups &groups) const;
+
+	static uint32_t GetChunk(uint64_t hash, int table) { return (uint32_t) (hash >> (table * CHUNK_BITS)) & ((1u << CHUNK_BITS) - 1); }
+
+	std::vector<uint64_t> hashes; // by ID
+	std::vector<uint32_t> offsets[TABLES]; // where the bucket for every chunk value starts in 'buckets' and 'ids'
+	std::vector<uint64_t> buckets[TABLES];
+	std::vector<uint32_t> ids[TABLES];
+};
+
+#endif
@@ -2,9 +2,90 @@
 // Created on 4/16/23
 
 #include "StaticUtilities.h"
+#include "DirectoryReader.h"
+#include "Trace.h"
+#include "CaptureTimeCache.h"
+#include "FingerprintCache.h"
+#include "PerceptualHashCache.h"
+#include "SimilarityIndex.h"
+#ifndef HEADLESS
 #include <wx/dirdlg.h>
+#endif
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <random>
 #include <iostream>
 
+/* The pseudo-random number generator behind ShuffleFiles(): xoshiro256** seeded through splitmix64 (Reference: https://prng.di.unimi.it/).
+ * It's implemented here rather than using <random> because std::uniform_int_distribution isn't required to produce the same numbers with
+ * every standard library, and a seed should give the same order on every platform. */
+class StaticUtilities::ShuffleGenerator
+{
+public:
+	ShuffleGenerator(uint64_t seed)
+	{
+		for (auto &word : state)
+		{
+			seed += 0x9E3779B97F4A7C15;
+			uint64_t z = seed;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+			word = z ^ (z >> 31);
+		}
+	}
+
+	uint64_t Next()
+	{
+		uint64_t result = RotateLeft(state[1] * 5, 7) * 9;
+		uint64_t t = state[1] << 17;
+		state[2] ^= state[0];
+		state[3] ^= state[1];
+		state[1] ^= state[2];
+		state[0] ^= state[3];
+		state[2] ^= t;
+		state[3] = RotateLeft(state[3], 45);
+		return result;
+	}
+
+	// An unbiased number in [0, bound) using Lemire's multiply-and-reject method (Reference: https://arxiv.org/abs/1805.10941)
+	uint64_t Below(uint64_t bound)
+	{
+		__uint128_t product = (__uint128_t) Next() * bound;
+		uint64_t low = (uint64_t) product;
+		if (low < bound)
+		{
+			uint64_t threshold = -bound % bound;
+			while (low < threshold)
+			{
+				product = (__uint128_t) Next() * bound;
+				low = (uint64_t) product;
+			}
+		}
+		return (uint64_t) (product >> 64);
+	}
+
+private:
+	static uint64_t RotateLeft(uint64_t x, int k)
+	{
+		return (x << k) | (x >> (64 - k));
+	}
+
+	uint64_t state[4];
+};
+
+/* The results of scanning one directory in parallel. Each child's images belong after the number of this directory's images in
+ * 'childPositions' at the same index, which is where the serial walk would have recursed into it. */
+struct StaticUtilities::ScanNode
+{
+	std::string path;
+	std::vector<File> images;
+	std::vector<std::unique_ptr<ScanNode>> children;
+	std::vector<std::size_t> childPositions;
+};
+
+#ifndef HEADLESS
 std::string StaticUtilities::ChooseDirectory(wxFrame *parent, std::string message)
 {
 	wxDirDialog *dialog = new wxDirDialog(parent,
@@ -17,124 +98,158 @@ std::string StaticUtilities::ChooseDirectory(wxFrame *parent, std::string messag
 	else
 		return "";
 }
+#endif
 
-std::vector<std::string> StaticUtilities::RecurseGetImages(std::filesystem::path path)
+// If 'directoryTimes' is provided, every directory that was walked is recorded there along with its modification time from before it was read
+std::vector<std::string> StaticUtilities::RecurseGetImages(std::filesystem::path path, std::vector<std::pair<std::string, int64_t>> *directoryTimes)
 {
 	std::vector<std::string> images;
 
-	for (const auto &entry : std::filesystem::directory_iterator(path))
+	if (directoryTimes != nullptr)
+	{
+		int64_t time = 0;
+		DirectoryReader::GetDirectoryTime(path.string(), time);
+		directoryTimes->push_back({ path.string(), time });
+	}
+
+	DirectoryReader reader(path.string());
+	while (reader.Next())
 	{
-		if (entry.is_directory())
+		if (reader.GetType() == DirectoryReader::DIRECTORY)
 		{
-			std::vector<std::string> recursedImages = RecurseGetImages(entry.path());
+			std::vector<std::string> recursedImages = RecurseGetImages(path / reader.GetName(), directoryTimes);
 			images.insert(images.end(), recursedImages.begin(), recursedImages.end());
 		}
-		else if (entry.is_regular_file())
-			images.push_back(entry.path().filename().string());
+		else if (reader.GetType() == DirectoryReader::REGULAR_FILE)
+			images.push_back(reader.GetName());
 	}
+
+	if (reader.Failed())
+		std::cout << "RecurseGetImages(): Unable to read \"" << path.string() << "\"" << std::endl;
 	
 	return images;
 }
 
-std::vector<File> StaticUtilities::RecurseGetImages(std::filesystem::path path, SortMethod sortMethod, const std::vector<FileType> &fileTypes, Directory *directory)
+/* Each sorted batch of images found for this directory is appended to 'runs' so that the caller can merge all of them at once.
+ * If 'roots' is provided, every directory that was scanned is also recorded there along with the filter rules that applied to it. */
+void StaticUtilities::RecurseGetImages(std::filesystem::path path, SortMethod sortMethod, const FileTypeRegistry &fileTypes, Directory *directory, std::vector<std::vector<File>> &runs, std::vector<ScanRoot> *roots)
 {
-	std::vector<File> images;
-
-	// Confirm the provided directory still exists in its expected location
+	/* Confirm the provided directory still exists in its expected location. This is one stat() per configured directory rather than per file,
+	 * and it keeps a directory that has gone missing from computing its filters' items (which walks their source folders) for nothing */
 	if (std::filesystem::is_directory((std::filesystem::path) (path.string() + "/" + directory->name)))
 	{
 		// Gather information about the filter and which items it will (dis)allow for this directory so that it's ready to pass along
-		std::unordered_map<std::string, int> filterItems;
-		bool defaultValidity = true;
+		std::shared_ptr<ScanRules> rules = std::make_shared<ScanRules>();
+		bool &defaultValidity = rules->defaultValidity;
 		if (directory->active && !directory->filters.empty())
 		{
+			std::vector<std::shared_ptr<const std::unordered_map<std::string, int>>> included, excluded;
 			for (auto &filter : directory->filters)
 			{
-				// Combine all of the filter items for INCLUDE filters
-				if (filter->GetType() == Filter::INCLUDE)
+				// Filters that match by content or by looks are applied to the images once they've been collected (see ApplyContentRules())
+				if (filter->GetMatch() == Filter::CONTENT)
+				{
+					if (filter->GetType() == Filter::INCLUDE)
+						rules->includedContent.push_back(filter->GetFilterFingerprints());
+					else if (filter->GetType() == Filter::EXCLUDE)
+						rules->excludedContent.push_back(filter->GetFilterFingerprints());
+				}
+				else if (filter->GetMatch() == Filter::SIMILAR)
 				{
-					defaultValidity = false;
-					std::unordered_map<std::string, int> newItems = filter->GetFilterItems();
-					filterItems.insert(newItems.begin(), newItems.end());
+					if (filter->GetType() == Filter::INCLUDE)
+						rules->includedSimilar.push_back(filter->GetFilterSimilarity());
+					else if (filter->GetType() == Filter::EXCLUDE)
+						rules->excludedSimilar.push_back(filter->GetFilterSimilarity());
 				}
+				else if (filter->GetType() == Filter::INCLUDE)
+					included.push_back(filter->GetFilterItems());
+				else if (filter->GetType() == Filter::EXCLUDE)
+					excluded.push_back(filter->GetFilterItems());
 			}
 
-			for (auto &filter : directory->filters)
+			/* With a single filter that matches by name, its cached set of items is used as it is. Otherwise the INCLUDE filters' items are
+			 * combined and the EXCLUDE filters' items removed from them, or if there are no INCLUDE filters, the EXCLUDE filters' items are combined */
+			defaultValidity = included.empty();
+			std::vector<std::shared_ptr<const std::unordered_map<std::string, int>>> &combined = defaultValidity ? excluded : included;
+			if (combined.size() == 1 && (defaultValidity || excluded.empty()))
+				rules->filterItems = combined.front();
+			else if (!combined.empty())
 			{
-				if (filter->GetType() == Filter::EXCLUDE)
+				std::shared_ptr<std::unordered_map<std::string, int>> filterItems = std::make_shared<std::unordered_map<std::string, int>>();
+				for (const auto &items : combined)
+					filterItems->insert(items->begin(), items->end());
+				if (!defaultValidity)
 				{
-					std::unordered_map<std::string, int> newItems = filter->GetFilterItems();
-
-					// If there are no INCLUDE items, combine all EXLUDE filter items
-					if (defaultValidity)
-						filterItems.insert(newItems.begin(), newItems.end());
-
-					// Otherwise, remove EXCLUDE filter items from the list of INCLUDE
-					else
+					for (const auto &items : excluded)
 					{
-						int count = 0;
-						for (auto iterator = newItems.begin(); iterator != newItems.end();)
-						{
-							// Attempting to erasing from a key returns whether 0 or 1 items were erased
-							if (!filterItems.erase(iterator->first))
-								iterator++;
-							else
-								count++;
-						}
+						for (const auto &item : *items)
+							filterItems->erase(item.first);
 					}
 				}
+				rules->filterItems = filterItems;
 			}
 		}
+		const std::unordered_map<std::string, int> &filterItems = *rules->filterItems;
 
 		// If it has nested subdirectories in the code
 		if (!directory->subdirectories.empty())
 		{
 			// Recurse to get their images
 			for (auto subdirectory : directory->subdirectories)
-			{
-				std::vector<File> recursedImages = RecurseGetImages(path.string() + "/" + directory->name, sortMethod, fileTypes, &subdirectory);
-				StaticUtilities::MergeVectors(images, recursedImages, sortMethod);
-			}
+				RecurseGetImages(path.string() + "/" + directory->name, sortMethod, fileTypes, &subdirectory, runs, roots);
 
 			// And then get the images from this directory if it's active
 			if (directory->active)
 			{
-				for (const auto &entry : std::filesystem::directory_iterator(path))
-				{
-					if (entry.is_regular_file() && IsActiveExtension(fileTypes, entry.path().extension().string()))
-						ProcessImage(entry, images, sortMethod, fileTypes, filterItems, defaultValidity);
-				}
+				std::vector<File> directoryImages;
+				GetDirectoryImages(path.string() + "/" + directory->name, fileTypes, filterItems, defaultValidity, directoryImages);
+				ApplyContentRules(directoryImages, *rules);
+				SortFiles(directoryImages, sortMethod);
+				runs.push_back(std::move(directoryImages));
+
+				if (roots != nullptr)
+					roots->push_back({ path.string() + "/" + directory->name, false, rules });
 			}
 		}
 		// If it does not have nested subdirectories in the code but it is activated
 		else if (directory->active)
 		{
 			// And then recurse with a different method
-			std::vector<File> recursedImages = RecurseGetImages(path.string() + "/" + directory->name, sortMethod, fileTypes, filterItems, defaultValidity);
-			StaticUtilities::MergeVectors(images, recursedImages, sortMethod);
+			runs.push_back(RecurseGetImages(path.string() + "/" + directory->name, sortMethod, fileTypes, filterItems, defaultValidity));
+			ApplyContentRules(runs.back(), *rules);
+
+			if (roots != nullptr)
+				roots->push_back({ path.string() + "/" + directory->name, true, rules });
 		}
 	}
 	else
 		std::cout << "RecurseGetImages(): Directory \"" << (path.string() + "/" + directory->name) << "\" does not exist" << std::endl;
-	
-	return images;
 }
 
-std::vector<File> StaticUtilities::RecurseGetImages(std::filesystem::path path, SortMethod sortMethod, const std::vector<FileType> &fileTypes, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity)
+std::vector<File> StaticUtilities::RecurseGetImages(std::filesystem::path path, SortMethod sortMethod, const FileTypeRegistry &fileTypes, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity)
 {
+	// Gather every valid image in this tree first and then sort them all at once, rather than sorting each image into place as it's found
+	Trace::Span span("ScanTree");
+	if (Trace::IsEnabled())
+		span.SetDetail(path.string());
 	std::vector<File> images;
-
-	for (const auto &entry : std::filesystem::directory_iterator(path))
+	ThreadPool &pool = ThreadPool::Get();
+	if (pool.GetThreadCount() > 1)
 	{
-		if (entry.is_directory())
-		{
-			std::vector<File> recursedImages = RecurseGetImages(entry.path(), sortMethod, fileTypes, filterItems, defaultValidity);
-			StaticUtilities::MergeVectors(images, recursedImages, sortMethod);
-		}
-		else if (entry.is_regular_file() && IsActiveExtension(fileTypes, entry.path().extension().string()))
-			ProcessImage(entry, images, sortMethod, fileTypes, filterItems, defaultValidity);
+		// Scan every subdirectory as its own task and then put the results back together in the same order as the serial walk
+		ScanNode root;
+		root.path = path.string();
+		TaskGroup group(pool);
+		group.Run([&]() { ScanDirectory(&root, fileTypes, filterItems, defaultValidity, group); });
+		group.Wait();
+
+		images.reserve(FlattenScan(&root, images, true));
+		FlattenScan(&root, images, false);
 	}
-	
+	else
+		CollectImages(path.string(), fileTypes, filterItems, defaultValidity, images);
+	SortFiles(images, sortMethod);
+
 	return images;
 }
 
@@ -160,103 +275,337 @@ std::string StaticUtilities::StandardizeImageName(std::string name)
 	else if (pos > 7 && name.substr(pos - 7, 6).compare(" copy ") == 0)
 		name.erase(pos - 7, 7);
 
-	for (int i = 0; i < name.size(); i++)
+	for (std::size_t i = 0; i < name.size(); i++)
 		name[i] = tolower(name[i]);
 
 	return name;
 }
 
-// Merge vector 'b's elements into vector 'a' using the current sort method (based on merge sort algorithm)
-void StaticUtilities::MergeVectors(std::vector<File> &a, const std::vector<File> &b, const SortMethod sortMethod)
+/* Merge any number of sorted runs into a single vector using the current sort method. Every image is moved exactly once into an output
+ * that's allocated up front, so the cost is O(n log k) for n images in k runs (see MergeRuns()). */
+std::vector<File> StaticUtilities::MergeVectors(std::vector<std::vector<File>> &runs, const SortMethod sortMethod)
 {
-	if (b.empty())
-		return;
-
-	// Reserve enough space for the final vector so that it won't be reallocated and invalidate the iterator
-	a.reserve(a.size() + b.size());
+	std::size_t total = 0;
+	for (const auto &run : runs)
+		total += run.size();
+
+	std::vector<File> merged;
+	merged.reserve(total);
+	MergeRuns(runs, sortMethod, [&merged](File &file) { merged.push_back(std::move(file)); });
+	return merged;
+}
 
-	std::vector<File>::iterator iterator = a.begin();
-	int i = 0;
-	while (iterator < a.end() && i < b.size())
+/* Hand every image of the sorted runs to 'output' in merged order (k-way merge with a min-heap of run cursors), without building the merged
+ * list, so a caller that only needs to pass the images along can start before the last one is merged. Each run's memory is released as soon
+ * as it's used up. When two images are equal, the one from the earlier run comes first, matching the order that the runs were collected in. */
+void StaticUtilities::MergeRuns(std::vector<std::vector<File>> &runs, const SortMethod sortMethod, const std::function<void(File &)> &output)
+{
+	Trace::Span span("MergeRuns");
+	FileComparator comparator = GetComparator(sortMethod);
+	if (comparator == nullptr)
 	{
-		// If the next element in vector 'b' is smaller according to the current sort method, insert it in the next spot in vector 'a'
-		if ((sortMethod == SortMethod::NAME && iterator->name.compare(b[i].name) > 0) ||
-		    (sortMethod == SortMethod::DATE && iterator->modifiedTime > b[i].modifiedTime) ||
-			(sortMethod == SortMethod::RANDOM && std::rand() % 2 == 1))
+		std::cout << "MergeRuns(): Unknown sorting method" << std::endl;
+		for (auto &run : runs)
 		{
-			a.insert(iterator, b[i]);
-			i++;
+			for (File &file : run)
+				output(file);
 		}
+		runs.clear();
+		return;
+	}
+
+	// Each cursor points at the next unmerged image of one run
+	struct Cursor
+	{
+		std::size_t run;
+		std::size_t index;
+	};
+
+	// std::push_heap and std::pop_heap keep the largest element on top, so this returns true when 'a' should come out of the heap after 'b'
+	auto after = [&runs, comparator](const Cursor &a, const Cursor &b)
+	{
+		const File &fileA = runs[a.run][a.index];
+		const File &fileB = runs[b.run][b.index];
+		if (comparator(fileB, fileA))
+			return true;
+		else if (comparator(fileA, fileB))
+			return false;
+		else
+			return a.run > b.run;
+	};
 
-		// Move to the next element in vector 'a' (either because it was smaller or because the new element from vector 'b' needs to be skipped)
-		iterator++;
+	std::vector<Cursor> heap;
+	heap.reserve(runs.size());
+	for (std::size_t i = 0; i < runs.size(); i++)
+	{
+		if (!runs[i].empty())
+			heap.push_back({ i, 0 });
 	}
+	std::make_heap(heap.begin(), heap.end(), after);
 
-	// If the end of vector 'a' has been reached but there are still elements in 'b', add them all to the end of 'a'
-	while (i < b.size())
+	while (!heap.empty())
 	{
-		a.push_back(b[i]);
-		i++;
+		std::pop_heap(heap.begin(), heap.end(), after);
+		Cursor &cursor = heap.back();
+		output(runs[cursor.run][cursor.index]);
+
+		// Advance this run and put it back in the heap if it still has images, otherwise free it and drop it
+		cursor.index++;
+		if (cursor.index < runs[cursor.run].size())
+			std::push_heap(heap.begin(), heap.end(), after);
+		else
+		{
+			std::vector<File>().swap(runs[cursor.run]);
+			heap.pop_back();
+		}
 	}
+
+	runs.clear();
 }
 
-void StaticUtilities::ProcessImage(const std::filesystem::directory_entry &file, std::vector<File> &vector, SortMethod sortMethod, const std::vector<FileType> &fileTypes, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity)
+void StaticUtilities::ProcessImage(const CatalogFile &file, uint32_t directory, std::vector<File> &vector, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity)
 {
-	std::string name = file.path().filename().string();
-	std::string nameStandardized = StaticUtilities::StandardizeImageName(name);
-	std::string path = file.path().string().substr(0, file.path().string().length() - name.length());
-
 	// If there is a filter, check whether this image is in the filter and flip its accept state if it's present.
 	// Standardize image name before comparing with filter so names like "image.jpg" and "image copy 2.jpg" will evaluate to equal
 	bool valid = defaultValidity;
-	if (filterItems.find(nameStandardized) != filterItems.end())
+	if (filterItems.find(file.nameStandardized) != filterItems.end())
 		valid = !valid;
+	Trace::Count(Trace::Counter::FILES_SEEN);
+	Trace::Count(valid ? Trace::Counter::FILES_ACCEPTED : Trace::Counter::FILES_FILTERED);
 
+	// The image is only collected here, so the caller is responsible for sorting the vector once it has finished gathering
 	if (valid)
+		vector.push_back(FileTable::Get().AddFile(directory, file.nameStandardized, file.name, file.modifiedTime, file.type));
+}
+
+/* Remove the images that the filters matching by content or by looks don't allow (see Filter::Match), keeping the rest in order. Every image's
+ * fingerprint or perceptual hash is looked up or computed first (see FingerprintCache and PerceptualHashCache). An image whose fingerprint is in
+ * a source folder only counts as the same as the file there once their full hashes agree too, and those comparisons read whole files the first
+ * time, so they're made in batches on the thread pool as well. An image that's still being hashed doesn't look like anything until it has been */
+void StaticUtilities::ApplyContentRules(std::vector<File> &files, const ScanRules &rules)
+{
+	bool content = !rules.includedContent.empty() || !rules.excludedContent.empty();
+	bool similar = !rules.includedSimilar.empty() || !rules.excludedSimilar.empty();
+	if (files.empty() || (!content && !similar))
+		return;
+
+	Trace::Span span("ApplyContentRules");
+	FileTable &table = FileTable::Get();
+	FingerprintCache &cache = FingerprintCache::Get();
+	std::vector<std::string> paths(files.size());
+	std::vector<time_t> modifiedTimes(files.size());
+	for (std::size_t i = 0; i < files.size(); i++)
+	{
+		paths[i] = table.GetPath(files[i]);
+		modifiedTimes[i] = files[i].modifiedTime;
+	}
+
+	std::vector<Fingerprint> fingerprints;
+	if (content)
+		fingerprints = cache.Resolve(paths, modifiedTimes);
+
+	// Only images have perceptual hashes, so videos aren't opened to find that out
+	std::vector<PerceptualHash> looks(files.size(), PerceptualHash{ 0, false });
+	if (similar)
 	{
-		// Struct documentation: https://man7.org/linux/man-pages/man0/sys_stat.h.0p.html
-		struct stat info;
-		time_t time;
-		// Function documentation: https://pubs.opengroup.org/onlinepubs/007908799/xsh/stat.html
-		if (stat(file.path().c_str(), &info) == 0)
+		std::vector<std::size_t> images;
+		std::vector<std::string> imagePaths;
+		std::vector<time_t> imageTimes;
+		for (std::size_t i = 0; i < files.size(); i++)
 		{
-			time = info.st_mtime;
+			if (table.GetType(files[i]) == MediaType::IMAGE)
+			{
+				images.push_back(i);
+				imagePaths.push_back(paths[i]);
+				imageTimes.push_back(modifiedTimes[i]);
+			}
 		}
-		else
+
+		std::vector<PerceptualHash> imageLooks = PerceptualHashCache::Get().Resolve(imagePaths, imageTimes);
+		for (std::size_t i = 0; i < images.size(); i++)
+			looks[images[i]] = imageLooks[i];
+	}
+
+	// Whether any of the source folders in 'sets' holds a file with the same contents as image 'i'
+	auto Matches = [&](std::size_t i, const std::vector<std::shared_ptr<const FingerprintItems>> &sets)
+	{
+		if (sets.empty() || fingerprints[i].size == 0)
+			return false;
+		for (const auto &items : sets)
 		{
-			std::cout << "ProcessImage(): Unable to obtain time for \"" << path << "\"" << std::endl;
-			time = 0;
+			auto match = items->find(fingerprints[i]);
+			if (match == items->end())
+				continue;
+			for (const FingerprintSource &source : match->second)
+			{
+				if (cache.IsSameContent(paths[i], modifiedTimes[i], source.path, source.modifiedTime))
+					return true;
+			}
 		}
+		return false;
+	};
 
-		File image = { nameStandardized, name, path, time, GetMediaType(fileTypes, file.path().extension().string()) };
-		if (sortMethod == SortMethod::NAME)
-			SortAlphabetically(vector, image);
-		else if (sortMethod == SortMethod::DATE)
-			SortByTime(vector, image);
-		else if (sortMethod == SortMethod::RANDOM)
-			SortRandomly(vector, image);
-		else
+	// Whether any of the source folders in 'sets' holds an image that looks the same as image 'i'
+	auto LooksLike = [&](std::size_t i, const std::vector<std::shared_ptr<const SimilarityIndex>> &sets)
+	{
+		if (!looks[i].valid)
+			return false;
+		for (const auto &index : sets)
 		{
-			std::cout << "ProcessImage(): Unknown sorting method" << std::endl;
-			vector.push_back(image);
+			if (index->HasSimilar(looks[i].bits, SimilarityIndex::NEAR_DUPLICATE_DISTANCE))
+				return true;
 		}
+		return false;
+	};
+
+	bool included = rules.includedContent.empty() && rules.includedSimilar.empty();
+	std::vector<char> valid(files.size());
+	auto CheckBatch = [&](std::size_t start)
+	{
+		for (std::size_t i = start; i < std::min(start + FingerprintCache::BATCH_SIZE, files.size()); i++)
+		{
+			valid[i] = (included || Matches(i, rules.includedContent) || LooksLike(i, rules.includedSimilar))
+				&& !Matches(i, rules.excludedContent) && !LooksLike(i, rules.excludedSimilar);
+		}
+	};
+
+	ThreadPool &pool = ThreadPool::Get();
+	if (pool.GetThreadCount() > 1 && files.size() > FingerprintCache::BATCH_SIZE)
+	{
+		TaskGroup group(pool);
+		for (std::size_t start = 0; start < files.size(); start += FingerprintCache::BATCH_SIZE)
+			group.Run([&CheckBatch, start]() { CheckBatch(start); });
+		group.Wait();
 	}
+	else
+	{
+		for (std::size_t start = 0; start < files.size(); start += FingerprintCache::BATCH_SIZE)
+			CheckBatch(start);
+	}
+
+	std::size_t kept = 0;
+	for (std::size_t i = 0; i < files.size(); i++)
+	{
+		if (valid[i])
+			files[kept++] = files[i];
+	}
+	files.resize(kept);
 }
 
-bool StaticUtilities::IsActiveExtension(const std::vector<FileType> &fileTypes, std::string extension)
+/* Keep only the first image (in the current order) of every group of images that look the same, along with every video and every image that
+ * couldn't be decoded or is still being hashed. The images are indexed by their perceptual hashes (see SimilarityIndex), which groups the
+ * near-duplicates on the thread pool. Groups are transitive, so an image that's close to two others puts all three in one group even if those
+ * two are further apart. */
+void StaticUtilities::HideNearDuplicates(std::vector<File> &files)
 {
-	// Convert the extension to all lowercase characters
-	for (int i = 0; i < extension.size(); i++)
-		extension[i] = tolower(extension[i]);
+	Trace::Span span("HideNearDuplicates");
+	FileTable &table = FileTable::Get();
+	std::vector<std::size_t> images;
+	std::vector<std::string> paths;
+	std::vector<time_t> modifiedTimes;
+	for (std::size_t i = 0; i < files.size(); i++)
+	{
+		if (table.GetType(files[i]) == MediaType::IMAGE)
+		{
+			images.push_back(i);
+			paths.push_back(table.GetPath(files[i]));
+			modifiedTimes.push_back(files[i].modifiedTime);
+		}
+	}
+	std::vector<PerceptualHash> looks = PerceptualHashCache::Get().Resolve(paths, modifiedTimes);
 
-	// Compare the file's lowercase extension against the active extensions
-	for (auto type : fileTypes)
+	// IDs in the index follow the order of the list, so the lower ID of two near-duplicates is the one that comes first
+	std::vector<uint64_t> hashes;
+	std::vector<std::size_t> positions;
+	for (std::size_t i = 0; i < images.size(); i++)
 	{
-		if (type.active && extension.compare(type.name) == 0)
-			return true;
+		if (looks[i].valid)
+		{
+			hashes.push_back(looks[i].bits);
+			positions.push_back(images[i]);
+		}
+	}
+	if (hashes.size() < 2)
+		return;
+
+	SimilarityIndex index;
+	index.Build(std::move(hashes));
+
+	// Every group is represented by its earliest image, which is the one that stays
+	std::vector<uint32_t> groups = index.FindGroups(SimilarityIndex::NEAR_DUPLICATE_DISTANCE);
+
+	std::vector<char> hidden(files.size(), 0);
+	for (uint32_t id = 0; id < groups.size(); id++)
+	{
+		if (groups[id] != id)
+			hidden[positions[id]] = 1;
+	}
+
+	std::size_t kept = 0;
+	for (std::size_t i = 0; i < files.size(); i++)
+	{
+		if (!hidden[i])
+			files[kept++] = files[i];
 	}
+	files.resize(kept);
+}
+
+/* Returns the function that decides whether image 'a' belongs before image 'b' for the given sort method, or nullptr if there is no defined order.
+ * A random order is built by shuffling the images after they've been put in name order (see ShuffleFiles()), so it collects them by name */
+StaticUtilities::FileComparator StaticUtilities::GetComparator(SortMethod sortMethod)
+{
+	if (sortMethod == SortMethod::NAME || sortMethod == SortMethod::RANDOM)
+		return CompareNames;
+	else if (sortMethod == SortMethod::DATE)
+		return CompareTimes;
+	else if (sortMethod == SortMethod::CAPTURE_DATE)
+		return CompareCaptureTimes;
+	else
+		return nullptr;
+}
+
+/* Sort a batch of collected images in O(n log n). A stable sort keeps images with equal keys in the order they were collected,
+ * which is the same order that inserting each image after its equals used to produce. */
+void StaticUtilities::SortFiles(std::vector<File> &files, SortMethod sortMethod)
+{
+	Trace::Span span("SortFiles");
+	if (sortMethod == SortMethod::CAPTURE_DATE)
+		CaptureTimeCache::Get().Resolve(files);
 
-	return false;
+	FileComparator comparator = GetComparator(sortMethod);
+	if (comparator != nullptr)
+		std::stable_sort(files.begin(), files.end(), comparator);
+	else
+		std::cout << "SortFiles(): Unknown sorting method" << std::endl;
+}
+
+/* Put the images in a random order with a single Fisher-Yates shuffle. The same seed always produces the same order from the same starting
+ * order, so shuffling the name order with a seed the user can see makes a random order reproducible.
+ * Reference: https://en.wikipedia.org/wiki/Fisher%E2%80%93Yates_shuffle */
+void StaticUtilities::ShuffleFiles(std::vector<File> &files, uint64_t seed)
+{
+	Trace::Span span("ShuffleFiles");
+	ShuffleGenerator generator(seed);
+	for (std::size_t i = files.size(); i > 1; i--)
+		std::swap(files[i - 1], files[generator.Below(i)]);
+}
+
+// Undo ShuffleFiles() with the same seed by replaying its swaps in reverse, which restores the order from before the shuffle in O(n)
+void StaticUtilities::UnshuffleFiles(std::vector<File> &files, uint64_t seed)
+{
+	ShuffleGenerator generator(seed);
+	std::vector<std::size_t> swaps(files.size());
+	for (std::size_t i = files.size(); i > 1; i--)
+		swaps[i - 1] = generator.Below(i);
+
+	for (std::size_t i = 2; i <= files.size(); i++)
+		std::swap(files[i - 1], files[swaps[i - 1]]);
+}
+
+uint64_t StaticUtilities::GetRandomSeed()
+{
+	std::random_device device;
+	return ((uint64_t) device() << 32) ^ device();
 }
 
 template <typename T>
@@ -282,49 +631,116 @@ template void StaticUtilities::SortAlphabetically(std::vector<Directory> &vector
 // Private functions *
 //********************
 
-template <typename T>
-void StaticUtilities::SortRandomly(std::vector<T> &vector, T &element)
+/* Append the valid images directly in this directory to 'images' in directory order, calling 'subdirectory' with the full path of each
+ * subdirectory at the point where it was listed. Both the parallel and the serial walk read directories through here, so a directory that
+ * can't be read is logged (by the ScanCatalog) and skipped the same way in both, and never throws */
+void StaticUtilities::ListImages(const std::string &path, const FileTypeRegistry &fileTypes, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity, std::vector<File> &images, const std::function<void(const std::string &)> &subdirectory)
 {
-	if (vector.size() > 0)
-	{
-		typename std::vector<T>::iterator it = vector.begin();
+	std::shared_ptr<const CatalogDirectory> directory = ScanCatalog::Get().ListDirectory(path, fileTypes);
+	if (directory == nullptr)
+		return;
 
-		// Reference: https://en.cppreference.com/w/cpp/numeric/random/rand
-		std::srand(std::time(nullptr));
-		int index = std::rand() % vector.size();
+	std::string directoryPath = (std::filesystem::path(path) / "").string();
+	uint32_t directoryId = FileTable::Get().AddDirectory(directoryPath);
+	std::size_t next = 0;
+	for (std::size_t i = 0; i <= directory->subdirectories.size(); i++)
+	{
+		// Process the files that were listed before the next subdirectory (or all of the rest after the last one)
+		std::size_t end = (i < directory->subdirectories.size()) ? directory->subdirectoryPositions[i] : directory->files.size();
+		for (; next < end; next++)
+		{
+			const FileType *fileType = fileTypes.Find(directory->files[next].name);
+			if (fileType != nullptr && fileType->active)
+				ProcessImage(directory->files[next], directoryId, images, filterItems, defaultValidity);
+		}
 
-		std::advance(it, index);
-		vector.insert(it, element);
+		if (i < directory->subdirectories.size())
+			subdirectory(directoryPath + directory->subdirectories[i]);
 	}
-	else
-		vector.push_back(element);
 }
 
-void StaticUtilities::SortByTime(std::vector<File> &vector, File &element)
+// Collect the valid images directly in this directory and hand each subdirectory to the thread pool as a new task
+void StaticUtilities::ScanDirectory(ScanNode *node, const FileTypeRegistry &fileTypes, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity, TaskGroup &group)
 {
-	std::vector<File>::iterator it;
-	for (it = vector.begin(); it < vector.end(); it++)
+	ListImages(node->path, fileTypes, filterItems, defaultValidity, node->images, [&](const std::string &path)
 	{
-		// If the current element in the list was modified later, break so the new element is inserted here
-		if ((*it).modifiedTime > element.modifiedTime)
-			break;
+		node->children.push_back(std::make_unique<ScanNode>());
+		node->childPositions.push_back(node->images.size());
+
+		ScanNode *child = node->children.back().get();
+		child->path = path;
+		group.Run([child, &fileTypes, &filterItems, defaultValidity, &group]() { ScanDirectory(child, fileTypes, filterItems, defaultValidity, group); });
+	});
+}
+
+// Move the scanned images into 'images' in the order of the serial walk and return how many there are (or only count them if 'countOnly')
+std::size_t StaticUtilities::FlattenScan(ScanNode *node, std::vector<File> &images, bool countOnly)
+{
+	std::size_t count = 0;
+	std::size_t next = 0;
+	for (std::size_t i = 0; i <= node->children.size(); i++)
+	{
+		// Add this directory's images up until the point where the next child was found (or all of the rest after the last child)
+		std::size_t end = (i < node->children.size()) ? node->childPositions[i] : node->images.size();
+		if (!countOnly)
+			std::move(node->images.begin() + next, node->images.begin() + end, std::back_inserter(images));
+		count += end - next;
+		next = end;
+
+		if (i < node->children.size())
+			count += FlattenScan(node->children[i].get(), images, countOnly);
 	}
 
-	vector.insert(it, element);
+	return count;
+}
+
+// Walk the tree in directory order and append every valid image to 'images' without sorting them
+void StaticUtilities::CollectImages(const std::string &path, const FileTypeRegistry &fileTypes, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity, std::vector<File> &images)
+{
+	ListImages(path, fileTypes, filterItems, defaultValidity, images, [&](const std::string &subdirectory)
+	{
+		CollectImages(subdirectory, fileTypes, filterItems, defaultValidity, images);
+	});
 }
 
-MediaType StaticUtilities::GetMediaType(const std::vector<FileType> &fileTypes, std::string extension)
+// Append the valid images directly inside one directory to 'images' without sorting them or looking in its subdirectories
+void StaticUtilities::GetDirectoryImages(std::string path, const FileTypeRegistry &fileTypes, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity, std::vector<File> &images)
 {
-	// Convert the extension to all lowercase characters
-	for (int i = 0; i < extension.size(); i++)
-		extension[i] = tolower(extension[i]);
+	std::shared_ptr<const CatalogDirectory> directory = ScanCatalog::Get().ListDirectory(path, fileTypes);
+	if (directory == nullptr)
+		return;
 
-	// Compare the file's lowercase extension against the active extensions
-	for (auto fileType : fileTypes)
+	uint32_t directoryId = FileTable::Get().AddDirectory((std::filesystem::path(path) / "").string());
+	for (const auto &file : directory->files)
 	{
-		if (extension.compare(fileType.name) == 0)
-			return fileType.type;
+		const FileType *fileType = fileTypes.Find(file.name);
+		if (fileType != nullptr && fileType->active)
+			ProcessImage(file, directoryId, images, filterItems, defaultValidity);
 	}
+}
 
-	return MediaType::UNKNOWN;
-}
\ No newline at end of file
+// Most names differ within their first 8 bytes, so the key in the list settles the comparison without looking the names up in the table
+bool StaticUtilities::CompareNames(const File &a, const File &b)
+{
+	if (a.nameKey != b.nameKey)
+		return a.nameKey < b.nameKey;
+
+	// A name shorter than 8 bytes is entirely in the key, so equal keys mean equal names
+	if ((a.nameKey & 0xFF) == 0)
+		return false;
+
+	const FileTable &table = FileTable::Get();
+	return table.GetName(a).compare(table.GetName(b)) < 0;
+}
+
+bool StaticUtilities::CompareTimes(const File &a, const File &b)
+{
+	return a.modifiedTime < b.modifiedTime;
+}
+
+// Images without a capture time are sorted by their modification time instead
+bool StaticUtilities::CompareCaptureTimes(const File &a, const File &b)
+{
+	const FileTable &table = FileTable::Get();
+	return table.GetCaptureTime(a) < table.GetCaptureTime(b);
+}
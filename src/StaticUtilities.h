@@ -5,36 +5,63 @@
 #define STATIC_UTILITIES
 
 #include "CustomTypes.h"
+#include "ThreadPool.h"
+#include "ScanCatalog.h"
+#include "FileTable.h"
 #include <string>
 #include <vector>
 #include <filesystem>
+#include <functional>
 #include <unordered_map>
-#include <wx/frame.h>
+#include <utility>
+#include <cstdint>
+
+class wxFrame;
 
 class StaticUtilities
 {
 public:
+#ifndef HEADLESS
 	// Get information from user
 	static std::string ChooseDirectory(wxFrame *parent, std::string message);
+#endif
 
 	// Functions to perform a recursive image search from a directory or filepath
-	static std::vector<std::string> RecurseGetImages(std::filesystem::path path); // gathers all image names without discretion, used only for filters
-	static std::vector<File> RecurseGetImages(std::filesystem::path path, SortMethod sortMethod, const std::vector<FileType> &fileTypes, Directory *directory); // gathers images and recurses based on directory information
-	static std::vector<File> RecurseGetImages(std::filesystem::path path, SortMethod sortMethod, const std::vector<FileType> &fileTypes, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity); // continues from where directory info ends
+	static std::vector<std::string> RecurseGetImages(std::filesystem::path path, std::vector<std::pair<std::string, int64_t>> *directoryTimes = nullptr); // gathers all image names without discretion, used only for filters
+	static void RecurseGetImages(std::filesystem::path path, SortMethod sortMethod, const FileTypeRegistry &fileTypes, Directory *directory, std::vector<std::vector<File>> &runs, std::vector<ScanRoot> *roots = nullptr); // gathers sorted runs of images and recurses based on directory information
+	static std::vector<File> RecurseGetImages(std::filesystem::path path, SortMethod sortMethod, const FileTypeRegistry &fileTypes, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity); // continues from where directory info ends
 
 	// Miscellaneous functions performing standardized or shared operations
 	static int GetUniqueId();
 	static std::string StandardizeImageName(std::string name);
-	static void MergeVectors(std::vector<File> &a, const std::vector<File> &b, const SortMethod sortMethod);
-	static void ProcessImage(const std::filesystem::directory_entry &file, std::vector<File> &vector, SortMethod sortMethod, const std::vector<FileType> &fileTypes, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity);
-	static bool IsActiveExtension(const std::vector<FileType> &fileTypes, std::string extension);
+	static std::vector<File> MergeVectors(std::vector<std::vector<File>> &runs, const SortMethod sortMethod);
+	static void MergeRuns(std::vector<std::vector<File>> &runs, const SortMethod sortMethod, const std::function<void(File &)> &output);
+	static void GetDirectoryImages(std::string path, const FileTypeRegistry &fileTypes, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity, std::vector<File> &images);
+	static void ProcessImage(const CatalogFile &file, uint32_t directory, std::vector<File> &vector, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity);
+	static void ApplyContentRules(std::vector<File> &files, const ScanRules &rules);
+	static void HideNearDuplicates(std::vector<File> &files);
 
+	/* Sorting functions. Images are collected unsorted and then each batch is sorted once with the comparator for the sort method. Sorting by
+	 * capture date looks up every image's capture time first (see CaptureTimeCache) */
+	typedef bool (*FileComparator)(const File &a, const File &b);
+	static FileComparator GetComparator(SortMethod sortMethod);
+	static void SortFiles(std::vector<File> &files, SortMethod sortMethod);
+	static void ShuffleFiles(std::vector<File> &files, uint64_t seed);
+	static void UnshuffleFiles(std::vector<File> &files, uint64_t seed);
+	static uint64_t GetRandomSeed();
 	template <typename T> static void SortAlphabetically(std::vector<T> &vector, T &element);
 
 private:
-	template <typename T> static void SortRandomly(std::vector<T> &vector, T &element);
-	static void SortByTime(std::vector<File> &vector, File &element);
-	static MediaType GetMediaType(const std::vector<FileType> &fileTypes, std::string extension);
+	class ShuffleGenerator;
+	struct ScanNode;
+
+	static void ListImages(const std::string &path, const FileTypeRegistry &fileTypes, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity, std::vector<File> &images, const std::function<void(const std::string &)> &subdirectory);
+	static void ScanDirectory(ScanNode *node, const FileTypeRegistry &fileTypes, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity, TaskGroup &group);
+	static std::size_t FlattenScan(ScanNode *node, std::vector<File> &images, bool countOnly);
+	static void CollectImages(const std::string &path, const FileTypeRegistry &fileTypes, const std::unordered_map<std::string, int> &filterItems, const bool defaultValidity, std::vector<File> &images);
+	static bool CompareNames(const File &a, const File &b);
+	static bool CompareTimes(const File &a, const File &b);
+	static bool CompareCaptureTimes(const File &a, const File &b);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,217 @@
+// Marcus Schmidt
+// Created on 7/8/23
+
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <iostream>
+
+// The index of the pool worker running on this thread, or -1 if this thread isn't part of the pool
+static thread_local int currentWorker = -1;
+
+ThreadPool & ThreadPool::Get()
+{
+	// Reference: https://en.cppreference.com/w/cpp/thread/thread/hardware_concurrency
+	static ThreadPool pool(std::thread::hardware_concurrency());
+	return pool;
+}
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+{
+	// hardware_concurrency() is allowed to return 0 if it can't tell
+	if (threadCount == 0)
+		threadCount = 1;
+
+	nextWorker = 0;
+	for (unsigned int i = 0; i < threadCount; i++)
+		workers.push_back(std::make_unique<Worker>());
+	for (unsigned int i = 0; i < threadCount; i++)
+		threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+
+	for (auto &thread : threads)
+		thread.join();
+}
+
+void ThreadPool::Submit(std::function<void()> task, const TaskGroup *group)
+{
+	// Workers keep their own tasks, and tasks from outside the pool are spread evenly between the workers
+	unsigned int index = (currentWorker >= 0) ? currentWorker : nextWorker++ % workers.size();
+	{
+		std::lock_guard<std::mutex> lock(workers[index]->mutex);
+		workers[index]->tasks.push_back({ std::move(task), group });
+	}
+
+	// The count is changed under the sleep lock so that a worker can't miss the wake-up between checking it and going to sleep
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		queuedCount++;
+	}
+	wakeCondition.notify_one();
+}
+
+/* Only tasks of the group being waited on are run, so a thread waiting on a scan (the GUI thread, say) doesn't end up running some unrelated
+ * long task that was meant for the background, like generating thumbnails */
+bool ThreadPool::RunPendingTask(const TaskGroup *group)
+{
+	std::function<void()> task;
+	unsigned int index = (currentWorker >= 0) ? currentWorker : nextWorker % workers.size();
+	if (PopGroupTask(index, group, task))
+	{
+		task();
+		return true;
+	}
+	else
+		return false;
+}
+
+//********************
+// Private functions *
+//********************
+
+void ThreadPool::WorkerLoop(unsigned int index)
+{
+	currentWorker = index;
+
+	std::function<void()> task;
+	while (true)
+	{
+		if (PopTask(index, task))
+		{
+			task();
+			task = nullptr;
+		}
+		else
+		{
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			wakeCondition.wait(lock, [this] { return stopping || queuedCount > 0; });
+			if (stopping)
+				return;
+		}
+	}
+}
+
+// Take the newest task from this worker's own queue, or steal the oldest task from another worker's queue if it's empty
+bool ThreadPool::PopTask(unsigned int index, std::function<void()> &task)
+{
+	bool found = false;
+	{
+		std::lock_guard<std::mutex> lock(workers[index]->mutex);
+		if (!workers[index]->tasks.empty())
+		{
+			task = std::move(workers[index]->tasks.back().run);
+			workers[index]->tasks.pop_back();
+			found = true;
+		}
+	}
+
+	for (unsigned int i = 1; !found && i < workers.size(); i++)
+	{
+		Worker &victim = *workers[(index + i) % workers.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front().run);
+			victim.tasks.pop_front();
+			found = true;
+		}
+	}
+
+	if (found)
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		queuedCount--;
+	}
+
+	return found;
+}
+
+// Like PopTask(), but only take a task of 'group' (newest-first from this worker's queue, then oldest-first from the others)
+bool ThreadPool::PopGroupTask(unsigned int index, const TaskGroup *group, std::function<void()> &task)
+{
+	bool found = false;
+	for (unsigned int i = 0; !found && i < workers.size(); i++)
+	{
+		Worker &worker = *workers[(index + i) % workers.size()];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (i == 0)
+		{
+			auto match = std::find_if(worker.tasks.rbegin(), worker.tasks.rend(), [group](const Task &queued) { return queued.group == group; });
+			if (match != worker.tasks.rend())
+			{
+				task = std::move(match->run);
+				worker.tasks.erase(std::next(match).base());
+				found = true;
+			}
+		}
+		else
+		{
+			auto match = std::find_if(worker.tasks.begin(), worker.tasks.end(), [group](const Task &queued) { return queued.group == group; });
+			if (match != worker.tasks.end())
+			{
+				task = std::move(match->run);
+				worker.tasks.erase(match);
+				found = true;
+			}
+		}
+	}
+
+	if (found)
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		queuedCount--;
+	}
+
+	return found;
+}
+
+//******************
+// TaskGroup class *
+//******************
+
+void TaskGroup::Run(std::function<void()> task)
+{
+	pending++;
+	pool.Submit([this, task = std::move(task)]()
+	{
+		try
+		{
+			task();
+		}
+		catch (const std::exception &exception)
+		{
+			std::cout << "TaskGroup::Run(): Task failed with \"" << exception.what() << "\"" << std::endl;
+		}
+
+		// Notify under the lock so that the group can't be destroyed by Wait() between the decrement and the notification
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--pending == 0)
+			finished.notify_all();
+	}, this);
+}
+
+void TaskGroup::Wait()
+{
+	/* Help run this group's queued tasks instead of only blocking, which also keeps a worker that waits on its own subtasks from deadlocking
+	 * the pool. Once none are queued, the rest are running elsewhere (and may queue more), so check back shortly */
+	while (pending > 0)
+	{
+		if (!pool.RunPendingTask(this))
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			finished.wait_for(lock, std::chrono::milliseconds(1), [this] { return pending == 0; });
+		}
+	}
+
+	// Wait for the last task to release the lock before this group goes out of scope
+	std::lock_guard<std::mutex> lock(mutex);
+}
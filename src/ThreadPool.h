@@ -0,0 +1,75 @@
+// Marcus Schmidt
+// Created on 7/8/23
+
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+
+/* A work-stealing pool of worker threads sized to the number of cores. Every worker owns a queue of tasks: tasks submitted
+ * from inside a worker go onto its own queue and are taken newest-first, while idle workers steal the oldest task from the
+ * other queues. This keeps recursive work (like scanning subdirectories) local to a thread until another thread runs dry. */
+class ThreadPool
+{
+public:
+	static ThreadPool & Get();
+
+	void Submit(std::function<void()> task, const TaskGroup *group = nullptr);
+	bool RunPendingTask(const TaskGroup *group); // runs one of the group's queued tasks on the calling thread, so a waiting thread can help
+	unsigned int GetThreadCount() { return (unsigned int) threads.size(); }
+
+private:
+	struct Task
+	{
+		std::function<void()> run;
+		const TaskGroup *group; // the group the task was run in, if any
+	};
+
+	struct Worker
+	{
+		std::deque<Task> tasks;
+		std::mutex mutex;
+	};
+
+	ThreadPool(unsigned int threadCount);
+	~ThreadPool();
+
+	void WorkerLoop(unsigned int index);
+	bool PopTask(unsigned int index, std::function<void()> &task);
+	bool PopGroupTask(unsigned int index, const TaskGroup *group, std::function<void()> &task);
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+	std::mutex sleepMutex;
+	std::condition_variable wakeCondition;
+	int queuedCount = 0;
+	bool stopping = false;
+	std::atomic<unsigned int> nextWorker;
+};
+
+// Tracks a set of tasks submitted to the pool (including tasks that they submit themselves) so that a caller can wait on all of them
+class TaskGroup
+{
+public:
+	TaskGroup(ThreadPool &_pool) : pool(_pool) {}
+
+	void Run(std::function<void()> task);
+	void Wait();
+
+private:
+	ThreadPool &pool;
+	std::atomic<int> pending { 0 };
+	std::mutex mutex;
+	std::condition_variable finished;
+};
+
+#endif
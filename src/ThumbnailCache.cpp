@@ -0,0 +1,315 @@
+// Marcus Schmidt
+// Created on 8/26/23
+
+#include "ThumbnailCache.h"
+#include "CacheFile.h"
+#include "ThreadPool.h"
+#include "ExifReader.h"
+#include "ImageOps.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <iostream>
+#include <wx/log.h>
+#include <wx/mstream.h>
+
+ThumbnailCache & ThumbnailCache::Get()
+{
+	static ThumbnailCache cache;
+	return cache;
+}
+
+/* The tasks handed to the pool point at the cache, and the pool may outlive it at exit (or have been destroyed first, in which case it has
+ * already run them), so drop the thumbnails that haven't been started and wait for every task to finish before the members go away */
+ThumbnailCache::~ThumbnailCache()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	queue.clear();
+	listeners.clear();
+	tasksFinished.wait(lock, [this]() { return tasks == 0; });
+}
+
+// Open the cache file, unless it's the one that's already open (every viewer window shares the same cache)
+void ThumbnailCache::Load(std::string _path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_path == path)
+		return;
+
+	Unmap();
+	path = _path;
+	entries.clear();
+	pendingPixels.clear();
+	changed = false;
+	Map();
+}
+
+/* Append the thumbnails that have been generated since the last save to the file and write a new index after them. The index is read from the
+ * end of the file, so a save that's interrupted leaves a file without a valid index that's discarded the next time it's loaded. Once half of
+ * the file is taken up by replaced thumbnails, the whole file is rewritten instead. Any image from GetThumbnail() is invalid afterwards. */
+void ThumbnailCache::Save()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!changed || path.empty())
+		return;
+	changed = false;
+
+	bool rewrite = (data == nullptr || staleBytes > dataSize / 2);
+	std::string writePath = rewrite ? path + ".tmp" : path;
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+	{
+		std::fstream stream;
+		if (rewrite)
+			stream.open(writePath, std::ios::out | std::ios::binary | std::ios::trunc);
+		else
+			stream.open(writePath, std::ios::in | std::ios::out | std::ios::binary);
+
+		// Write the pixels, either after the ones already in the file or (when rewriting) copying the ones that are still in use
+		uint64_t position = rewrite ? 0 : dataSize;
+		stream.seekp(position);
+		std::vector<IndexRecord> index;
+		index.reserve(entries.size());
+		for (auto &item : entries)
+		{
+			Entry &entry = item.second;
+			std::size_t size = (std::size_t) entry.width * entry.height * 3;
+			if (entry.pending || rewrite)
+			{
+				const unsigned char *pixels = entry.pending ? pendingPixels.data() + entry.offset : data + entry.offset;
+				stream.write(reinterpret_cast<const char *>(pixels), size);
+				entry.offset = position;
+				entry.pending = false;
+				position += size;
+			}
+
+			index.push_back({ item.first, entry.modifiedTime, entry.offset, entry.width, entry.height, 0 });
+		}
+
+		uint64_t footer[3] = { (uint64_t) index.size(), position, MAGIC };
+		stream.write(reinterpret_cast<const char *>(index.data()), index.size() * sizeof(IndexRecord));
+		stream.write(reinterpret_cast<const char *>(footer), sizeof(footer));
+		if (!stream)
+			std::cout << "ThumbnailCache::Save(): Unable to write \"" << writePath << "\"" << std::endl;
+	}
+
+	if (rewrite)
+	{
+		std::filesystem::rename(writePath, path, error);
+		if (error)
+			std::cout << "ThumbnailCache::Save(): Unable to replace \"" << path << "\" (" << error.message() << ")" << std::endl;
+	}
+
+	// Everything now comes from the file, so map it again to reach the thumbnails that were just added
+	Unmap();
+	entries.clear();
+	pendingPixels.clear();
+	pendingPixels.shrink_to_fit();
+	Map();
+}
+
+// Save only if enough new thumbnails have built up in memory, which keeps their memory bounded without rewriting the index for every few thumbnails
+void ThumbnailCache::Flush()
+{
+	std::size_t pendingBytes;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pendingBytes = pendingPixels.size();
+	}
+
+	if (pendingBytes >= FLUSH_BYTES)
+		Save();
+}
+
+/* Get the thumbnail of an image if it has been generated. Returns false if it hasn't, and otherwise sets 'image', which isn't valid if the
+ * image couldn't be decoded. A thumbnail from the file uses the mapped memory directly, so the image must be converted (to a bitmap, say)
+ * before the next Save() */
+bool ThumbnailCache::GetThumbnail(const std::string &path, time_t modifiedTime, wxImage &image)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto iterator = entries.find(CacheFile::GetKey(path));
+	if (iterator == entries.end() || iterator->second.modifiedTime != (int64_t) modifiedTime)
+		return false;
+
+	const Entry &entry = iterator->second;
+	if (entry.width == 0)
+		image = wxImage();
+	else if (entry.pending)
+	{
+		// New thumbnails can move around in memory as more are added, so these are copied while the lock is held
+		image = wxImage(entry.width, entry.height, false);
+		std::memcpy(image.GetData(), pendingPixels.data() + entry.offset, (std::size_t) entry.width * entry.height * 3);
+	}
+	else
+		image = wxImage(entry.width, entry.height, const_cast<unsigned char *>(data + entry.offset), true);
+	return true;
+}
+
+/* Generate thumbnails for the images an owner (such as a window) is showing, most important first. Any thumbnails the same owner asked for
+ * earlier that haven't been started are dropped, so scrolling past a page of images doesn't leave it to be generated. 'ready' is called from a
+ * worker thread, with the cache locked, whenever any thumbnail has been generated. */
+void ThumbnailCache::Generate(const void *owner, const std::vector<Request> &requests, std::function<void()> ready)
+{
+	int newJobs = 0;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		listeners[owner] = ready;
+		std::size_t previousSize = queue.size();
+		queue.erase(std::remove_if(queue.begin(), queue.end(), [owner](const Job &job) { return job.owner == owner; }), queue.end());
+		int droppedJobs = (int) (previousSize - queue.size());
+
+		for (const auto &request : requests)
+		{
+			uint64_t key = CacheFile::GetKey(request.path);
+			auto iterator = entries.find(key);
+			if ((iterator != entries.end() && iterator->second.modifiedTime == (int64_t) request.modifiedTime) || generating.count(key) > 0
+				|| std::any_of(queue.begin(), queue.end(), [key](const Job &job) { return job.key == key; }))
+				continue;
+
+			queue.push_back({ key, request.path, request.modifiedTime, owner });
+			newJobs++;
+		}
+
+		// The tasks that were handed out for the dropped jobs will take new ones instead
+		newJobs = std::max(0, newJobs - droppedJobs);
+		tasks += newJobs;
+	}
+
+	for (int i = 0; i < newJobs; i++)
+	{
+		ThreadPool::Get().Submit([this]()
+		{
+			GenerateNext();
+
+			// Notify under the lock so that the cache can't be destroyed between the decrement and the notification
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--tasks == 0)
+				tasksFinished.notify_all();
+		});
+	}
+}
+
+// Stop generating thumbnails for an owner and stop telling it about new ones, which must be done before the owner is destroyed
+void ThumbnailCache::Cancel(const void *owner)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	listeners.erase(owner);
+	queue.erase(std::remove_if(queue.begin(), queue.end(), [owner](const Job &job) { return job.owner == owner; }), queue.end());
+}
+
+//********************
+// Private functions *
+//********************
+
+// Map the file and read its index (the caller must hold the lock). Nothing is kept if the file doesn't end with a valid index
+void ThumbnailCache::Map()
+{
+	dataSize = 0;
+	staleBytes = 0;
+
+	// Thumbnails are read wherever the grid happens to be, so there's no point reading ahead
+	if (file.Open(path, MappedFile::Access::RANDOM))
+		data = file.GetData();
+	std::size_t dataLength = file.GetSize();
+
+	uint64_t footer[3];
+	if (data == nullptr || dataLength < sizeof(footer))
+	{
+		Unmap();
+		return;
+	}
+
+	std::memcpy(footer, data + dataLength - sizeof(footer), sizeof(footer));
+	uint64_t count = footer[0], indexOffset = footer[1];
+	if (footer[2] != MAGIC || indexOffset > dataLength || count > (dataLength - indexOffset) / sizeof(IndexRecord)
+		|| indexOffset + count * sizeof(IndexRecord) + sizeof(footer) != dataLength)
+	{
+		std::cout << "ThumbnailCache::Map(): Discarding unreadable thumbnail cache \"" << path << "\"" << std::endl;
+		Unmap();
+		return;
+	}
+
+	uint64_t usedBytes = 0;
+	entries.reserve(count);
+	for (uint64_t i = 0; i < count; i++)
+	{
+		IndexRecord record;
+		std::memcpy(&record, data + indexOffset + i * sizeof(IndexRecord), sizeof(record));
+		uint64_t size = (uint64_t) record.width * record.height * 3;
+		if (record.width > THUMBNAIL_SIZE || record.height > THUMBNAIL_SIZE || record.offset > indexOffset || size > indexOffset - record.offset)
+			continue;
+
+		entries[record.key] = { record.modifiedTime, record.offset, record.width, record.height, false };
+		usedBytes += size;
+	}
+
+	// Whatever the index doesn't use belongs to thumbnails that were replaced
+	dataSize = indexOffset;
+	staleBytes = dataSize - std::min(usedBytes, dataSize);
+}
+
+// The caller must hold the lock
+void ThumbnailCache::Unmap()
+{
+	file.Close();
+	data = nullptr;
+}
+
+// Generate the most important thumbnail that's still waiting, if there is one
+void ThumbnailCache::GenerateNext()
+{
+	Job job;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (queue.empty())
+			return;
+
+		job = std::move(queue.front());
+		queue.pop_front();
+		generating.insert(job.key);
+	}
+
+	// Let the JPEG handler skip most of the work since only a small image is needed, and read the file in place (see ImagePrefetcher::Decode())
+	Trace::Span span("GenerateThumbnail");
+	span.SetDetail(job.path);
+	wxImage image;
+	bool loaded = false;
+	int orientation = 1;
+	MappedFile file;
+	if (file.Open(job.path))
+	{
+		wxLogNull noLog;
+		wxMemoryInputStream stream(file.GetData(), file.GetSize());
+		ImageOps::LimitDecodeSize(image, wxSize(THUMBNAIL_SIZE, THUMBNAIL_SIZE));
+		loaded = image.LoadFile(stream);
+		orientation = ExifReader::ReadOrientation(file.GetData(), file.GetSize());
+	}
+	file.Close();
+
+	int width = 0, height = 0;
+	if (loaded)
+	{
+		image = ImageOps::Orient(ImageOps::Fit(image, wxSize(THUMBNAIL_SIZE, THUMBNAIL_SIZE)), orientation);
+		width = image.GetWidth();
+		height = image.GetHeight();
+		Trace::Count(Trace::Counter::THUMBNAILS_GENERATED);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	generating.erase(job.key);
+	auto iterator = entries.find(job.key);
+	if (iterator != entries.end() && !iterator->second.pending)
+		staleBytes += (uint64_t) iterator->second.width * iterator->second.height * 3;
+
+	entries[job.key] = { (int64_t) job.modifiedTime, pendingPixels.size(), (uint16_t) width, (uint16_t) height, true };
+	if (loaded)
+		pendingPixels.insert(pendingPixels.end(), image.GetData(), image.GetData() + (std::size_t) width * height * 3);
+	changed = true;
+
+	for (const auto &listener : listeners)
+		listener.second();
+}
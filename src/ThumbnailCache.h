@@ -0,0 +1,104 @@
+// Marcus Schmidt
+// Created on 8/26/23
+
+#ifndef THUMBNAIL_CACHE
+#define THUMBNAIL_CACHE
+
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include "MappedFile.h"
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <wx/image.h>
+
+/* Small copies of images for browsing many of them at once, generated on the thread pool and kept in a single file that's memory-mapped,
+ * so showing a thumbnail that was generated in an earlier session only touches the pages it's stored in. The file holds the pixels of every
+ * thumbnail back to back followed by an index of where each one starts, keyed by a hash of the image's path along with its modification time.
+ * New thumbnails are kept in memory until they're appended to the file, which only rewrites the index. A file that's missing, unreadable or
+ * from another version is discarded (see CacheFile). Everything except generating thumbnails must be called from the GUI thread. */
+class ThumbnailCache
+{
+public:
+	struct Request
+	{
+		std::string path;
+		time_t modifiedTime;
+	};
+
+	static ThumbnailCache & Get();
+
+	void Load(std::string _path);
+	void Save();
+	void Flush();
+
+	bool GetThumbnail(const std::string &path, time_t modifiedTime, wxImage &image);
+	void Generate(const void *owner, const std::vector<Request> &requests, std::function<void()> ready);
+	void Cancel(const void *owner);
+
+	constexpr static int THUMBNAIL_SIZE = 96; // the largest width or height of a thumbnail
+	constexpr static std::size_t FLUSH_BYTES = (std::size_t) 16 << 20; // how many bytes of new thumbnails Flush() lets build up in memory
+
+private:
+	// Where a thumbnail's pixels (RGB, row by row) are stored. An image that couldn't be decoded is recorded with a size of zero
+	struct Entry
+	{
+		int64_t modifiedTime;
+		uint64_t offset; // into the file, or into 'pendingPixels' until the thumbnail has been saved
+		uint16_t width;
+		uint16_t height;
+		bool pending;
+	};
+
+	// One record of the index at the end of the file
+	struct IndexRecord
+	{
+		uint64_t key;
+		int64_t modifiedTime;
+		uint64_t offset;
+		uint16_t width;
+		uint16_t height;
+		uint32_t reserved;
+	};
+
+	struct Job
+	{
+		uint64_t key;
+		std::string path;
+		time_t modifiedTime;
+		const void *owner;
+	};
+
+	ThumbnailCache() {}
+	~ThumbnailCache();
+
+	void Map();
+	void Unmap();
+	void GenerateNext();
+
+	const static uint64_t VERSION = 2; // 2: thumbnails are turned upright
+	const static uint64_t MAGIC = 0x544850484f544f00 | VERSION; // "THPHOTO" and the version
+
+	std::string path;
+	std::unordered_map<uint64_t, Entry> entries;
+	std::vector<unsigned char> pendingPixels;
+	uint64_t dataSize = 0; // where the pixels in the file end and the index begins
+	uint64_t staleBytes = 0; // pixels in the file that belong to thumbnails that have since been replaced
+	MappedFile file;
+	const unsigned char *data = nullptr; // the start of the file, or nullptr if there's no valid file
+	bool changed = false;
+
+	std::deque<Job> queue; // thumbnails waiting to be generated, most important first
+	std::unordered_set<uint64_t> generating;
+	std::unordered_map<const void *, std::function<void()>> listeners;
+	std::size_t tasks = 0; // tasks handed to the pool that haven't finished yet
+	std::condition_variable tasksFinished;
+	std::mutex mutex;
+};
+
+#endif
@@ -0,0 +1,197 @@
+// Marcus Schmidt
+// Created on 8/26/23
+
+#include "ThumbnailGrid.h"
+#include "FileTable.h"
+#include "ThumbnailCache.h"
+#include <wx/dcbuffer.h>
+#include <wx/settings.h>
+#include <algorithm>
+
+ThumbnailGrid::ThumbnailGrid(wxWindow *parent, const std::vector<File> &_files, std::function<void(int, bool)> _onSelect)
+			: wxVScrolledWindow(parent, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxBORDER_NONE), files(_files), onSelect(_onSelect)
+{
+	// Everything is drawn in OnPaint(), so skip erasing the background first to avoid flicker
+	SetBackgroundStyle(wxBG_STYLE_PAINT);
+	FilesChanged();
+}
+
+ThumbnailGrid::~ThumbnailGrid()
+{
+	// The cache reports from worker threads, so make sure nothing is reported to this window once it's gone
+	ThumbnailCache::Get().Cancel(this);
+}
+
+// Update the grid after the list of files has been changed in any way (which also changes what each position holds)
+void ThumbnailGrid::FilesChanged()
+{
+	bitmaps.clear();
+	if (selection >= (int) files.size())
+		selection = 0;
+
+	columns = GetColumnCount();
+	SetRowCount((files.size() + columns - 1) / columns);
+	RefreshAll();
+}
+
+// Highlight a file and scroll to it if it's not on screen
+void ThumbnailGrid::SetSelection(int index)
+{
+	if (index < 0 || index >= (int) files.size())
+		return;
+
+	selection = index;
+	std::size_t row = index / columns;
+	if (row < GetVisibleRowsBegin() || row >= GetVisibleRowsEnd())
+		ScrollToRow(row);
+	Refresh();
+}
+
+void ThumbnailGrid::OnPaint(wxPaintEvent &event)
+{
+	wxAutoBufferedPaintDC dc(this);
+	dc.SetBackground(wxBrush(GetBackgroundColour()));
+	dc.Clear();
+
+	const FileTable &table = FileTable::Get();
+	ThumbnailCache &cache = ThumbnailCache::Get();
+	int left = (GetClientSize().GetWidth() - columns * CELL_SIZE) / 2;
+	std::size_t firstRow = GetVisibleRowsBegin(), lastRow = GetVisibleRowsEnd();
+
+	std::vector<ThumbnailCache::Request> missing;
+	for (std::size_t row = firstRow; row < lastRow; row++)
+	{
+		for (int column = 0; column < columns; column++)
+		{
+			int index = (int) row * columns + column;
+			if (index >= (int) files.size())
+				break;
+
+			// The visible rows always start at the top of the window
+			wxRect cell(left + column * CELL_SIZE, (int) (row - firstRow) * CELL_SIZE, CELL_SIZE, CELL_SIZE);
+			if (index == selection)
+			{
+				dc.SetPen(*wxTRANSPARENT_PEN);
+				dc.SetBrush(wxBrush(wxSystemSettings::GetColour(wxSYS_COLOUR_HIGHLIGHT)));
+				dc.DrawRectangle(cell);
+			}
+
+			auto iterator = bitmaps.find(index);
+			if (iterator == bitmaps.end() && table.GetType(files[index]) == MediaType::IMAGE)
+			{
+				std::string path = table.GetPath(files[index]);
+				wxImage image;
+				if (cache.GetThumbnail(path, files[index].modifiedTime, image))
+					iterator = bitmaps.emplace(index, image.IsOk() ? wxBitmap(image) : wxBitmap()).first;
+				else
+					missing.push_back({ path, files[index].modifiedTime });
+			}
+
+			if (iterator != bitmaps.end() && iterator->second.IsOk())
+			{
+				const wxBitmap &bitmap = iterator->second;
+				dc.DrawBitmap(bitmap, cell.GetX() + (CELL_SIZE - bitmap.GetWidth()) / 2, cell.GetY() + (CELL_SIZE - bitmap.GetHeight()) / 2);
+			}
+			else
+			{
+				// Videos, images that couldn't be decoded and thumbnails that are still being generated get a placeholder
+				int margin = (CELL_SIZE - ThumbnailCache::THUMBNAIL_SIZE) / 2;
+				dc.SetPen(wxPen(wxSystemSettings::GetColour(wxSYS_COLOUR_GRAYTEXT)));
+				dc.SetBrush(*wxTRANSPARENT_BRUSH);
+				dc.DrawRectangle(wxRect(cell).Deflate(margin));
+				if (table.GetType(files[index]) == MediaType::VIDEO)
+				{
+					dc.SetTextForeground(wxSystemSettings::GetColour(wxSYS_COLOUR_GRAYTEXT));
+					dc.DrawLabel("Video", cell, wxALIGN_CENTER);
+				}
+			}
+		}
+	}
+
+	// Let go of the thumbnails that have scrolled more than a page away, so only the ones around the screen are held in memory
+	std::size_t page = lastRow - firstRow;
+	for (auto iterator = bitmaps.begin(); iterator != bitmaps.end();)
+	{
+		std::size_t row = iterator->first / columns;
+		if (row + page < firstRow || row >= lastRow + page)
+			iterator = bitmaps.erase(iterator);
+		else
+			++iterator;
+	}
+
+	/* Generate whatever is missing, which replaces the thumbnails asked for by the previous paint if they haven't started. The cache reports
+	 * from a worker thread, so the redraw is passed back to the GUI thread, which is also where thumbnails are saved once enough have built up */
+	if (!missing.empty())
+	{
+		cache.Generate(this, missing, [this]()
+		{
+			CallAfter([this]()
+			{
+				ThumbnailCache::Get().Flush();
+				Refresh();
+			});
+		});
+	}
+}
+
+void ThumbnailGrid::OnSize(wxSizeEvent &event)
+{
+	// The number of columns depends on the width, so keep the top row's first file at the top as the rows are reflowed
+	event.Skip();
+	if (GetColumnCount() == columns)
+		return;
+
+	std::size_t firstIndex = GetVisibleRowsBegin() * columns;
+	columns = GetColumnCount();
+	bitmaps.clear();
+	SetRowCount((files.size() + columns - 1) / columns);
+	ScrollToRow(firstIndex / columns);
+	RefreshAll();
+}
+
+void ThumbnailGrid::OnLeftDown(wxMouseEvent &event)
+{
+	int index = HitTest(event.GetPosition());
+	if (index >= 0)
+	{
+		SetSelection(index);
+		onSelect(index, false);
+	}
+}
+
+void ThumbnailGrid::OnLeftDoubleClick(wxMouseEvent &event)
+{
+	int index = HitTest(event.GetPosition());
+	if (index >= 0)
+	{
+		SetSelection(index);
+		onSelect(index, true);
+	}
+}
+
+//********************
+// Private functions *
+//********************
+
+int ThumbnailGrid::GetColumnCount() const
+{
+	return std::max(1, GetClientSize().GetWidth() / CELL_SIZE);
+}
+
+// The index of the file under a point in the window, or -1 if there isn't one
+int ThumbnailGrid::HitTest(const wxPoint &position) const
+{
+	int left = (GetClientSize().GetWidth() - columns * CELL_SIZE) / 2;
+	if (position.x < left || position.x >= left + columns * CELL_SIZE || position.y < 0)
+		return -1;
+
+	int index = (int) (GetVisibleRowsBegin() + position.y / CELL_SIZE) * columns + (position.x - left) / CELL_SIZE;
+	return (index < (int) files.size()) ? index : -1;
+}
+
+BEGIN_EVENT_TABLE(ThumbnailGrid, wxVScrolledWindow)
+EVT_PAINT(ThumbnailGrid::OnPaint)
+EVT_SIZE(ThumbnailGrid::OnSize)
+EVT_LEFT_DOWN(ThumbnailGrid::OnLeftDown)
+EVT_LEFT_DCLICK(ThumbnailGrid::OnLeftDoubleClick)
+END_EVENT_TABLE()
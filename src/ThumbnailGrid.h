@@ -0,0 +1,48 @@
+// Marcus Schmidt
+// Created on 8/26/23
+
+#ifndef THUMBNAIL_GRID
+#define THUMBNAIL_GRID
+
+#include "CustomTypes.h"
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <wx/bitmap.h>
+#include <wx/event.h>
+#include <wx/vscroll.h>
+
+/* A grid of thumbnails of every file in the list. Only the rows on screen are drawn, and only their thumbnails are asked for (and generated if
+ * they don't exist yet), so the grid costs the same whether the list holds a hundred images or a hundred thousand. Clicking a thumbnail selects
+ * its file and double-clicking opens it, both of which are reported to the owner. */
+class ThumbnailGrid : public wxVScrolledWindow
+{
+public:
+	ThumbnailGrid(wxWindow *parent, const std::vector<File> &_files, std::function<void(int, bool)> _onSelect);
+	~ThumbnailGrid();
+
+	void FilesChanged();
+	void SetSelection(int index);
+
+	constexpr static int CELL_SIZE = 112; // a thumbnail with a margin around it
+
+private:
+	DECLARE_EVENT_TABLE();
+
+	void OnPaint(wxPaintEvent &event);
+	void OnSize(wxSizeEvent &event);
+	void OnLeftDown(wxMouseEvent &event);
+	void OnLeftDoubleClick(wxMouseEvent &event);
+
+	wxCoord OnGetRowHeight(size_t row) const override { return CELL_SIZE; }
+	int GetColumnCount() const;
+	int HitTest(const wxPoint &position) const;
+
+	const std::vector<File> &files;
+	std::function<void(int, bool)> onSelect;
+	std::unordered_map<int, wxBitmap> bitmaps; // thumbnails of the files on or near the screen, by index in the list
+	int columns = 1; // how many thumbnails fit across the window, as of the last time the rows were laid out
+	int selection = 0;
+};
+
+#endif
@@ -0,0 +1,235 @@
+// Marcus Schmidt
+// Created on 10/14/23
+
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <unordered_map>
+
+/* Everything one thread has recorded. Only its own thread adds to it, but the lock lets the GUI read the totals and export the timeline
+ * while recording carries on (it's never contended otherwise). The counters don't need the lock since they're only ever added to atomically,
+ * which keeps Start() from losing its reset to a count that was in progress */
+struct Trace::ThreadBuffer
+{
+	uint32_t thread;
+	std::mutex mutex;
+	std::vector<Event> events;
+	std::unordered_map<const char *, SpanTotal> totals;
+	std::atomic<uint64_t> counters[(int) Counter::COUNT] = {};
+	uint64_t dropped = 0;
+};
+
+std::atomic<bool> Trace::enabled(false);
+std::atomic<int64_t> Trace::origin(0);
+std::vector<std::unique_ptr<Trace::ThreadBuffer>> Trace::buffers;
+std::mutex Trace::buffersMutex;
+
+void Trace::Span::Begin(const char *_name)
+{
+	name = _name;
+	start = GetTime();
+	active = true;
+}
+
+/* A span that was already running when the recording was restarted only counts from the restart, since everything before it was thrown away
+ * (and would otherwise come before the start of the timeline) */
+void Trace::Span::End()
+{
+	int64_t end = GetTime();
+	ThreadBuffer &buffer = GetBuffer();
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+
+	// Start() moves the origin before it clears the buffers, so once the lock is held the origin is the one for whatever the buffer holds
+	int64_t recordingStart = origin.load(std::memory_order_relaxed);
+	start = std::max(start, recordingStart);
+	int64_t duration = std::max(end - start, (int64_t) 0);
+	start -= recordingStart;
+
+	SpanTotal &total = buffer.totals.try_emplace(name, SpanTotal{ name, 0, 0.0 }).first->second;
+	total.count++;
+	total.milliseconds += duration / 1e6;
+
+	if (buffer.events.size() < MAX_EVENTS)
+		buffer.events.push_back({ name, start, duration, std::move(detail) });
+	else
+		buffer.dropped++;
+}
+
+// Start a new recording
+void Trace::Start()
+{
+	std::lock_guard<std::mutex> lock(buffersMutex);
+	origin = GetTime();
+	for (auto &buffer : buffers)
+	{
+		std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+		buffer->events.clear();
+		buffer->totals.clear();
+		buffer->dropped = 0;
+		for (auto &counter : buffer->counters)
+			counter.store(0, std::memory_order_relaxed);
+	}
+
+	enabled = true;
+}
+
+void Trace::Stop()
+{
+	enabled = false;
+}
+
+/* Write the recording as a JSON trace: a complete ("X") event for every span, the counters as counter ("C") events at the start and
+ * end of the recording, and a name for every thread. Times in the format are in microseconds.
+ * Reference: https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU */
+bool Trace::Export(const std::string &path)
+{
+	std::ofstream stream(path);
+	if (!stream)
+		return false;
+
+	// Paths can hold quotes, backslashes and control characters, which JSON strings can't hold as they are
+	auto escape = [](const std::string &text)
+	{
+		std::string escaped;
+		for (unsigned char c : text)
+		{
+			if (c == '"' || c == '\\')
+				escaped.append({ '\\', (char) c });
+			else if (c < 0x20)
+			{
+				char code[8];
+				std::snprintf(code, sizeof(code), "\\u%04x", c);
+				escaped.append(code);
+			}
+			else
+				escaped.push_back((char) c);
+		}
+		return escaped;
+	};
+
+	// Times are recorded in nanoseconds and written in microseconds, which need every digit to keep spans nested and in order late in a recording
+	stream << std::fixed << std::setprecision(3);
+	stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	int64_t end = 0;
+	uint64_t counts[(int) Counter::COUNT] = {};
+	{
+		std::lock_guard<std::mutex> lock(buffersMutex);
+		for (auto &buffer : buffers)
+		{
+			std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+			stream << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread
+				   << ",\"args\":{\"name\":\"Thread " << buffer->thread << "\"}}";
+			first = false;
+
+			for (const Event &event : buffer->events)
+			{
+				stream << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread << ",\"ts\":"
+					   << event.start / 1e3 << ",\"dur\":" << event.duration / 1e3;
+				if (!event.detail.empty())
+					stream << ",\"args\":{\"detail\":\"" << escape(event.detail) << "\"}";
+				stream << "}";
+				end = std::max(end, event.start + event.duration);
+			}
+			if (buffer->dropped > 0)
+				stream << ",\n{\"name\":\"Spans not kept (over " << MAX_EVENTS << ")\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":" << buffer->thread
+					   << ",\"ts\":" << end / 1e3 << ",\"args\":{\"count\":" << buffer->dropped << "}}";
+
+			for (int i = 0; i < (int) Counter::COUNT; i++)
+				counts[i] += buffer->counters[i].load(std::memory_order_relaxed);
+		}
+	}
+
+	for (int64_t time : { (int64_t) 0, end })
+	{
+		stream << (first ? "" : ",\n") << "{\"name\":\"Counters\",\"ph\":\"C\",\"pid\":1,\"ts\":" << time / 1e3 << ",\"args\":{";
+		first = false;
+		for (int i = 0; i < (int) Counter::COUNT; i++)
+			stream << (i == 0 ? "" : ",") << "\"" << GetName((Counter) i) << "\":" << (time == 0 ? 0 : counts[i]);
+		stream << "}}";
+	}
+	stream << "\n]}\n";
+
+	return (bool) stream;
+}
+
+// The total of a counter across every thread since recording started
+uint64_t Trace::GetCount(Counter counter)
+{
+	uint64_t count = 0;
+	std::lock_guard<std::mutex> lock(buffersMutex);
+	for (auto &buffer : buffers)
+		count += buffer->counters[(int) counter].load(std::memory_order_relaxed);
+	return count;
+}
+
+// The totals of every span across every thread since recording started, the longest first
+std::vector<Trace::SpanTotal> Trace::GetSpanTotals()
+{
+	std::unordered_map<const char *, SpanTotal> combined;
+	{
+		std::lock_guard<std::mutex> lock(buffersMutex);
+		for (auto &buffer : buffers)
+		{
+			std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+			for (const auto &entry : buffer->totals)
+			{
+				SpanTotal &total = combined.try_emplace(entry.first, SpanTotal{ entry.first, 0, 0.0 }).first->second;
+				total.count += entry.second.count;
+				total.milliseconds += entry.second.milliseconds;
+			}
+		}
+	}
+
+	std::vector<SpanTotal> totals;
+	for (const auto &entry : combined)
+		totals.push_back(entry.second);
+	std::sort(totals.begin(), totals.end(), [](const SpanTotal &a, const SpanTotal &b) { return a.milliseconds > b.milliseconds; });
+	return totals;
+}
+
+const char * Trace::GetName(Counter counter)
+{
+	switch (counter)
+	{
+		case Counter::FILES_SEEN: return "Files seen";
+		case Counter::FILES_ACCEPTED: return "Files accepted";
+		case Counter::FILES_FILTERED: return "Files filtered";
+		case Counter::DIRECTORIES_READ: return "Directories read";
+		case Counter::IMAGES_DECODED: return "Images decoded";
+		case Counter::THUMBNAILS_GENERATED: return "Thumbnails generated";
+		default: return "Unknown";
+	}
+}
+
+//********************
+// Private functions *
+//********************
+
+void Trace::Add(Counter counter, uint64_t amount)
+{
+	GetBuffer().counters[(int) counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+// The calling thread's buffer, which is made the first time the thread records anything
+Trace::ThreadBuffer & Trace::GetBuffer()
+{
+	thread_local ThreadBuffer *buffer = nullptr;
+	if (buffer == nullptr)
+	{
+		std::lock_guard<std::mutex> lock(buffersMutex);
+		buffers.push_back(std::make_unique<ThreadBuffer>());
+		buffer = buffers.back().get();
+		buffer->thread = (uint32_t) buffers.size() - 1;
+	}
+	return *buffer;
+}
+
+// Nanoseconds on the steady clock, which recorded times are made relative to the start of the recording from
+int64_t Trace::GetTime()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
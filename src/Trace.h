@@ -0,0 +1,89 @@
+// Marcus Schmidt
+// Created on 10/14/23
+
+#ifndef TRACE
+#define TRACE
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* Records where the time goes in scanning, filtering and decoding: spans that time a scope on whichever thread runs it, and counters of the
+ * files that pass through the scan. Nothing is recorded until Start() is called, and until then a span or a count is a single relaxed atomic
+ * load, so they can stay in the code permanently. Each thread records into its own buffer so that threads never wait on each other. What was
+ * recorded can be written out in Chrome's trace event format (see Export()), which chrome://tracing and https://ui.perfetto.dev display as a
+ * timeline, and summarized while it's being recorded for the viewer's statistics overlay. */
+class Trace
+{
+public:
+	enum class Counter { FILES_SEEN, FILES_ACCEPTED, FILES_FILTERED, DIRECTORIES_READ, IMAGES_DECODED, THUMBNAILS_GENERATED, COUNT };
+
+	// How many times a span with one name was recorded and how long they took altogether
+	struct SpanTotal
+	{
+		const char *name;
+		uint64_t count;
+		double milliseconds;
+	};
+
+	// Times the scope it's declared in. The name must be a string literal, since only the pointer is kept
+	class Span
+	{
+	public:
+		Span(const char *_name) { if (IsEnabled()) Begin(_name); }
+		~Span() { if (active) End(); }
+		Span(const Span &) = delete;
+		Span & operator=(const Span &) = delete;
+
+		void SetDetail(const std::string &text) { if (active) detail = text; } // shown with the span in the timeline, such as the path it worked on
+
+	private:
+		void Begin(const char *_name);
+		void End();
+
+		const char *name = nullptr;
+		int64_t start = 0;
+		bool active = false;
+		std::string detail;
+	};
+
+	static bool IsEnabled() { return enabled.load(std::memory_order_relaxed); }
+	static void Count(Counter counter, uint64_t amount = 1) { if (IsEnabled()) Add(counter, amount); }
+
+	static void Start(); // throws away anything recorded before
+	static void Stop();
+	static bool Export(const std::string &path);
+
+	static uint64_t GetCount(Counter counter);
+	static std::vector<SpanTotal> GetSpanTotals();
+	static const char * GetName(Counter counter);
+
+	constexpr static std::size_t MAX_EVENTS = 1 << 18; // spans kept per thread for the timeline; later ones are only added to the totals
+
+private:
+	struct Event
+	{
+		const char *name;
+		int64_t start;
+		int64_t duration;
+		std::string detail;
+	};
+
+	struct ThreadBuffer;
+
+	static void Add(Counter counter, uint64_t amount);
+	static ThreadBuffer & GetBuffer();
+	static int64_t GetTime();
+
+	static std::atomic<bool> enabled;
+	static std::atomic<int64_t> origin; // when recording started, which the recorded times count from
+
+	// Buffers are kept until the program ends, so that the spans of a thread that has finished can still be exported
+	static std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+	static std::mutex buffersMutex;
+};
+
+#endif